@@ -4,20 +4,27 @@
 #include <cmath>
 
 void Application::Run() {
-    InitWindow();
+    if (!m_Headless) {
+        InitWindow();
+    }
     InitVulkan();
     m_Lights.red = glm::vec4( std::cos(M_PI / 180 * -40), std::sin(M_PI / 180 * -40), 0.8f, 1.0f);
     m_Lights.green = glm::vec4(std::cos(M_PI / 180 * 220), std::sin(M_PI / 180 * 220), 0.8f, 1.0f);
     m_Lights.blue = glm::vec4(std::cos(/*M_PI / 180 * 240 */0), std::sin(/*M_PI / 180 * 240*/ 0), 2.0f, 1.0f);
 
     RaytracedModel skull({ "models/skull.obj", "models/jaw.obj", "models/teethUpper.obj", "models/teethLower.obj" });
-    skull.AddInstance(glm::vec3(0.0f, 10.0f, 1.0f), glm::vec3(4.f, 4.f, 4.f), glm::vec3(0.0f, 1.0f, 0.0f));
+    skull.AddInstance(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(4.f, 4.f, 4.f), glm::vec3(0.0f, 1.0f, 0.0f));
     skull.PrepareForRayTracing();
     m_Models.push_back(&skull);
+    m_VkFactory->DumpMemoryStatistics();
 
     m_Camera.m_Position = glm::vec3(0.0f, -1.0f, 13.0f);
     m_Camera.m_LookAt = glm::vec3(0.0f, -1.0, 2.0f);
-    MainLoop();
+    if (m_Headless) {
+        HeadlessLoop();
+    } else {
+        MainLoop();
+    }
     Cleanup();
 }
 
@@ -51,7 +58,12 @@ void Application::InitWindow() {
 
 void Application::InitVulkan() {
     m_VkFactory = VulkanFactory::GetInstance();
-    m_VkFactory->InitVulkan(m_Window);
+    if (m_Headless) {
+        // two images keep the CPU recording one frame while the GPU renders the other
+        m_VkFactory->InitVulkanHeadless(m_HeadlessWidth, m_HeadlessHeight, 2);
+    } else {
+        m_VkFactory->InitVulkan(m_Window);
+    }
 }
 
 void Application::RecordCommandBuffers(uint32_t index) {
@@ -128,10 +140,12 @@ void Application::RecordCommandBuffers(uint32_t index) {
     } else {
         vkCmdWriteTimestamp(m_VkFactory->GetCommandBuffer(index), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_VkFactory->GetQueryPool(), index * 2);
         static float rot = 0;
-        if (m_UseLtc) {
-            rot += 0.006f;
-        } else {
-            rot += 0.01f;
+        if (!m_Paused) {
+            if (m_UseLtc) {
+                rot += 0.006f;
+            } else {
+                rot += 0.01f;
+            }
         }
         float alphas[] = { 0.1, 0.5, 0.9 };
         m_UseLtc = static_cast<int>(rot) % 2;
@@ -143,7 +157,10 @@ void Application::RecordCommandBuffers(uint32_t index) {
         }
         prevax = ax; prevay = ay;
         m_Models[0]->SetConstants(m_UseLtc, ax, ay);
+        m_Models[0]->SetSampleSequence(m_SampleSequence);
+        m_Models[0]->SetCheckerboard(m_Checkerboard);
         m_Models[0]->Raytrace(m_VkFactory->GetCommandBuffer(index), m_Camera.GetViewMatrix(), rot, index);
+        m_Models[0]->Denoise(m_VkFactory->GetCommandBuffer(index), index);
 
         // postprocess
 
@@ -195,6 +212,21 @@ void Application::KeyboardInputCallback(GLFWwindow* window, int key, int scancod
 
         }
     }
+    else if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+        // a still scene lets the ray traced image converge
+        app->m_Paused = !app->m_Paused;
+    }
+    else if (key == GLFW_KEY_N && action == GLFW_PRESS) {
+        // cycles the BRDF sample sequences to compare their noise on the same scene
+        const char *names[] = { "random", "sobol", "r2" };
+        uint32_t next = (static_cast<uint32_t>(app->m_SampleSequence) + 1) % static_cast<uint32_t>(SampleSequence::Count);
+        app->m_SampleSequence = static_cast<SampleSequence>(next);
+        std::cout << "sample sequence: " << names[next] << std::endl;
+    }
+    else if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+        app->m_Checkerboard = !app->m_Checkerboard;
+        std::cout << "checkerboard: " << (app->m_Checkerboard ? "on" : "off") << std::endl;
+    }
     int state = glfwGetKey(window, GLFW_KEY_W);
     if (state == GLFW_PRESS) {
         app->m_Camera.MovePosition(MoveDirection::up);
@@ -293,6 +325,53 @@ void Application::MainLoop() {
     }
 }
 
+void Application::HeadlessLoop() {
+    uint32_t imageCount = static_cast<uint32_t>(m_VkFactory->GetSwapchainImages().size());
+    uint32_t imageIndex = 0;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (uint32_t frame = 0; frame < m_HeadlessFrames; ++frame) {
+        imageIndex = frame % imageCount;
+        if (vkWaitForFences(m_VkFactory->GetDevice(), 1, &m_VkFactory->GetCmdBuffFence(imageIndex), VK_TRUE, UINT64_MAX) != VK_SUCCESS) {
+            throw std::runtime_error("failed to wait for frame fence");
+        }
+        if (frame >= imageCount) {
+            m_VkFactory->FetchRenderTimeResults(imageIndex);
+        }
+
+        RecordCommandBuffers(imageIndex);
+        VkSubmitInfo submitInfo = {
+            VK_STRUCTURE_TYPE_SUBMIT_INFO,                          // sType
+            nullptr,                                                // pNext
+            0,                                                      // waitSemaphoreCount
+            nullptr,                                                // pWaitSemaphores
+            nullptr,                                                // pWaitDstStageMask
+            1,                                                      // commandBufferCount
+            &m_VkFactory->GetCommandBuffer(imageIndex),             // pCommandBuffers
+            0,                                                      // signalSemaphoreCount
+            nullptr                                                 // pSignalSemaphores
+        };
+        vkResetFences(m_VkFactory->GetDevice(), 1, &m_VkFactory->GetCmdBuffFence(imageIndex));
+        if (vkQueueSubmit(m_VkFactory->GetQueue(), 1, &submitInfo, m_VkFactory->GetCmdBuffFence(imageIndex)) != VK_SUCCESS) {
+            throw std::runtime_error("queue submit failed");
+        }
+    }
+    vkDeviceWaitIdle(m_VkFactory->GetDevice());
+    auto end = std::chrono::high_resolution_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    if (m_HeadlessFrames > 0) {
+        std::cout << "headless: " << m_HeadlessFrames << " frames at " << m_HeadlessWidth << "x" << m_HeadlessHeight
+            << ", avg " << seconds * 1000.0 / m_HeadlessFrames << " ms/frame, "
+            << m_HeadlessFrames / seconds << " fps" << std::endl;
+    }
+
+    if (!m_CapturePath.empty() && m_HeadlessFrames > 0) {
+        m_VkFactory->ReadbackImage(imageIndex, m_CapturePath);
+        std::cout << "captured last frame to " << m_CapturePath << std::endl;
+    }
+}
+
 void Application::DrawFrame() {
     VkResult result;
     uint32_t imageIndex;
@@ -372,6 +451,8 @@ void Application::Cleanup() {
 
     m_VkFactory->Cleanup();
 
-    glfwDestroyWindow(m_Window);
-    glfwTerminate();
+    if (!m_Headless) {
+        glfwDestroyWindow(m_Window);
+        glfwTerminate();
+    }
 }
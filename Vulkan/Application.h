@@ -18,6 +18,16 @@ class Application {
 
 public:
     void Run();
+    void SetHeadless(uint32_t width, uint32_t height, uint32_t frameCount, const std::string& capturePath) {
+        m_Headless = true;
+        m_HeadlessWidth = width;
+        m_HeadlessHeight = height;
+        m_HeadlessFrames = frameCount;
+        m_CapturePath = capturePath;
+    }
+    void SetCheckerboard(bool checkerboard) {
+        m_Checkerboard = checkerboard;
+    }
 
 private:
     VulkanFactory* m_VkFactory;
@@ -27,6 +37,9 @@ private:
     LightsPositions m_Lights;
     float m_LightsMoveX = 0.0f, m_LightsMoveY = 0.0f;
     bool m_UseLtc = true;
+    bool m_Paused = false;
+    SampleSequence m_SampleSequence = SampleSequence::Sobol;
+    bool m_Checkerboard = false;
     bool m_IsFullscreen;
 
     bool framebufferResized = false;
@@ -34,6 +47,11 @@ private:
 
     bool m_rtEnabled = true;
 
+    bool m_Headless = false;
+    uint32_t m_HeadlessWidth = DEFAULT_WIDTH, m_HeadlessHeight = DEFAULT_HEIGHT;
+    uint32_t m_HeadlessFrames = 0;
+    std::string m_CapturePath;
+
     void InitWindow();
     static void FramebufferResizeCallback(GLFWwindow*, int, int);
     static void KeyboardInputCallback(GLFWwindow*, int, int, int, int);
@@ -44,6 +62,7 @@ private:
     void RecordCommandBuffers(uint32_t index);
     
     void MainLoop();
+    void HeadlessLoop();
     void DrawFrame();
     void Cleanup();
 };
\ No newline at end of file
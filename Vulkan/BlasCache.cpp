@@ -0,0 +1,51 @@
+#include "BlasCache.h"
+#include "MappedFile.h"
+#include <cstdio>
+#include <cstring>
+
+static_assert(sizeof(BlasCacheHeader) == 24, "BLAS cache header layout changed");
+
+bool BlasCache::Load(const std::string &cachePath, uint64_t geometryHash, std::vector<uint8_t> &serialized) {
+    MappedFile cache;
+    if (!cache.Open(cachePath) || cache.GetSize() < sizeof(BlasCacheHeader)) {
+        return false;
+    }
+    BlasCacheHeader header;
+    memcpy(&header, cache.GetData(), sizeof(header));
+
+    if (header.magic != Magic || header.version != Version || header.geometryHash != geometryHash
+        || header.serializedSize == 0 || cache.GetSize() != sizeof(BlasCacheHeader) + header.serializedSize) {
+        return false;
+    }
+
+    const uint8_t *blob = cache.GetData() + sizeof(BlasCacheHeader);
+    serialized.assign(blob, blob + header.serializedSize);
+    return true;
+}
+
+void BlasCache::Store(const std::string &cachePath, uint64_t geometryHash, const void *serialized, size_t size) {
+    BlasCacheHeader header{
+        Magic,                                                      // magic
+        Version,                                                    // version
+        geometryHash,                                               // geometryHash
+        size                                                        // serializedSize
+    };
+
+    // written under a temporary name first so an interrupted write never leaves a cache that looks valid
+    std::string tempPath = cachePath + ".tmp";
+    {
+        std::ofstream fout(tempPath, std::ios::binary | std::ios::trunc);
+        if (!fout.is_open()) {
+            return;
+        }
+        fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        fout.write(static_cast<const char*>(serialized), (std::streamsize)size);
+        if (!fout) {
+            fout.close();
+            std::remove(tempPath.c_str());
+            return;
+        }
+    }
+    std::remove(cachePath.c_str());
+    std::rename(tempPath.c_str(), cachePath.c_str());
+}
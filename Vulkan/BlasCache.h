@@ -0,0 +1,24 @@
+#pragma once
+
+#include "CommonHeaders.h"
+
+struct BlasCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t geometryHash;
+    uint64_t serializedSize;
+};
+
+// A serialized bottom level structure stored as <model>.blas: header, then the blob the driver wrote, which starts
+// with the driver and compatibility UUIDs the device has to accept before it is deserialized. The cache is valid only
+// while the hash of the geometry and build inputs matches the one recorded in the header.
+class BlasCache {
+public:
+    static constexpr uint32_t Magic = 0x53414c42;           // "BLAS"
+    static constexpr uint32_t Version = 1;
+
+    static std::string GetCachePath(const std::string &sourcePath) { return sourcePath + ".blas"; }
+
+    static bool Load(const std::string &cachePath, uint64_t geometryHash, std::vector<uint8_t> &serialized);
+    static void Store(const std::string &cachePath, uint64_t geometryHash, const void *serialized, size_t size);
+};
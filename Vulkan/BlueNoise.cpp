@@ -0,0 +1,108 @@
+#include "BlueNoise.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <random>
+
+std::vector<float> BlueNoise::Generate(uint32_t seed) {
+    static_assert((Size & (Size - 1)) == 0, "the torus wraps by masking");
+    const uint32_t Mask = Size - 1;
+    const uint32_t count = Size * Size;
+
+    // gaussian of the toroidal offset, row major by (dy, dx)
+    std::vector<float> kernel(count);
+    for (uint32_t y = 0; y < Size; ++y) {
+        for (uint32_t x = 0; x < Size; ++x) {
+            float dx = static_cast<float>(std::min(x, Size - x));
+            float dy = static_cast<float>(std::min(y, Size - y));
+            kernel[y * Size + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * Sigma * Sigma));
+        }
+    }
+
+    // energy of a texel is the kernel summed over the set texels, kept up to date on every change
+    std::vector<uint8_t> pattern(count, 0);
+    std::vector<float> energy(count, 0.0f);
+    auto toggle = [&](uint32_t p, bool set) {
+        pattern[p] = set;
+        float sign = set ? 1.0f : -1.0f;
+        uint32_t px = p & Mask, py = p / Size;
+        for (uint32_t y = 0; y < Size; ++y) {
+            const float *row = &kernel[((y - py) & Mask) * Size];
+            float *target = &energy[y * Size];
+            for (uint32_t x = 0; x < Size; ++x) {
+                target[x] += sign * row[(x - px) & Mask];
+            }
+        }
+    };
+    // the set texel with the most energy and the free texel with the least
+    auto tightestCluster = [&]() {
+        uint32_t best = 0;
+        float bestEnergy = -FLT_MAX;
+        for (uint32_t p = 0; p < count; ++p) {
+            if (pattern[p] && energy[p] > bestEnergy) {
+                bestEnergy = energy[p];
+                best = p;
+            }
+        }
+        return best;
+    };
+    auto largestVoid = [&]() {
+        uint32_t best = 0;
+        float bestEnergy = FLT_MAX;
+        for (uint32_t p = 0; p < count; ++p) {
+            if (!pattern[p] && energy[p] < bestEnergy) {
+                bestEnergy = energy[p];
+                best = p;
+            }
+        }
+        return best;
+    };
+
+    std::mt19937 random(seed);
+    uint32_t initialCount = static_cast<uint32_t>(count * InitialDensity);
+    for (uint32_t placed = 0; placed < initialCount;) {
+        uint32_t p = random() % count;
+        if (!pattern[p]) {
+            toggle(p, true);
+            ++placed;
+        }
+    }
+
+    // move the tightest cluster into the largest void until it stays where it is
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t cluster = tightestCluster();
+        toggle(cluster, false);
+        uint32_t hole = largestVoid();
+        toggle(hole, true);
+        if (hole == cluster) {
+            break;
+        }
+    }
+
+    std::vector<uint32_t> ranks(count);
+    std::vector<uint8_t> initialPattern = pattern;
+    std::vector<float> initialEnergy = energy;
+
+    // below the initial pattern: take out the tightest clusters, the last one removed ranks first
+    for (uint32_t rank = initialCount; rank > 0; --rank) {
+        uint32_t cluster = tightestCluster();
+        toggle(cluster, false);
+        ranks[cluster] = rank - 1;
+    }
+
+    // above it: fill the largest voids; past half the texels this is the tightest cluster of the free ones,
+    // their energy being a constant minus the energy of the set ones
+    pattern = initialPattern;
+    energy = initialEnergy;
+    for (uint32_t rank = initialCount; rank < count; ++rank) {
+        uint32_t hole = largestVoid();
+        toggle(hole, true);
+        ranks[hole] = rank;
+    }
+
+    std::vector<float> values(count);
+    for (uint32_t p = 0; p < count; ++p) {
+        values[p] = (ranks[p] + 0.5f) / count;
+    }
+    return values;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "CommonHeaders.h"
+
+// Tileable blue noise by void and cluster (Ulichney 93). Every texel gets its rank in a dithering order in
+// which each prefix is spread as evenly as possible over the torus, so thresholds taken from the texture
+// have no low frequency clumps and neighbouring texels differ as much as they can.
+class BlueNoise {
+public:
+    static constexpr uint32_t Size = 64;
+
+    // Size * Size values in (0, 1), row major; different seeds give independent textures
+    static std::vector<float> Generate(uint32_t seed);
+
+private:
+    // width of the gaussian that measures how clustered a texel is, in texels
+    static constexpr float Sigma = 1.5f;
+    // share of texels set in the initial pattern
+    static constexpr float InitialDensity = 0.1f;
+};
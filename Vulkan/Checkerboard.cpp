@@ -0,0 +1,158 @@
+#include "Checkerboard.h"
+
+void Checkerboard::Init(VkDescriptorSetLayout rtDescriptorSetLayout, uint32_t targetCount) {
+    m_VkFactory = VulkanFactory::GetInstance();
+    m_HistoryColor.resize(targetCount);
+    m_HistoryGBuffer.resize(targetCount);
+    CreateImages();
+    CreateDescriptorSets();
+
+    std::vector<VkDescriptorSetLayout> layouts{ rtDescriptorSetLayout, m_DescriptorSetLayout };
+    std::vector<VkPushConstantRange> pushConstantRanges{ {
+        VK_SHADER_STAGE_COMPUTE_BIT,                                // stageFlags
+        0,                                                          // offset
+        sizeof(CheckerboardConstants)                               // size
+    } };
+    m_VkFactory->CreateGraphicsPipelineLayout(layouts, pushConstantRanges, m_PipelineLayout);
+    m_VkFactory->CreateComputePipeline("shaders/checkerboardComp.spv", m_PipelineLayout, m_Pipeline);
+    m_HistoryValid.assign(targetCount, false);
+}
+
+void Checkerboard::Cleanup() {
+    vkDestroyPipeline(m_VkFactory->GetDevice(), m_Pipeline, nullptr);
+    vkDestroyPipelineLayout(m_VkFactory->GetDevice(), m_PipelineLayout, nullptr);
+    vkDestroyDescriptorPool(m_VkFactory->GetDevice(), m_DescriptorPool, nullptr);
+    vkDestroyDescriptorSetLayout(m_VkFactory->GetDevice(), m_DescriptorSetLayout, nullptr);
+    DestroyImages();
+}
+
+void Checkerboard::Resize() {
+    DestroyImages();
+    CreateImages();
+    UpdateDescriptorSets();
+    Reset();
+}
+
+void Checkerboard::CreateImages() {
+    m_Width = m_VkFactory->GetExtent().width;
+    m_Height = m_VkFactory->GetExtent().height;
+    for (uint32_t i = 0; i < m_HistoryColor.size(); ++i) {
+        CreateStorageImage(m_HistoryColor[i]);
+        CreateStorageImage(m_HistoryGBuffer[i]);
+    }
+}
+
+void Checkerboard::DestroyImages() {
+    for (uint32_t i = 0; i < m_HistoryColor.size(); ++i) {
+        for (StorageImage *image : { &m_HistoryColor[i], &m_HistoryGBuffer[i] }) {
+            vkDestroyImageView(m_VkFactory->GetDevice(), image->view, nullptr);
+            vkDestroyImage(m_VkFactory->GetDevice(), image->image, nullptr);
+            m_VkFactory->FreeMemory(image->memory);
+        }
+    }
+}
+
+void Checkerboard::CreateStorageImage(StorageImage &image) {
+    m_VkFactory->CreateImage(m_Width, m_Height, 1, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_STORAGE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image.image, image.memory, 1, 0);
+    m_VkFactory->TransitionImageLayout(image.image, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 1);
+    image.view = m_VkFactory->CreateImageView(image.image, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_2D, 1);
+}
+
+void Checkerboard::CreateDescriptorSets() {
+    // history color and G-buffer
+    std::vector<VkDescriptorSetLayoutBinding> bindings;
+    for (uint32_t binding = 0; binding < 2; ++binding) {
+        bindings.push_back({
+            binding,                                                // binding
+            VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,                       // descriptorType
+            1,                                                      // descriptorCount
+            VK_SHADER_STAGE_COMPUTE_BIT,                            // stageFlags
+            nullptr                                                 // pImmutableSamplers
+        });
+    }
+    m_VkFactory->CreateDescriptorSetLayout(bindings, m_DescriptorSetLayout);
+
+    std::vector<VkDescriptorPoolSize> poolSizes = { {
+        VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,                           // type
+        static_cast<uint32_t>(
+            m_HistoryColor.size() * bindings.size())                // descriptorCount
+    } };
+    m_VkFactory->CreateDescriptorPool(poolSizes, m_DescriptorPool);
+
+    std::vector<VkDescriptorSetLayout> layouts(m_HistoryColor.size(), m_DescriptorSetLayout);
+    m_DescriptorSets.resize(layouts.size());
+    VkDescriptorSetAllocateInfo allocateInfo = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,             // sType
+        nullptr,                                                    // pNext
+        m_DescriptorPool,                                           // descriptorPool
+        static_cast<uint32_t>(layouts.size()),                      // descriptorSetCount
+        layouts.data()                                              // pSetLayouts
+    };
+    if (vkAllocateDescriptorSets(m_VkFactory->GetDevice(), &allocateInfo, m_DescriptorSets.data()) != VK_SUCCESS) {
+        throw std::runtime_error("cannot allocate descriptor sets");
+    }
+    UpdateDescriptorSets();
+}
+
+void Checkerboard::UpdateDescriptorSets() {
+    for (uint32_t target = 0; target < m_DescriptorSets.size(); ++target) {
+        std::array<VkDescriptorImageInfo, 2> imageInfos = { {
+            { {}, m_HistoryColor[target].view, VK_IMAGE_LAYOUT_GENERAL },
+            { {}, m_HistoryGBuffer[target].view, VK_IMAGE_LAYOUT_GENERAL }
+        } };
+
+        std::array<VkWriteDescriptorSet, 2> writeDescriptorSet{};
+        for (uint32_t j = 0; j < imageInfos.size(); ++j) {
+            writeDescriptorSet[j] = {
+                VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,             // sType
+                nullptr,                                            // pNext
+                m_DescriptorSets[target],                           // dstSet
+                j,                                                  // dstBinding
+                0,                                                  // dstArrayElement
+                1,                                                  // descriptorCount
+                VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,                   // descriptorType
+                &imageInfos[j],                                     // pImageInfo
+                nullptr,                                            // pBufferInfo
+                nullptr                                             // pTexelBufferView
+            };
+        }
+        vkUpdateDescriptorSets(m_VkFactory->GetDevice(), static_cast<uint32_t>(writeDescriptorSet.size()), writeDescriptorSet.data(), 0, nullptr);
+    }
+}
+
+void Checkerboard::Reconstruct(VkCommandBuffer cmdBuff, VkDescriptorSet rtDescriptorSet, uint32_t target, uint32_t parity) {
+    VkMemoryBarrier barrier{
+        VK_STRUCTURE_TYPE_MEMORY_BARRIER,                           // sType
+        nullptr,                                                    // pNext
+        VK_ACCESS_SHADER_WRITE_BIT,                                 // srcAccessMask
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT      // dstAccessMask
+    };
+    vkCmdPipelineBarrier(cmdBuff, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    std::array<VkDescriptorSet, 2> descSets{ rtDescriptorSet, m_DescriptorSets[target] };
+    vkCmdBindPipeline(cmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, m_Pipeline);
+    vkCmdBindDescriptorSets(cmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, m_PipelineLayout, 0, static_cast<uint32_t>(descSets.size()), descSets.data(), 0, nullptr);
+
+    CheckerboardConstants constants{
+        m_HistoryValid[target] ? 1u : 0u,                           // historyValid
+        parity,                                                     // parity
+        0                                                           // storeHistory
+    };
+    uint32_t groupsX = (m_Width + 7) / 8, groupsY = (m_Height + 7) / 8;
+    vkCmdPushConstants(cmdBuff, m_PipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CheckerboardConstants), &constants);
+    vkCmdDispatch(cmdBuff, groupsX, groupsY, 1);
+
+    // the history is read around reprojected positions, so it is only overwritten once the whole target is done
+    vkCmdPipelineBarrier(cmdBuff, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    constants.storeHistory = 1;
+    vkCmdPushConstants(cmdBuff, m_PipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CheckerboardConstants), &constants);
+    vkCmdDispatch(cmdBuff, groupsX, groupsY, 1);
+
+    // the denoiser or the post pass read the complete target, the next frame traces into it and reads the history
+    vkCmdPipelineBarrier(cmdBuff, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    m_HistoryValid[target] = true;
+}
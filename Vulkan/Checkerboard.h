@@ -0,0 +1,59 @@
+#pragma once
+
+#include "CommonHeaders.h"
+#include "VulkanFactory.h"
+#include <algorithm>
+
+// push constants of the reconstruction pass
+struct CheckerboardConstants {
+    uint32_t historyValid;                                  // 0 right after a reset, the missing pixels are then interpolated
+    uint32_t parity;                                        // pixels with (x + y + parity) odd were not traced
+    uint32_t storeHistory;                                  // copies the completed target into its history instead
+};
+
+// Fills the pixels a checkerboarded trace skipped. raygen traces the pixels with x + y + parity even and every
+// target flips its parity each frame, so the last frame of a target traced exactly the pixels it skips now. Those
+// take that frame reprojected through the motion of their nearest neighbour, clamped to the range of their four
+// traced neighbours, or an edge-directed interpolation of the neighbours where the history saw another surface.
+// Their G-buffer and motion come from the nearest neighbour too, so the denoiser sees a complete frame. Set 0 is
+// the ray tracing set of the target, set 1 its history: every target keeps its own completed frame before
+// denoising, copied in by a second dispatch once the reconstruction has read it.
+class Checkerboard {
+public:
+    void Init(VkDescriptorSetLayout rtDescriptorSetLayout, uint32_t targetCount);
+    void Cleanup();
+    // recreates the histories at the current extent, the device must be idle
+    void Resize();
+
+    // the next frame of every target interpolates instead of reprojecting
+    void Reset() { std::fill(m_HistoryValid.begin(), m_HistoryValid.end(), false); }
+    void Reconstruct(VkCommandBuffer cmdBuff, VkDescriptorSet rtDescriptorSet, uint32_t target, uint32_t parity);
+
+private:
+    struct StorageImage {
+        VkImage image;
+        MemoryAllocation memory;
+        VkImageView view;
+    };
+
+    VulkanFactory *m_VkFactory = nullptr;
+    uint32_t m_Width = 0, m_Height = 0;
+
+    // per target
+    std::vector<StorageImage> m_HistoryColor;               // the complete frame before denoising
+    std::vector<StorageImage> m_HistoryGBuffer;
+    std::vector<bool> m_HistoryValid;
+
+    VkDescriptorSetLayout m_DescriptorSetLayout;
+    VkDescriptorPool m_DescriptorPool;
+    std::vector<VkDescriptorSet> m_DescriptorSets;          // per target
+
+    VkPipelineLayout m_PipelineLayout;
+    VkPipeline m_Pipeline;
+
+    void CreateImages();
+    void DestroyImages();
+    void CreateStorageImage(StorageImage &image);
+    void CreateDescriptorSets();
+    void UpdateDescriptorSets();
+};
@@ -9,4 +9,8 @@
 %VK_SDK_PATH%/Bin/glslc.exe --target-spv=spv1.5 shaders/rchit.rchit -o shaders/chit.spv
 %VK_SDK_PATH%/Bin/glslc.exe --target-spv=spv1.5 shaders/passthrough.vert -o shaders/passthroughVert.spv
 %VK_SDK_PATH%/Bin/glslc.exe --target-spv=spv1.5 shaders/post.frag -o shaders/postFrag.spv
-%VK_SDK_PATH%/Bin/glslc.exe --target-spv=spv1.5 shaders/rayreflection.rmiss -o shaders/rayreflection.spv
\ No newline at end of file
+%VK_SDK_PATH%/Bin/glslc.exe --target-spv=spv1.5 shaders/rayreflection.rmiss -o shaders/rayreflection.spv
+%VK_SDK_PATH%/Bin/glslc.exe --target-spv=spv1.5 shaders/adaptive.comp -o shaders/adaptiveComp.spv
+%VK_SDK_PATH%/Bin/glslc.exe --target-spv=spv1.5 shaders/denoiseTemporal.comp -o shaders/denoiseTemporalComp.spv
+%VK_SDK_PATH%/Bin/glslc.exe --target-spv=spv1.5 shaders/denoiseAtrous.comp -o shaders/denoiseAtrousComp.spv
+%VK_SDK_PATH%/Bin/glslc.exe --target-spv=spv1.5 shaders/checkerboard.comp -o shaders/checkerboardComp.spv
\ No newline at end of file
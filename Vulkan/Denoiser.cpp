@@ -0,0 +1,167 @@
+#include "Denoiser.h"
+
+void Denoiser::Init(VkDescriptorSetLayout rtDescriptorSetLayout) {
+    m_VkFactory = VulkanFactory::GetInstance();
+    CreateImages();
+    CreateDescriptorSets();
+
+    std::vector<VkDescriptorSetLayout> layouts{ rtDescriptorSetLayout, m_DescriptorSetLayout };
+    std::vector<VkPushConstantRange> pushConstantRanges{ {
+        VK_SHADER_STAGE_COMPUTE_BIT,                                // stageFlags
+        0,                                                          // offset
+        sizeof(DenoiserConstants)                                   // size
+    } };
+    m_VkFactory->CreateGraphicsPipelineLayout(layouts, pushConstantRanges, m_PipelineLayout);
+    m_VkFactory->CreateComputePipeline("shaders/denoiseTemporalComp.spv", m_PipelineLayout, m_TemporalPipeline);
+    m_VkFactory->CreateComputePipeline("shaders/denoiseAtrousComp.spv", m_PipelineLayout, m_AtrousPipeline);
+    m_HistoryValid = false;
+}
+
+void Denoiser::Cleanup() {
+    vkDestroyPipeline(m_VkFactory->GetDevice(), m_TemporalPipeline, nullptr);
+    vkDestroyPipeline(m_VkFactory->GetDevice(), m_AtrousPipeline, nullptr);
+    vkDestroyPipelineLayout(m_VkFactory->GetDevice(), m_PipelineLayout, nullptr);
+    vkDestroyDescriptorPool(m_VkFactory->GetDevice(), m_DescriptorPool, nullptr);
+    vkDestroyDescriptorSetLayout(m_VkFactory->GetDevice(), m_DescriptorSetLayout, nullptr);
+    DestroyImages();
+}
+
+void Denoiser::Resize() {
+    DestroyImages();
+    CreateImages();
+    UpdateDescriptorSets();
+    m_HistoryValid = false;
+}
+
+void Denoiser::CreateImages() {
+    m_Width = m_VkFactory->GetExtent().width;
+    m_Height = m_VkFactory->GetExtent().height;
+    for (uint32_t i = 0; i < 2; ++i) {
+        CreateStorageImage(m_HistoryColor[i]);
+        CreateStorageImage(m_HistoryGBuffer[i]);
+        CreateStorageImage(m_Filter[i]);
+    }
+}
+
+void Denoiser::DestroyImages() {
+    for (uint32_t i = 0; i < 2; ++i) {
+        for (StorageImage *image : { &m_HistoryColor[i], &m_HistoryGBuffer[i], &m_Filter[i] }) {
+            vkDestroyImageView(m_VkFactory->GetDevice(), image->view, nullptr);
+            vkDestroyImage(m_VkFactory->GetDevice(), image->image, nullptr);
+            m_VkFactory->FreeMemory(image->memory);
+        }
+    }
+}
+
+void Denoiser::CreateStorageImage(StorageImage &image) {
+    m_VkFactory->CreateImage(m_Width, m_Height, 1, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_STORAGE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image.image, image.memory, 1, 0);
+    m_VkFactory->TransitionImageLayout(image.image, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 1);
+    image.view = m_VkFactory->CreateImageView(image.image, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_2D, 1);
+}
+
+void Denoiser::CreateDescriptorSets() {
+    // history in, history out, then the two filter images
+    std::vector<VkDescriptorSetLayoutBinding> bindings;
+    for (uint32_t binding = 0; binding < 6; ++binding) {
+        bindings.push_back({
+            binding,                                                // binding
+            VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,                       // descriptorType
+            1,                                                      // descriptorCount
+            VK_SHADER_STAGE_COMPUTE_BIT,                            // stageFlags
+            nullptr                                                 // pImmutableSamplers
+        });
+    }
+    m_VkFactory->CreateDescriptorSetLayout(bindings, m_DescriptorSetLayout);
+
+    std::vector<VkDescriptorPoolSize> poolSizes = { {
+        VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,                           // type
+        static_cast<uint32_t>(
+            m_DescriptorSets.size() * bindings.size())              // descriptorCount
+    } };
+    m_VkFactory->CreateDescriptorPool(poolSizes, m_DescriptorPool);
+
+    std::array<VkDescriptorSetLayout, 2> layouts{ m_DescriptorSetLayout, m_DescriptorSetLayout };
+    VkDescriptorSetAllocateInfo allocateInfo = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,             // sType
+        nullptr,                                                    // pNext
+        m_DescriptorPool,                                           // descriptorPool
+        static_cast<uint32_t>(layouts.size()),                      // descriptorSetCount
+        layouts.data()                                              // pSetLayouts
+    };
+    if (vkAllocateDescriptorSets(m_VkFactory->GetDevice(), &allocateInfo, m_DescriptorSets.data()) != VK_SUCCESS) {
+        throw std::runtime_error("cannot allocate descriptor sets");
+    }
+    UpdateDescriptorSets();
+}
+
+void Denoiser::UpdateDescriptorSets() {
+    for (uint32_t parity = 0; parity < 2; ++parity) {
+        // the set of a parity writes that history and reads the other one
+        std::array<VkDescriptorImageInfo, 6> imageInfos = { {
+            { {}, m_HistoryColor[parity ^ 1].view, VK_IMAGE_LAYOUT_GENERAL },
+            { {}, m_HistoryGBuffer[parity ^ 1].view, VK_IMAGE_LAYOUT_GENERAL },
+            { {}, m_HistoryColor[parity].view, VK_IMAGE_LAYOUT_GENERAL },
+            { {}, m_HistoryGBuffer[parity].view, VK_IMAGE_LAYOUT_GENERAL },
+            { {}, m_Filter[0].view, VK_IMAGE_LAYOUT_GENERAL },
+            { {}, m_Filter[1].view, VK_IMAGE_LAYOUT_GENERAL }
+        } };
+
+        std::array<VkWriteDescriptorSet, 6> writeDescriptorSet{};
+        for (uint32_t j = 0; j < imageInfos.size(); ++j) {
+            writeDescriptorSet[j] = {
+                VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,             // sType
+                nullptr,                                            // pNext
+                m_DescriptorSets[parity],                           // dstSet
+                j,                                                  // dstBinding
+                0,                                                  // dstArrayElement
+                1,                                                  // descriptorCount
+                VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,                   // descriptorType
+                &imageInfos[j],                                     // pImageInfo
+                nullptr,                                            // pBufferInfo
+                nullptr                                             // pTexelBufferView
+            };
+        }
+        vkUpdateDescriptorSets(m_VkFactory->GetDevice(), static_cast<uint32_t>(writeDescriptorSet.size()), writeDescriptorSet.data(), 0, nullptr);
+    }
+}
+
+void Denoiser::Denoise(VkCommandBuffer cmdBuff, VkDescriptorSet rtDescriptorSet) {
+    VkMemoryBarrier barrier{
+        VK_STRUCTURE_TYPE_MEMORY_BARRIER,                           // sType
+        nullptr,                                                    // pNext
+        VK_ACCESS_SHADER_WRITE_BIT,                                 // srcAccessMask
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT      // dstAccessMask
+    };
+    vkCmdPipelineBarrier(cmdBuff, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    std::array<VkDescriptorSet, 2> descSets{ rtDescriptorSet, m_DescriptorSets[m_Parity] };
+    vkCmdBindDescriptorSets(cmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, m_PipelineLayout, 0, static_cast<uint32_t>(descSets.size()), descSets.data(), 0, nullptr);
+
+    DenoiserConstants constants{
+        m_HistoryValid ? 1u : 0u,                                   // historyValid
+        0,                                                          // iteration
+        0                                                           // lastIteration
+    };
+    uint32_t groupsX = (m_Width + 7) / 8, groupsY = (m_Height + 7) / 8;
+    vkCmdBindPipeline(cmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, m_TemporalPipeline);
+    vkCmdPushConstants(cmdBuff, m_PipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(DenoiserConstants), &constants);
+    vkCmdDispatch(cmdBuff, groupsX, groupsY, 1);
+
+    vkCmdBindPipeline(cmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, m_AtrousPipeline);
+    for (uint32_t i = 0; i < AtrousIterations; ++i) {
+        vkCmdPipelineBarrier(cmdBuff, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+        constants.iteration = i;
+        constants.lastIteration = i + 1 == AtrousIterations;
+        vkCmdPushConstants(cmdBuff, m_PipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(DenoiserConstants), &constants);
+        vkCmdDispatch(cmdBuff, groupsX, groupsY, 1);
+    }
+
+    // the post pass samples the target, the next frame traces into it and reads the history written here
+    vkCmdPipelineBarrier(cmdBuff, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    m_Parity ^= 1;
+    m_HistoryValid = true;
+}
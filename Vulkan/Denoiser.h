@@ -0,0 +1,62 @@
+#pragma once
+
+#include "CommonHeaders.h"
+#include "VulkanFactory.h"
+
+// push constants of both denoiser passes
+struct DenoiserConstants {
+    uint32_t historyValid;                                  // 0 right after a reset, the history is then ignored
+    uint32_t iteration;                                     // a-trous taps lie 1 << iteration pixels apart
+    uint32_t lastIteration;                                 // writes the target image instead of a filter image
+};
+
+// Spatiotemporal denoiser running between the trace and the post pass. The temporal pass reprojects the
+// history of the previous frame through the motion image, drops what fails the G-buffer test, clamps the
+// rest to the neighbourhood of the new frame and blends; AtrousIterations edge-aware a-trous passes guided
+// by normals, hit distances and the luminance variance then filter the result into the target image.
+// Set 0 is the ray tracing set of the target, set 1 holds the history and filter images, which the
+// denoiser owns and shares between all targets; the history ping-pongs by frame.
+class Denoiser {
+public:
+    static constexpr uint32_t AtrousIterations = 4;
+
+    void Init(VkDescriptorSetLayout rtDescriptorSetLayout);
+    void Cleanup();
+    // recreates the images at the current extent, the device must be idle
+    void Resize();
+
+    // the next frame starts a new history
+    void Reset() { m_HistoryValid = false; }
+    void Denoise(VkCommandBuffer cmdBuff, VkDescriptorSet rtDescriptorSet);
+
+private:
+    struct StorageImage {
+        VkImage image;
+        MemoryAllocation memory;
+        VkImageView view;
+    };
+
+    VulkanFactory *m_VkFactory = nullptr;
+    uint32_t m_Width = 0, m_Height = 0;
+
+    std::array<StorageImage, 2> m_HistoryColor;             // blended color, alpha counts the frames behind it
+    std::array<StorageImage, 2> m_HistoryGBuffer;           // G-buffer the history was blended at
+    std::array<StorageImage, 2> m_Filter;                   // a-trous ping-pong, alpha carries the luminance variance
+
+    VkDescriptorSetLayout m_DescriptorSetLayout;
+    VkDescriptorPool m_DescriptorPool;
+    std::array<VkDescriptorSet, 2> m_DescriptorSets;        // per history parity
+
+    VkPipelineLayout m_PipelineLayout;
+    VkPipeline m_TemporalPipeline;
+    VkPipeline m_AtrousPipeline;
+
+    uint32_t m_Parity = 0;
+    bool m_HistoryValid = false;
+
+    void CreateImages();
+    void DestroyImages();
+    void CreateStorageImage(StorageImage &image);
+    void CreateDescriptorSets();
+    void UpdateDescriptorSets();
+};
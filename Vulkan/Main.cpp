@@ -1,9 +1,48 @@
 #include "Application.h"
+#include "ObjParser.h"
 
-int main() {
+int main(int argc, char** argv) {
     Application app;
 
     try {
+        // --headless [frames] [--size WxH] [--capture file.ppm] renders without a window and reports frame times;
+        // --checkerboard starts with checkerboarded tracing
+        const std::string usage = "usage: Vulkan [--headless [frames]] [--size WxH] [--capture file.ppm] [--checkerboard] [--benchmark-obj]";
+        bool headless = false;
+        bool headlessOption = false;
+        uint32_t frames = 1000, width = DEFAULT_WIDTH, height = DEFAULT_HEIGHT;
+        std::string capturePath;
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--headless") {
+                headless = true;
+                if (i + 1 < argc && isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                    frames = std::stoul(argv[++i]);
+                }
+            } else if (arg == "--size" && i + 1 < argc) {
+                headlessOption = true;
+                if (sscanf(argv[++i], "%ux%u", &width, &height) != 2 || width == 0 || height == 0) {
+                    throw std::runtime_error("invalid --size, expected WxH");
+                }
+            } else if (arg == "--capture" && i + 1 < argc) {
+                headlessOption = true;
+                capturePath = argv[++i];
+            } else if (arg == "--checkerboard") {
+                app.SetCheckerboard(true);
+            } else if (arg == "--benchmark-obj") {
+                ObjParser::Benchmark({ "models/cube.obj", "models/gnome.obj", "models/helmets.obj", "models/sphere.obj", "models/viking_room.obj" });
+                return EXIT_SUCCESS;
+            } else {
+                throw std::runtime_error("unknown argument " + arg + "\n" + usage);
+            }
+        }
+        // a window has its own size and nothing captures it
+        if (headlessOption && !headless) {
+            throw std::runtime_error("--size and --capture need --headless\n" + usage);
+        }
+        if (headless) {
+            app.SetHeadless(width, height, frames, capturePath);
+        }
         app.Run();
     }
     catch (const std::exception& e) {
@@ -12,4 +51,4 @@ int main() {
     }
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
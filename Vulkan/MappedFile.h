@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only view of a whole file mapped into the address space.
+class MappedFile {
+private:
+    const uint8_t *m_Data = nullptr;
+    size_t m_Size = 0;
+#ifdef _WIN32
+    void *m_File = nullptr;
+    void *m_Mapping = nullptr;
+#else
+    int m_File = -1;
+#endif
+
+public:
+    MappedFile() = default;
+    ~MappedFile() { Close(); }
+    MappedFile(const MappedFile &other) = delete;
+    void operator=(const MappedFile &other) = delete;
+
+    // returns false if the file does not exist or cannot be mapped, an empty file maps to a null view
+    bool Open(const std::string &path);
+    void Close();
+
+    const uint8_t *GetData() const { return m_Data; }
+    size_t GetSize() const { return m_Size; }
+};
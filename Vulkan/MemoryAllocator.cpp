@@ -0,0 +1,271 @@
+#include "MemoryAllocator.h"
+#include <algorithm>
+
+template <class integral>
+static constexpr integral alignUp(integral x, size_t a) noexcept {
+    return integral((x + (integral(a) - 1)) & ~integral(a - 1));
+}
+
+void MemoryAllocator::Init(VkPhysicalDevice physicalDevice, VkDevice device) {
+    m_Device = device;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &m_MemProperties);
+
+    m_Pools.clear();
+    m_Pools.resize(m_MemProperties.memoryTypeCount * 2);
+    for (uint32_t i = 0; i < m_MemProperties.memoryTypeCount; ++i) {
+        // small heaps (e.g. the 256MB host visible BAR) get smaller blocks so one pool cannot exhaust them
+        VkDeviceSize heapSize = m_MemProperties.memoryHeaps[m_MemProperties.memoryTypes[i].heapIndex].size;
+        VkDeviceSize blockSize = std::min(DefaultBlockSize, heapSize / 8);
+        m_Pools[i * 2].blockSize = blockSize;
+        m_Pools[i * 2 + 1].blockSize = blockSize;
+    }
+}
+
+void MemoryAllocator::Cleanup() {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    for (auto &pool : m_Pools) {
+        for (auto &block : pool.blocks) {
+            if (block.memory != VK_NULL_HANDLE) {
+                vkFreeMemory(m_Device, block.memory, nullptr);
+            }
+        }
+        pool.blocks.clear();
+    }
+    m_DeviceAllocationCount = 0;
+}
+
+uint32_t MemoryAllocator::FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
+    for (uint32_t i = 0; i < m_MemProperties.memoryTypeCount; ++i) {
+        if (typeFilter & (1 << i) && (m_MemProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+            return i;
+        }
+    }
+    throw std::runtime_error("cannot find suitable memory type");
+}
+
+VkDeviceMemory MemoryAllocator::AllocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, VkBuffer dedicatedBuffer, VkImage dedicatedImage) {
+    VkMemoryDedicatedAllocateInfo dedicatedInfo{
+        VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,           // sType
+        nullptr,                                                    // pNext
+        dedicatedImage,                                             // image
+        dedicatedBuffer                                             // buffer
+    };
+
+    VkMemoryAllocateFlagsInfo flagsInfo{
+        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,               // sType
+        (dedicatedBuffer || dedicatedImage) ? &dedicatedInfo : nullptr, // pNext
+        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,                      // flags
+        0                                                           // deviceMask
+    };
+
+    VkMemoryAllocateInfo memAllocateInfo = {
+        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,                     // sType
+        &flagsInfo,                                                 // pNext
+        size,                                                       // allocationSize
+        memoryType                                                  // memoryTypeIndex
+    };
+
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(m_Device, &memAllocateInfo, nullptr, &memory) != VK_SUCCESS) {
+        throw std::runtime_error("cannot allocate device memory");
+    }
+    m_PeakDeviceAllocationCount = std::max(m_PeakDeviceAllocationCount, ++m_DeviceAllocationCount);
+    return memory;
+}
+
+void MemoryAllocator::RemoveFreeRange(Block &block, std::map<VkDeviceSize, VkDeviceSize>::iterator it) {
+    auto range = block.freeBySize.equal_range(it->second);
+    for (auto sizeIt = range.first; sizeIt != range.second; ++sizeIt) {
+        if (sizeIt->second == it->first) {
+            block.freeBySize.erase(sizeIt);
+            break;
+        }
+    }
+    block.freeByOffset.erase(it);
+}
+
+void MemoryAllocator::AddFreeRange(Block &block, VkDeviceSize offset, VkDeviceSize size) {
+    auto next = block.freeByOffset.lower_bound(offset);
+    if (next != block.freeByOffset.end() && offset + size == next->first) {
+        size += next->second;
+        RemoveFreeRange(block, next);
+    }
+    next = block.freeByOffset.lower_bound(offset);
+    if (next != block.freeByOffset.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == offset) {
+            offset = prev->first;
+            size += prev->second;
+            RemoveFreeRange(block, prev);
+        }
+    }
+    block.freeByOffset.emplace(offset, size);
+    block.freeBySize.emplace(size, offset);
+}
+
+bool MemoryAllocator::AllocateFromBlock(Block &block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset) {
+    // best fit: smallest free range that still holds the request after alignment padding
+    for (auto it = block.freeBySize.lower_bound(size); it != block.freeBySize.end(); ++it) {
+        VkDeviceSize rangeOffset = it->second;
+        VkDeviceSize rangeSize = it->first;
+        VkDeviceSize aligned = alignUp(rangeOffset, alignment);
+        if (aligned + size > rangeOffset + rangeSize) {
+            continue;
+        }
+
+        RemoveFreeRange(block, block.freeByOffset.find(rangeOffset));
+        if (aligned > rangeOffset) {
+            AddFreeRange(block, rangeOffset, aligned - rangeOffset);
+        }
+        if (rangeOffset + rangeSize > aligned + size) {
+            AddFreeRange(block, aligned + size, rangeOffset + rangeSize - aligned - size);
+        }
+        offset = aligned;
+        return true;
+    }
+    return false;
+}
+
+MemoryAllocation MemoryAllocator::Allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties, bool linear,
+    bool dedicated, VkBuffer dedicatedBuffer, VkImage dedicatedImage) {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    ++m_TotalRequests;
+
+    uint32_t memoryType = FindMemoryType(requirements.memoryTypeBits, properties);
+    bool hostVisible = m_MemProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    uint32_t poolIndex = memoryType * 2 + (linear ? 0 : 1);
+    Pool &pool = m_Pools[poolIndex];
+
+    MemoryAllocation allocation;
+    allocation.pool = poolIndex;
+    allocation.size = requirements.size;
+
+    if (dedicated || requirements.size > pool.blockSize / 2) {
+        allocation.memory = AllocateDeviceMemory(requirements.size, memoryType, dedicatedBuffer, dedicatedImage);
+        allocation.dedicated = true;
+        if (hostVisible) {
+            vkMapMemory(m_Device, allocation.memory, 0, VK_WHOLE_SIZE, 0, &allocation.mapped);
+        }
+        ++m_DedicatedAllocationCount;
+        m_DedicatedBytes += requirements.size;
+        return allocation;
+    }
+
+    uint32_t blockIndex = 0;
+    bool found = false;
+    for (; blockIndex < pool.blocks.size(); ++blockIndex) {
+        Block &block = pool.blocks[blockIndex];
+        if (block.memory != VK_NULL_HANDLE && AllocateFromBlock(block, requirements.size, requirements.alignment, allocation.offset)) {
+            found = true;
+            break;
+        }
+    }
+
+    if (!found) {
+        // reuse a released slot so block indices held by live allocations stay valid
+        for (blockIndex = 0; blockIndex < pool.blocks.size(); ++blockIndex) {
+            if (pool.blocks[blockIndex].memory == VK_NULL_HANDLE) {
+                break;
+            }
+        }
+        if (blockIndex == pool.blocks.size()) {
+            pool.blocks.emplace_back();
+        }
+
+        Block &block = pool.blocks[blockIndex];
+        block.memory = AllocateDeviceMemory(pool.blockSize, memoryType, VK_NULL_HANDLE, VK_NULL_HANDLE);
+        block.size = pool.blockSize;
+        if (hostVisible) {
+            vkMapMemory(m_Device, block.memory, 0, VK_WHOLE_SIZE, 0, &block.mapped);
+        }
+        AddFreeRange(block, 0, block.size);
+        AllocateFromBlock(block, requirements.size, requirements.alignment, allocation.offset);
+    }
+
+    Block &block = pool.blocks[blockIndex];
+    block.used += requirements.size;
+    ++block.allocationCount;
+    ++m_SubAllocationCount;
+
+    allocation.memory = block.memory;
+    allocation.block = blockIndex;
+    if (block.mapped) {
+        allocation.mapped = static_cast<char*>(block.mapped) + allocation.offset;
+    }
+    return allocation;
+}
+
+void MemoryAllocator::Free(MemoryAllocation &allocation) {
+    if (allocation.memory == VK_NULL_HANDLE) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    if (allocation.dedicated) {
+        vkFreeMemory(m_Device, allocation.memory, nullptr);
+        --m_DeviceAllocationCount;
+        --m_DedicatedAllocationCount;
+        m_DedicatedBytes -= allocation.size;
+        allocation = MemoryAllocation();
+        return;
+    }
+
+    Pool &pool = m_Pools[allocation.pool];
+    Block &block = pool.blocks[allocation.block];
+    AddFreeRange(block, allocation.offset, allocation.size);
+    block.used -= allocation.size;
+    --block.allocationCount;
+
+    // an empty block is released only if the pool has another one, so alternating create/destroy does not thrash the driver
+    if (block.allocationCount == 0) {
+        uint32_t liveBlocks = 0;
+        for (const auto &b : pool.blocks) {
+            liveBlocks += b.memory != VK_NULL_HANDLE;
+        }
+        if (liveBlocks > 1) {
+            vkFreeMemory(m_Device, block.memory, nullptr);
+            --m_DeviceAllocationCount;
+            block = Block();
+        }
+    }
+    allocation = MemoryAllocation();
+}
+
+void MemoryAllocator::DumpStatistics() {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    const double MiB = 1024.0 * 1024.0;
+
+    std::cout << "memory allocator: " << m_DeviceAllocationCount << " device allocations (peak " << m_PeakDeviceAllocationCount
+        << ", " << m_DedicatedAllocationCount << " dedicated, " << m_DedicatedBytes / MiB << " MiB), "
+        << m_TotalRequests << " requests, " << m_SubAllocationCount << " sub-allocated" << std::endl;
+
+    for (uint32_t i = 0; i < m_Pools.size(); ++i) {
+        const Pool &pool = m_Pools[i];
+        uint32_t blockCount = 0, allocationCount = 0, freeRanges = 0;
+        VkDeviceSize reserved = 0, used = 0, largestFree = 0;
+        for (const auto &block : pool.blocks) {
+            if (block.memory == VK_NULL_HANDLE) {
+                continue;
+            }
+            ++blockCount;
+            allocationCount += block.allocationCount;
+            reserved += block.size;
+            used += block.used;
+            freeRanges += static_cast<uint32_t>(block.freeByOffset.size());
+            if (!block.freeBySize.empty()) {
+                largestFree = std::max(largestFree, block.freeBySize.rbegin()->first);
+            }
+        }
+        if (blockCount == 0) {
+            continue;
+        }
+
+        // fragmentation: how much of the free space is not usable by one request of the same total size
+        VkDeviceSize totalFree = reserved - used;
+        double fragmentation = totalFree ? 1.0 - static_cast<double>(largestFree) / totalFree : 0.0;
+        std::cout << "  type " << i / 2 << (i % 2 ? " optimal" : " linear ") << " flags 0x" << std::hex
+            << m_MemProperties.memoryTypes[i / 2].propertyFlags << std::dec << ": " << blockCount << " blocks, "
+            << allocationCount << " allocations, " << used / MiB << " / " << reserved / MiB << " MiB used, "
+            << freeRanges << " free ranges, fragmentation " << fragmentation * 100.0 << "%" << std::endl;
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "CommonHeaders.h"
+#include <map>
+
+struct MemoryAllocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    void *mapped = nullptr;                 // host pointer at offset, only for host visible memory
+    uint32_t pool = 0;
+    uint32_t block = 0;
+    bool dedicated = false;
+};
+
+// Hands out sub-ranges of large VkDeviceMemory blocks instead of one vkAllocateMemory per resource.
+// Every memory type has two pools, one for buffers/linear images and one for optimal images, so
+// bufferImageGranularity never has to be honoured inside a block. Free space of a block is kept
+// both by offset (for coalescing) and by size (for best-fit lookup).
+class MemoryAllocator {
+private:
+    struct Block {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        VkDeviceSize used = 0;
+        void *mapped = nullptr;
+        uint32_t allocationCount = 0;
+        std::map<VkDeviceSize, VkDeviceSize> freeByOffset;
+        std::multimap<VkDeviceSize, VkDeviceSize> freeBySize;
+    };
+
+    struct Pool {
+        std::vector<Block> blocks;
+        VkDeviceSize blockSize = 0;
+    };
+
+    static constexpr VkDeviceSize DefaultBlockSize = 64ull * 1024 * 1024;
+
+    VkDevice m_Device = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties m_MemProperties{};
+    std::vector<Pool> m_Pools;
+    std::mutex m_Mutex;
+
+    // statistics
+    uint32_t m_DeviceAllocationCount = 0;
+    uint32_t m_PeakDeviceAllocationCount = 0;
+    uint32_t m_DedicatedAllocationCount = 0;
+    uint64_t m_SubAllocationCount = 0;
+    uint64_t m_TotalRequests = 0;
+    VkDeviceSize m_DedicatedBytes = 0;
+
+    VkDeviceMemory AllocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, VkBuffer dedicatedBuffer, VkImage dedicatedImage);
+    bool AllocateFromBlock(Block &block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset);
+    void AddFreeRange(Block &block, VkDeviceSize offset, VkDeviceSize size);
+    void RemoveFreeRange(Block &block, std::map<VkDeviceSize, VkDeviceSize>::iterator it);
+
+public:
+    void Init(VkPhysicalDevice physicalDevice, VkDevice device);
+    void Cleanup();
+
+    uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
+    MemoryAllocation Allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties, bool linear,
+        bool dedicated, VkBuffer dedicatedBuffer = VK_NULL_HANDLE, VkImage dedicatedImage = VK_NULL_HANDLE);
+    void Free(MemoryAllocation &allocation);
+    void DumpStatistics();
+};
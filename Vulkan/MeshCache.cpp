@@ -0,0 +1,114 @@
+#include "MeshCache.h"
+#include "MappedFile.h"
+#include <cstdio>
+#include <cstring>
+
+static_assert(sizeof(MeshCacheHeader) == 48, "mesh cache header layout changed");
+
+uint64_t MeshCache::HashBytes(const void *bytes, size_t size, uint64_t hash) {
+    // FNV-1a over 8 byte words with the high half folded back in, the tail goes byte by byte
+    const uint64_t prime = 1099511628211ull;
+    const uint8_t *data = static_cast<const uint8_t*>(bytes);
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * prime;
+        hash ^= hash >> 32;
+    }
+    for (; i < size; ++i) {
+        hash = (hash ^ data[i]) * prime;
+    }
+    return hash;
+}
+
+bool MeshCache::Load(const std::string &sourcePath, Mesh &mesh) {
+    MappedFile cache;
+    if (!cache.Open(GetCachePath(sourcePath)) || cache.GetSize() < sizeof(MeshCacheHeader)) {
+        return false;
+    }
+    MeshCacheHeader header;
+    memcpy(&header, cache.GetData(), sizeof(header));
+
+    size_t expectedSize = sizeof(MeshCacheHeader) + (size_t)header.vertexCount * sizeof(Vertex) + (size_t)header.indexCount * sizeof(uint32_t)
+        + (size_t)header.lodCount * sizeof(MeshLod) + (size_t)header.meshletCount * sizeof(Meshlet);
+    if (header.magic != Magic || header.version != Version || header.vertexStride != sizeof(Vertex) || header.lodCount == 0 || cache.GetSize() != expectedSize) {
+        return false;
+    }
+
+    MappedFile source;
+    if (!source.Open(sourcePath) || source.GetSize() != header.sourceSize || HashBytes(source.GetData(), source.GetSize()) != header.sourceHash) {
+        return false;
+    }
+
+    const Vertex *cachedVertices = reinterpret_cast<const Vertex*>(cache.GetData() + sizeof(MeshCacheHeader));
+    const uint32_t *cachedIndices = reinterpret_cast<const uint32_t*>(cachedVertices + header.vertexCount);
+    const MeshLod *cachedLods = reinterpret_cast<const MeshLod*>(cachedIndices + header.indexCount);
+    const Meshlet *cachedMeshlets = reinterpret_cast<const Meshlet*>(cachedLods + header.lodCount);
+    for (uint32_t i = 0; i < header.lodCount; ++i) {
+        if ((uint64_t)cachedLods[i].firstIndex + cachedLods[i].indexCount > header.indexCount
+            || (uint64_t)cachedLods[i].firstMeshlet + cachedLods[i].meshletCount > header.meshletCount) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header.meshletCount; ++i) {
+        if ((uint64_t)cachedMeshlets[i].firstIndex + cachedMeshlets[i].indexCount > header.indexCount) {
+            return false;
+        }
+    }
+    // the indices go to the GPU and the BLAS builds as they are, a stale or damaged file must not fetch past the vertices
+    for (uint32_t i = 0; i < header.indexCount; ++i) {
+        if (cachedIndices[i] >= header.vertexCount) {
+            return false;
+        }
+    }
+
+    mesh.vertices.assign(cachedVertices, cachedVertices + header.vertexCount);
+    mesh.indices.assign(cachedIndices, cachedIndices + header.indexCount);
+    mesh.lods.assign(cachedLods, cachedLods + header.lodCount);
+    mesh.meshlets.assign(cachedMeshlets, cachedMeshlets + header.meshletCount);
+    return true;
+}
+
+void MeshCache::Store(const std::string &sourcePath, const Mesh &mesh) {
+    MappedFile source;
+    if (!source.Open(sourcePath)) {
+        return;
+    }
+
+    MeshCacheHeader header{
+        Magic,                                                      // magic
+        Version,                                                    // version
+        sizeof(Vertex),                                             // vertexStride
+        static_cast<uint32_t>(mesh.vertices.size()),                // vertexCount
+        static_cast<uint32_t>(mesh.indices.size()),                 // indexCount
+        static_cast<uint32_t>(mesh.lods.size()),                    // lodCount
+        static_cast<uint32_t>(mesh.meshlets.size()),                // meshletCount
+        0,                                                          // reserved
+        source.GetSize(),                                           // sourceSize
+        HashBytes(source.GetData(), source.GetSize())               // sourceHash
+    };
+    source.Close();
+
+    // written under a temporary name first so an interrupted write never leaves a cache that looks valid
+    std::string cachePath = GetCachePath(sourcePath);
+    std::string tempPath = cachePath + ".tmp";
+    {
+        std::ofstream fout(tempPath, std::ios::binary | std::ios::trunc);
+        if (!fout.is_open()) {
+            return;
+        }
+        fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        fout.write(reinterpret_cast<const char*>(mesh.vertices.data()), (std::streamsize)header.vertexCount * sizeof(Vertex));
+        fout.write(reinterpret_cast<const char*>(mesh.indices.data()), (std::streamsize)header.indexCount * sizeof(uint32_t));
+        fout.write(reinterpret_cast<const char*>(mesh.lods.data()), (std::streamsize)header.lodCount * sizeof(MeshLod));
+        fout.write(reinterpret_cast<const char*>(mesh.meshlets.data()), (std::streamsize)header.meshletCount * sizeof(Meshlet));
+        if (!fout) {
+            fout.close();
+            std::remove(tempPath.c_str());
+            return;
+        }
+    }
+    std::remove(cachePath.c_str());
+    std::rename(tempPath.c_str(), cachePath.c_str());
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "CommonHeaders.h"
+#include "Vertex.h"
+#include "MeshLoader.h"
+
+struct MeshCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vertexStride;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t lodCount;
+    uint32_t meshletCount;
+    uint32_t reserved;
+    uint64_t sourceSize;
+    uint64_t sourceHash;
+};
+
+// Deduplicated, optimized vertices and indices of an OBJ stored next to it as <model>.mesh:
+// header, Vertex array, uint32 index array (every LOD), MeshLod array, Meshlet array. The cache is valid only while size and
+// hash of the source file match the ones recorded in the header.
+class MeshCache {
+public:
+    static constexpr uint32_t Magic = 0x4853454d;           // "MESH"
+    static constexpr uint32_t Version = 7;
+
+    static std::string GetCachePath(const std::string &sourcePath) { return sourcePath + ".mesh"; }
+
+    // chains over several buffers when the previous result is passed as hash
+    static uint64_t HashBytes(const void *data, size_t size, uint64_t hash = 14695981039346656037ull);
+
+    static bool Load(const std::string &sourcePath, Mesh &mesh);
+    static void Store(const std::string &sourcePath, const Mesh &mesh);
+};
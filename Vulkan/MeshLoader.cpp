@@ -0,0 +1,128 @@
+#include "MeshLoader.h"
+#include "MeshCache.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "ObjParser.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <sstream>
+
+namespace {
+
+void BuildMeshlets(Mesh &mesh) {
+    std::vector<std::vector<Meshlet>> lodMeshlets(mesh.lods.size());
+    ThreadPool::GetInstance()->ParallelFor(static_cast<uint32_t>(mesh.lods.size()), [&](uint32_t level) {
+        const MeshLod &lod = mesh.lods[level];
+        MeshletBuilder::Build(mesh.vertices, mesh.indices, lod.firstIndex, lod.indexCount, lodMeshlets[level]);
+    });
+
+    mesh.meshlets.clear();
+    for (size_t level = 0; level < mesh.lods.size(); ++level) {
+        mesh.lods[level].firstMeshlet = static_cast<uint32_t>(mesh.meshlets.size());
+        mesh.lods[level].meshletCount = static_cast<uint32_t>(lodMeshlets[level].size());
+        mesh.meshlets.insert(mesh.meshlets.end(), lodMeshlets[level].begin(), lodMeshlets[level].end());
+    }
+}
+
+// returns the statistics line of a freshly processed part, empty for a cache hit
+std::string LoadPart(const std::string &path, Mesh &part) {
+    if (MeshCache::Load(path, part)) {
+        return {};
+    }
+    ObjParser::Load(path, part.vertices, part.indices);
+
+    VertexCacheStatistics before = MeshOptimizer::AnalyzeVertexCache(part.indices, part.vertices.size());
+    MeshOptimizer::Optimize(part.vertices, part.indices);
+    VertexCacheStatistics after = MeshOptimizer::AnalyzeVertexCache(part.indices, part.vertices.size());
+    MeshSimplifier::BuildLods(part);
+    BuildMeshlets(part);
+    std::ostringstream report;
+    report << path << ": ACMR " << before.acmr << " -> " << after.acmr
+        << ", ATVR " << before.atvr << " -> " << after.atvr << ", LOD triangles";
+    for (const MeshLod &lod : part.lods) {
+        report << " " << lod.indexCount / 3;
+    }
+
+    MeshCache::Store(path, part);
+    return report.str();
+}
+
+Mesh Concatenate(const std::vector<Mesh> &parts) {
+    ThreadPool *threadPool = ThreadPool::GetInstance();
+
+    // exclusive prefix sums place every part behind the ones before it, indices level by level
+    size_t lodCount = 0;
+    std::vector<size_t> vertexOffsets(parts.size() + 1, 0);
+    for (size_t i = 0; i < parts.size(); ++i) {
+        vertexOffsets[i + 1] = vertexOffsets[i] + parts[i].vertices.size();
+        lodCount = std::max(lodCount, parts[i].lods.size());
+    }
+    auto partLod = [&parts](size_t i, size_t level) { return parts[i].lods[std::min(level, parts[i].lods.size() - 1)]; };
+
+    Mesh mesh;
+    mesh.lods.resize(lodCount);
+    std::vector<size_t> indexOffsets(lodCount * parts.size());
+    std::vector<size_t> meshletOffsets(lodCount * parts.size());
+    size_t indexCount = 0;
+    size_t meshletCount = 0;
+    for (size_t level = 0; level < lodCount; ++level) {
+        MeshLod &lod = mesh.lods[level];
+        lod = { static_cast<uint32_t>(indexCount), 0, 0.0f, static_cast<uint32_t>(meshletCount), 0 };
+        for (size_t i = 0; i < parts.size(); ++i) {
+            indexOffsets[level * parts.size() + i] = indexCount;
+            meshletOffsets[level * parts.size() + i] = meshletCount;
+            indexCount += partLod(i, level).indexCount;
+            meshletCount += partLod(i, level).meshletCount;
+            lod.error = std::max(lod.error, partLod(i, level).error);
+        }
+        lod.indexCount = static_cast<uint32_t>(indexCount - lod.firstIndex);
+        lod.meshletCount = static_cast<uint32_t>(meshletCount - lod.firstMeshlet);
+    }
+    mesh.vertices.resize(vertexOffsets.back());
+    mesh.indices.resize(indexCount);
+    mesh.meshlets.resize(meshletCount);
+
+    threadPool->ParallelFor(static_cast<uint32_t>(parts.size()), [&](uint32_t i) {
+        const Mesh &part = parts[i];
+        std::copy(part.vertices.begin(), part.vertices.end(), mesh.vertices.begin() + vertexOffsets[i]);
+
+        uint32_t baseVertex = static_cast<uint32_t>(vertexOffsets[i]);
+        for (size_t level = 0; level < lodCount; ++level) {
+            MeshLod lod = partLod(i, level);
+            uint32_t *dst = mesh.indices.data() + indexOffsets[level * parts.size() + i];
+            for (uint32_t j = 0; j < lod.indexCount; ++j) {
+                dst[j] = part.indices[lod.firstIndex + j] + baseVertex;
+            }
+
+            // meshlet bounds are in model space and stay, only their index ranges move
+            uint32_t indexShift = static_cast<uint32_t>(indexOffsets[level * parts.size() + i]) - lod.firstIndex;
+            Meshlet *meshlets = mesh.meshlets.data() + meshletOffsets[level * parts.size() + i];
+            for (uint32_t j = 0; j < lod.meshletCount; ++j) {
+                meshlets[j] = part.meshlets[lod.firstMeshlet + j];
+                meshlets[j].firstIndex += indexShift;
+            }
+        }
+    });
+    return mesh;
+}
+
+}
+
+Mesh MeshLoader::Load(const std::vector<std::string> &paths) {
+    std::vector<Mesh> parts(paths.size());
+    // parts load concurrently, their statistics are printed afterwards so the lines do not interleave
+    std::vector<std::string> reports(paths.size());
+    ThreadPool::GetInstance()->ParallelFor(static_cast<uint32_t>(paths.size()), [&](uint32_t i) {
+        reports[i] = LoadPart(paths[i], parts[i]);
+    });
+    for (const std::string &report : reports) {
+        if (!report.empty()) {
+            std::cout << report << std::endl;
+        }
+    }
+
+    if (parts.size() == 1) {
+        return std::move(parts[0]);
+    }
+    return Concatenate(parts);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "CommonHeaders.h"
+#include "Vertex.h"
+#include "Meshlet.h"
+
+// a level of detail is a range of the mesh indices drawn with the full vertex array
+struct MeshLod {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error;                                            // deviation from the full mesh in model units
+    uint32_t firstMeshlet;                                  // the meshlets partitioning the index range
+    uint32_t meshletCount;
+};
+
+// vertex and index data of a drawable, owned by exactly one object so it is moved around rather than copied
+struct Mesh {
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<MeshLod> lods;                              // finest first, LOD 0 is the full mesh
+    std::vector<Meshlet> meshlets;
+
+    Mesh() = default;
+    Mesh(Mesh &&other) = default;
+    Mesh &operator=(Mesh &&other) = default;
+    Mesh(const Mesh &other) = delete;
+    Mesh &operator=(const Mesh &other) = delete;
+};
+
+class MeshLoader {
+public:
+    // loads every file as its own task (from the mesh cache when valid, otherwise parsed and cached) and
+    // concatenates them in list order into arrays allocated once at their final size; indices are rebased
+    // so they refer to the combined vertices array and LOD k of the result holds LOD k of every part (or
+    // its coarsest one) contiguously, and likewise for the meshlets
+    static Mesh Load(const std::vector<std::string> &paths);
+};
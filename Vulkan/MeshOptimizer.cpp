@@ -0,0 +1,322 @@
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const float CacheDecayPower = 1.5f;
+const float LastTriangleScore = 0.75f;
+const float ValenceBoostScale = 2.0f;
+const float ValenceBoostPower = 0.5f;
+
+float VertexScore(int32_t cachePosition, uint32_t remainingValence) {
+    if (remainingValence == 0) {
+        return -1.0f;
+    }
+
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+        if (cachePosition < 3) {
+            // the vertices of the last triangle are scored flat so it does not matter which of its edges is continued
+            score = LastTriangleScore;
+        } else {
+            float scaler = 1.0f / (MeshOptimizer::CacheSize - 3);
+            score = std::pow(1.0f - (cachePosition - 3) * scaler, CacheDecayPower);
+        }
+    }
+    // vertices with few triangles left are finished first so they do not have to be reloaded later
+    return score + ValenceBoostScale * std::pow(static_cast<float>(remainingValence), -ValenceBoostPower);
+}
+
+// FIFO cache simulation with timestamps; bumping the timestamp by more than the cache size empties it
+struct FifoCache {
+    std::vector<uint32_t> timestamps;
+    uint32_t timestamp;
+    uint32_t size;
+
+    FifoCache(size_t vertexCount, uint32_t cacheSize) : timestamps(vertexCount, 0), timestamp(cacheSize + 1), size(cacheSize) {}
+
+    void Reset() { timestamp += size + 1; }
+
+    uint32_t Update(const uint32_t *triangle) {
+        uint32_t misses = 0;
+        for (uint32_t k = 0; k < 3; ++k) {
+            if (timestamp - timestamps[triangle[k]] > size) {
+                timestamps[triangle[k]] = timestamp++;
+                ++misses;
+            }
+        }
+        return misses;
+    }
+};
+
+}
+
+void MeshOptimizer::Optimize(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices) {
+    OptimizeVertexCache(indices, vertices.size());
+    OptimizeOverdraw(indices, vertices);
+    OptimizeVertexFetch(vertices, indices);
+}
+
+void MeshOptimizer::OptimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount) {
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+
+    // triangles of every vertex; the first liveCount entries of a vertex are the triangles not emitted yet
+    std::vector<uint32_t> liveCount(vertexCount, 0);
+    for (uint32_t index : indices) {
+        ++liveCount[index];
+    }
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        offsets[v + 1] = offsets[v] + liveCount[v];
+    }
+    std::vector<uint32_t> adjacency(indices.size());
+    {
+        std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); ++i) {
+            adjacency[cursor[indices[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+    }
+
+    std::vector<int32_t> cachePosition(vertexCount, -1);
+    std::vector<float> vertexScores(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        vertexScores[v] = VertexScore(-1, liveCount[v]);
+    }
+
+    auto triangleScore = [&indices, &vertexScores](size_t t) {
+        const uint32_t *triangle = &indices[t * 3];
+        return vertexScores[triangle[0]] + vertexScores[triangle[1]] + vertexScores[triangle[2]];
+    };
+
+    std::vector<uint8_t> emitted(triangleCount, 0);
+    int64_t best = 0;
+    float bestScore = triangleScore(0);
+    for (size_t t = 1; t < triangleCount; ++t) {
+        float score = triangleScore(t);
+        if (score > bestScore) {
+            bestScore = score;
+            best = t;
+        }
+    }
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    uint32_t cache[CacheSize + 3];
+    uint32_t cacheCount = 0;
+    size_t deadEndCursor = 0;
+
+    while (result.size() < indices.size()) {
+        if (best < 0) {
+            // nothing in the cache has triangles left, continue with the next triangle in input order
+            while (emitted[deadEndCursor]) {
+                ++deadEndCursor;
+            }
+            best = deadEndCursor;
+        }
+
+        uint32_t triangle[3] = { indices[best * 3], indices[best * 3 + 1], indices[best * 3 + 2] };
+        emitted[best] = 1;
+        for (uint32_t v : triangle) {
+            result.push_back(v);
+            uint32_t *live = &adjacency[offsets[v]];
+            uint32_t *found = std::find(live, live + liveCount[v], static_cast<uint32_t>(best));
+            std::swap(*found, live[--liveCount[v]]);
+        }
+
+        // the emitted vertices move to the front, up to three old entries fall out at the back
+        uint32_t newCache[CacheSize + 3];
+        uint32_t newCount = 0;
+        for (uint32_t v : triangle) {
+            if (std::find(newCache, newCache + newCount, v) == newCache + newCount) {
+                newCache[newCount++] = v;
+            }
+        }
+        for (uint32_t i = 0; i < cacheCount; ++i) {
+            if (std::find(triangle, triangle + 3, cache[i]) == triangle + 3) {
+                newCache[newCount++] = cache[i];
+            }
+        }
+
+        for (uint32_t i = 0; i < newCount; ++i) {
+            uint32_t v = newCache[i];
+            cachePosition[v] = i < CacheSize ? static_cast<int32_t>(i) : -1;
+            vertexScores[v] = VertexScore(cachePosition[v], liveCount[v]);
+        }
+
+        // only triangles touching the cache changed their score, the best of them is emitted next
+        best = -1;
+        bestScore = -1.0f;
+        for (uint32_t i = 0; i < newCount; ++i) {
+            uint32_t v = newCache[i];
+            for (uint32_t j = 0; j < liveCount[v]; ++j) {
+                uint32_t t = adjacency[offsets[v] + j];
+                float score = triangleScore(t);
+                if (score > bestScore) {
+                    bestScore = score;
+                    best = t;
+                }
+            }
+        }
+
+        cacheCount = std::min(newCount, CacheSize);
+        std::copy(newCache, newCache + cacheCount, cache);
+    }
+
+    indices.swap(result);
+}
+
+void MeshOptimizer::OptimizeOverdraw(std::vector<uint32_t> &indices, const std::vector<Vertex> &vertices, float threshold) {
+    uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+    if (triangleCount == 0) {
+        return;
+    }
+
+    // hard boundaries: triangles that miss all three vertices, the cache optimizer restarted there anyway
+    FifoCache cache(vertices.size(), 16);
+    std::vector<uint32_t> hardBoundaries = { 0 };
+    cache.Update(&indices[0]);
+    for (uint32_t t = 1; t < triangleCount; ++t) {
+        if (cache.Update(&indices[t * 3]) == 3) {
+            hardBoundaries.push_back(t);
+        }
+    }
+    hardBoundaries.push_back(triangleCount);
+
+    // soft boundaries: a cluster ends as soon as its own ACMR is within threshold of the hard cluster's ACMR
+    std::vector<uint32_t> clusterStarts;
+    for (size_t h = 0; h + 1 < hardBoundaries.size(); ++h) {
+        uint32_t start = hardBoundaries[h];
+        uint32_t end = hardBoundaries[h + 1];
+
+        cache.Reset();
+        uint32_t clusterMisses = 0;
+        for (uint32_t t = start; t < end; ++t) {
+            clusterMisses += cache.Update(&indices[t * 3]);
+        }
+        float clusterThreshold = threshold * clusterMisses / (end - start);
+
+        clusterStarts.push_back(start);
+        cache.Reset();
+        uint32_t runningMisses = 0;
+        uint32_t runningTriangles = 0;
+        for (uint32_t t = start; t < end; ++t) {
+            runningMisses += cache.Update(&indices[t * 3]);
+            ++runningTriangles;
+            if (runningMisses <= clusterThreshold * runningTriangles && t + 1 < end) {
+                clusterStarts.push_back(t + 1);
+                cache.Reset();
+                runningMisses = 0;
+                runningTriangles = 0;
+            }
+        }
+    }
+    clusterStarts.push_back(triangleCount);
+    size_t clusterCount = clusterStarts.size() - 1;
+
+    glm::vec3 meshCentroid(0.0f);
+    for (uint32_t index : indices) {
+        meshCentroid += vertices[index].pos;
+    }
+    meshCentroid /= static_cast<float>(indices.size());
+
+    // clusters facing away from the mesh center are likely in front of the others they overlap, drawing
+    // them first lets early depth testing reject more of what follows
+    std::vector<float> sortKeys(clusterCount);
+    for (size_t c = 0; c < clusterCount; ++c) {
+        glm::vec3 centroid(0.0f);
+        glm::vec3 normal(0.0f);
+        float area = 0.0f;
+        for (uint32_t t = clusterStarts[c]; t < clusterStarts[c + 1]; ++t) {
+            glm::vec3 p0 = vertices[indices[t * 3]].pos;
+            glm::vec3 p1 = vertices[indices[t * 3 + 1]].pos;
+            glm::vec3 p2 = vertices[indices[t * 3 + 2]].pos;
+            glm::vec3 areaNormal = glm::cross(p1 - p0, p2 - p0);
+            float triangleArea = glm::length(areaNormal);
+            centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            normal += areaNormal;
+            area += triangleArea;
+        }
+        float normalLength = glm::length(normal);
+        if (area > 0.0f && normalLength > 0.0f) {
+            sortKeys[c] = glm::dot(centroid / area - meshCentroid, normal / normalLength);
+        } else {
+            sortKeys[c] = 0.0f;
+        }
+    }
+
+    std::vector<uint32_t> order(clusterCount);
+    for (uint32_t c = 0; c < clusterCount; ++c) {
+        order[c] = c;
+    }
+    std::stable_sort(order.begin(), order.end(), [&sortKeys](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    for (uint32_t c : order) {
+        result.insert(result.end(), indices.begin() + clusterStarts[c] * 3, indices.begin() + clusterStarts[c + 1] * 3);
+    }
+    indices.swap(result);
+}
+
+void MeshOptimizer::OptimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices) {
+    const uint32_t Unused = ~0u;
+    std::vector<uint32_t> remap(vertices.size(), Unused);
+    std::vector<Vertex> result;
+    result.reserve(vertices.size());
+    for (uint32_t &index : indices) {
+        if (remap[index] == Unused) {
+            remap[index] = static_cast<uint32_t>(result.size());
+            result.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(result);
+}
+
+std::vector<uint32_t> MeshOptimizer::RemapPositions(const std::vector<Vertex> &vertices) {
+    uint32_t vertexCount = static_cast<uint32_t>(vertices.size());
+    std::vector<uint32_t> order(vertexCount);
+    for (uint32_t v = 0; v < vertexCount; ++v) {
+        order[v] = v;
+    }
+    auto less = [&vertices](uint32_t a, uint32_t b) {
+        const glm::vec3 &pa = vertices[a].pos;
+        const glm::vec3 &pb = vertices[b].pos;
+        if (pa.x != pb.x) return pa.x < pb.x;
+        if (pa.y != pb.y) return pa.y < pb.y;
+        if (pa.z != pb.z) return pa.z < pb.z;
+        return a < b;
+    };
+    std::sort(order.begin(), order.end(), less);
+
+    std::vector<uint32_t> remap(vertexCount);
+    for (uint32_t begin = 0, end = 0; begin < vertexCount; begin = end) {
+        end = begin + 1;
+        while (end < vertexCount && vertices[order[end]].pos == vertices[order[begin]].pos) {
+            ++end;
+        }
+        for (uint32_t i = begin; i < end; ++i) {
+            remap[order[i]] = order[begin];
+        }
+    }
+    return remap;
+}
+
+VertexCacheStatistics MeshOptimizer::AnalyzeVertexCache(const std::vector<uint32_t> &indices, size_t vertexCount, uint32_t cacheSize) {
+    FifoCache cache(vertexCount, cacheSize);
+    uint32_t transforms = 0;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        transforms += cache.Update(&indices[i]);
+    }
+
+    size_t triangleCount = indices.size() / 3;
+    return {
+        transforms,                                                 // vertexTransforms
+        triangleCount ? float(transforms) / triangleCount : 0.0f,   // acmr
+        vertexCount ? float(transforms) / vertexCount : 0.0f        // atvr
+    };
+}
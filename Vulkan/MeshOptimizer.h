@@ -0,0 +1,36 @@
+#pragma once
+
+#include "CommonHeaders.h"
+#include "Vertex.h"
+
+struct VertexCacheStatistics {
+    uint32_t vertexTransforms;                              // cache misses, i.e. vertex shader invocations
+    float acmr;                                             // transforms per triangle, 0.5 is the ideal for big regular grids
+    float atvr;                                             // transforms per vertex, 1.0 is the ideal
+};
+
+// Index and vertex reordering run once per mesh before it is cached.
+class MeshOptimizer {
+public:
+    // Forsyth's linear speed reordering for an LRU post-transform cache of CacheSize entries
+    static constexpr uint32_t CacheSize = 32;
+
+    // vertex cache, then overdraw, then vertex fetch optimization
+    static void Optimize(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices);
+
+    static void OptimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount);
+
+    // splits a cache optimized index buffer into clusters whose ACMR stays within threshold of the
+    // unsplit order and sorts them so outward facing clusters are drawn first
+    static void OptimizeOverdraw(std::vector<uint32_t> &indices, const std::vector<Vertex> &vertices, float threshold = 1.05f);
+
+    // renumbers vertices in order of first use, unreferenced vertices are dropped
+    static void OptimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices);
+
+    // maps every vertex to the lowest index vertex with the same position, so wedges split by normals or
+    // texture coordinates can be recognized as one point of the surface
+    static std::vector<uint32_t> RemapPositions(const std::vector<Vertex> &vertices);
+
+    // simulates a FIFO cache, the replacement policy most GPUs approximate
+    static VertexCacheStatistics AnalyzeVertexCache(const std::vector<uint32_t> &indices, size_t vertexCount, uint32_t cacheSize = 16);
+};
@@ -0,0 +1,444 @@
+#include "MeshSimplifier.h"
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+namespace {
+
+const float BorderWeight = 10.0f;
+const float NormalWeight = 0.5f;
+const float PassLimitScale = 1.5f;
+const size_t MinPassReduction = 100;                        // a pass removing less than 1/100 of the triangles means a stall
+const float MinFlipCosine = 0.25f;                          // a collapse may turn a remaining triangle by at most ~75 degrees
+const uint32_t NoVertex = ~0u;
+
+enum class VertexKind : uint8_t {
+    Manifold,                                               // single wedge inside the surface, collapses onto any neighbour
+    Border,                                                 // single wedge on an open border, collapses along it
+    Seam,                                                   // two wedges on a closed attribute seam, both collapse along it
+    Locked                                                  // corners, seam junctions and non-manifold vertices stay put
+};
+
+// sum of squared distances to weighted planes, p^T A p + 2 b.p + c with A symmetric
+struct Quadric {
+    double a00 = 0.0, a01 = 0.0, a02 = 0.0, a11 = 0.0, a12 = 0.0, a22 = 0.0;
+    double b0 = 0.0, b1 = 0.0, b2 = 0.0;
+    double c = 0.0;
+    double weight = 0.0;
+
+    void AddPlane(glm::vec3 normal, float distance, float planeWeight) {
+        double x = normal.x, y = normal.y, z = normal.z, d = distance, w = planeWeight;
+        a00 += w * x * x; a01 += w * x * y; a02 += w * x * z;
+        a11 += w * y * y; a12 += w * y * z; a22 += w * z * z;
+        b0 += w * x * d; b1 += w * y * d; b2 += w * z * d;
+        c += w * d * d;
+        weight += w;
+    }
+
+    void Add(const Quadric &other) {
+        a00 += other.a00; a01 += other.a01; a02 += other.a02;
+        a11 += other.a11; a12 += other.a12; a22 += other.a22;
+        b0 += other.b0; b1 += other.b1; b2 += other.b2;
+        c += other.c;
+        weight += other.weight;
+    }
+
+    // weighted mean of the squared plane distances
+    double Error(glm::vec3 p) const {
+        double x = p.x, y = p.y, z = p.z;
+        double error = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z)
+            + 2.0 * (b0 * x + b1 * y + b2 * z) + c;
+        return weight > 0.0 ? std::max(error, 0.0) / weight : 0.0;
+    }
+};
+
+// half edges grouped by start vertex; with a remap they are keyed by position instead of wedge
+struct Adjacency {
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> ends;
+
+    void Build(const std::vector<uint32_t> &indices, const uint32_t *remap, size_t vertexCount) {
+        auto key = [remap](uint32_t v) { return remap ? remap[v] : v; };
+        offsets.assign(vertexCount + 1, 0);
+        for (uint32_t index : indices) {
+            ++offsets[key(index) + 1];
+        }
+        for (size_t v = 0; v < vertexCount; ++v) {
+            offsets[v + 1] += offsets[v];
+        }
+        ends.resize(indices.size());
+        std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+        for (size_t t = 0; t < indices.size(); t += 3) {
+            for (uint32_t k = 0; k < 3; ++k) {
+                ends[cursor[key(indices[t + k])]++] = key(indices[t + (k + 1) % 3]);
+            }
+        }
+    }
+
+    uint32_t Count(uint32_t from, uint32_t to) const {
+        return static_cast<uint32_t>(std::count(ends.begin() + offsets[from], ends.begin() + offsets[from + 1], to));
+    }
+};
+
+struct Collapse {
+    uint32_t from;
+    uint32_t to;
+    uint32_t siblingFrom;                                   // other wedge of a seam and where it goes, NoVertex otherwise
+    uint32_t siblingTo;
+    float cost;                                             // orders the collapses, includes the attribute term
+    float error;                                            // squared geometric part, what the LOD error reports
+};
+
+// links the vertices sharing a position into rings
+std::vector<uint32_t> BuildWedges(const std::vector<uint32_t> &remap) {
+    std::vector<uint32_t> wedges(remap.size());
+    for (uint32_t v = 0; v < remap.size(); ++v) {
+        if (remap[v] == v) {
+            wedges[v] = v;
+        } else {
+            wedges[v] = wedges[remap[v]];
+            wedges[remap[v]] = v;
+        }
+    }
+    return wedges;
+}
+
+}
+
+std::vector<std::vector<uint32_t>> MeshSimplifier::Simplify(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices,
+    const std::vector<size_t> &targetTriangleCounts, std::vector<float> &errors) {
+    std::vector<std::vector<uint32_t>> levels;
+    errors.clear();
+    size_t vertexCount = vertices.size();
+    if (vertexCount == 0 || targetTriangleCounts.empty()) {
+        return levels;
+    }
+
+    std::vector<uint32_t> remap = MeshOptimizer::RemapPositions(vertices);
+    std::vector<uint32_t> wedges = BuildWedges(remap);
+
+    std::vector<uint32_t> current;
+    current.reserve(indices.size());
+    for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+        uint32_t p0 = remap[indices[t]], p1 = remap[indices[t + 1]], p2 = remap[indices[t + 2]];
+        if (p0 != p1 && p1 != p2 && p2 != p0) {
+            current.insert(current.end(), indices.begin() + t, indices.begin() + t + 3);
+        }
+    }
+
+    Adjacency wedgeEdges, positionEdges;
+    positionEdges.Build(current, remap.data(), vertexCount);
+
+    // quadrics live at the position's remap vertex: triangle planes weighted by area, and planes through open
+    // border edges perpendicular to their triangle that hold the outline in place
+    std::vector<Quadric> quadrics(vertexCount);
+    for (size_t t = 0; t < current.size(); t += 3) {
+        glm::vec3 p[3] = { vertices[current[t]].pos, vertices[current[t + 1]].pos, vertices[current[t + 2]].pos };
+        glm::vec3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+        float length = glm::length(normal);
+        if (length == 0.0f) {
+            continue;
+        }
+        normal /= length;
+        for (uint32_t k = 0; k < 3; ++k) {
+            quadrics[remap[current[t + k]]].AddPlane(normal, -glm::dot(normal, p[0]), length * 0.5f);
+        }
+        for (uint32_t k = 0; k < 3; ++k) {
+            uint32_t a = remap[current[t + k]];
+            uint32_t b = remap[current[t + (k + 1) % 3]];
+            if (positionEdges.Count(b, a) != 0) {
+                continue;
+            }
+            glm::vec3 edge = p[(k + 1) % 3] - p[k];
+            glm::vec3 edgeNormal = glm::cross(edge, normal);
+            float edgeLength = glm::length(edgeNormal);
+            if (edgeLength > 0.0f) {
+                edgeNormal /= edgeLength;
+                float distance = -glm::dot(edgeNormal, p[k]);
+                quadrics[a].AddPlane(edgeNormal, distance, edgeLength * edgeLength * BorderWeight);
+                quadrics[b].AddPlane(edgeNormal, distance, edgeLength * edgeLength * BorderWeight);
+            }
+        }
+    }
+
+    std::vector<uint8_t> used(vertexCount);
+    std::vector<uint32_t> openOut(vertexCount), openIn(vertexCount);
+    std::vector<uint32_t> loop(vertexCount), loopBack(vertexCount);
+    std::vector<uint8_t> onBorder(vertexCount), onSeam(vertexCount), nonManifold(vertexCount);
+    std::vector<VertexKind> kinds(vertexCount);
+    std::vector<uint32_t> triangleOffsets(vertexCount + 1), triangles;
+    std::vector<uint32_t> collapseRemap(vertexCount);
+    std::vector<uint8_t> touched(vertexCount);
+    std::vector<Collapse> candidates;
+    double maxError = 0.0;
+
+    size_t level = 0;
+    while (level < targetTriangleCounts.size()) {
+        size_t triangleCount = current.size() / 3;
+        if (triangleCount <= targetTriangleCounts[level]) {
+            levels.push_back(current);
+            errors.push_back(static_cast<float>(std::sqrt(maxError)));
+            ++level;
+            continue;
+        }
+
+        wedgeEdges.Build(current, nullptr, vertexCount);
+        positionEdges.Build(current, remap.data(), vertexCount);
+
+        // an edge without its opposite among the wedges is open: a border if the positions lack it too, a seam otherwise
+        std::fill(used.begin(), used.end(), 0);
+        std::fill(openOut.begin(), openOut.end(), 0);
+        std::fill(openIn.begin(), openIn.end(), 0);
+        std::fill(onBorder.begin(), onBorder.end(), 0);
+        std::fill(onSeam.begin(), onSeam.end(), 0);
+        std::fill(nonManifold.begin(), nonManifold.end(), 0);
+        for (size_t t = 0; t < current.size(); t += 3) {
+            for (uint32_t k = 0; k < 3; ++k) {
+                uint32_t a = current[t + k];
+                uint32_t b = current[t + (k + 1) % 3];
+                used[a] = 1;
+                if (positionEdges.Count(remap[a], remap[b]) > 1) {
+                    nonManifold[remap[a]] = nonManifold[remap[b]] = 1;
+                }
+                if (wedgeEdges.Count(b, a) != 0) {
+                    continue;
+                }
+                std::vector<uint8_t> &openKind = positionEdges.Count(remap[b], remap[a]) == 0 ? onBorder : onSeam;
+                openKind[a] = openKind[b] = 1;
+                ++openOut[a];
+                loop[a] = b;
+                ++openIn[b];
+                loopBack[b] = a;
+            }
+        }
+
+        for (uint32_t p = 0; p < vertexCount; ++p) {
+            if (remap[p] != p) {
+                continue;
+            }
+            uint32_t wedgeCount = 0;
+            uint32_t first = NoVertex;
+            uint32_t v = p;
+            do {
+                if (used[v]) {
+                    first = wedgeCount++ == 0 ? v : first;
+                }
+                v = wedges[v];
+            } while (v != p);
+
+            VertexKind kind = VertexKind::Locked;
+            auto onOneLoop = [&](uint32_t w) { return openOut[w] == 1 && openIn[w] == 1; };
+            if (nonManifold[p] || wedgeCount == 0) {
+                kind = VertexKind::Locked;
+            } else if (wedgeCount == 1) {
+                if (openOut[first] == 0 && openIn[first] == 0) {
+                    kind = VertexKind::Manifold;
+                } else if (onOneLoop(first) && !onSeam[first]) {
+                    kind = VertexKind::Border;
+                }
+            } else if (wedgeCount == 2) {
+                uint32_t second = wedges[first];
+                while (!used[second]) {
+                    second = wedges[second];
+                }
+                if (onOneLoop(first) && onOneLoop(second) && !onBorder[first] && !onBorder[second]) {
+                    kind = VertexKind::Seam;
+                }
+            }
+            kinds[p] = kind;
+        }
+
+        std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+        for (uint32_t index : current) {
+            ++triangleOffsets[remap[index] + 1];
+        }
+        for (size_t v = 0; v < vertexCount; ++v) {
+            triangleOffsets[v + 1] += triangleOffsets[v];
+        }
+        triangles.resize(current.size());
+        {
+            std::vector<uint32_t> cursor(triangleOffsets.begin(), triangleOffsets.end() - 1);
+            for (size_t i = 0; i < current.size(); ++i) {
+                triangles[cursor[remap[current[i]]]++] = static_cast<uint32_t>(i / 3);
+            }
+        }
+
+        auto addCandidate = [&](uint32_t from, uint32_t to) {
+            uint32_t p0 = remap[from];
+            uint32_t p1 = remap[to];
+            Collapse collapse{ from, to, NoVertex, NoVertex, 0.0f, 0.0f };
+            switch (kinds[p0]) {
+            case VertexKind::Manifold:
+                break;
+            case VertexKind::Border:
+            case VertexKind::Seam:
+                if ((to != loop[from] && to != loopBack[from]) || (kinds[p1] != kinds[p0] && kinds[p1] != VertexKind::Locked)) {
+                    return;
+                }
+                if (kinds[p0] == VertexKind::Seam) {
+                    uint32_t sibling = wedges[from];
+                    while (!used[sibling]) {
+                        sibling = wedges[sibling];
+                    }
+                    collapse.siblingFrom = sibling;
+                    if (remap[loop[sibling]] == p1) {
+                        collapse.siblingTo = loop[sibling];
+                    } else if (remap[loopBack[sibling]] == p1) {
+                        collapse.siblingTo = loopBack[sibling];
+                    } else {
+                        return;
+                    }
+                }
+                break;
+            default:
+                return;
+            }
+
+            // the attribute term grows with how far the collapse drags the old normals across the surface
+            glm::vec3 offset = vertices[to].pos - vertices[from].pos;
+            glm::vec3 normalChange = vertices[to].normal - vertices[from].normal;
+            if (collapse.siblingFrom != NoVertex) {
+                glm::vec3 siblingChange = vertices[collapse.siblingTo].normal - vertices[collapse.siblingFrom].normal;
+                normalChange = glm::dot(siblingChange, siblingChange) > glm::dot(normalChange, normalChange) ? siblingChange : normalChange;
+            }
+            double error = quadrics[p0].Error(vertices[to].pos);
+            collapse.error = static_cast<float>(error);
+            collapse.cost = static_cast<float>(error + NormalWeight * glm::dot(normalChange, normalChange) * glm::dot(offset, offset));
+            candidates.push_back(collapse);
+        };
+
+        candidates.clear();
+        for (size_t t = 0; t < current.size(); t += 3) {
+            for (uint32_t k = 0; k < 3; ++k) {
+                uint32_t a = current[t + k];
+                uint32_t b = current[t + (k + 1) % 3];
+                addCandidate(a, b);
+                // closed edges get the other direction from the neighbouring triangle
+                if (wedgeEdges.Count(b, a) == 0) {
+                    addCandidate(b, a);
+                }
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(), [](const Collapse &a, const Collapse &b) { return a.cost < b.cost; });
+
+        // greedy in order of cost; the one-ring of a collapsed vertex is frozen for the rest of the pass so the flip
+        // test of every later collapse still sees the triangles it will actually move. Once the cheap candidates
+        // are blocked the pass ends rather than reaching for expensive ones, the next pass has fresh neighbourhoods;
+        // the limit is a little above the cost of the collapse that would reach the target if none were blocked, but
+        // never so low that the pass could not make the progress that tells it apart from a stall.
+        size_t neededCollapses = std::max((triangleCount - targetTriangleCounts[level] + 1) / 2, triangleCount / MinPassReduction);
+        float passLimit = neededCollapses < candidates.size() ? candidates[neededCollapses].cost * PassLimitScale : FLT_MAX;
+        for (uint32_t v = 0; v < vertexCount; ++v) {
+            collapseRemap[v] = v;
+        }
+        std::fill(touched.begin(), touched.end(), 0);
+        size_t remaining = triangleCount;
+        size_t collapseCount = 0;
+        for (const Collapse &collapse : candidates) {
+            if (remaining <= targetTriangleCounts[level] || (collapse.cost > passLimit && collapseCount > 0)) {
+                break;
+            }
+            uint32_t p0 = remap[collapse.from];
+            uint32_t p1 = remap[collapse.to];
+            if (touched[p0] || touched[p1]) {
+                continue;
+            }
+
+            glm::vec3 target = vertices[collapse.to].pos;
+            uint32_t removed = 0;
+            bool flips = false;
+            for (uint32_t i = triangleOffsets[p0]; i < triangleOffsets[p0 + 1] && !flips; ++i) {
+                const uint32_t *triangle = &current[triangles[i] * 3];
+                glm::vec3 before[3], after[3];
+                bool degenerates = false;
+                for (uint32_t k = 0; k < 3; ++k) {
+                    before[k] = vertices[triangle[k]].pos;
+                    after[k] = remap[triangle[k]] == p0 ? target : before[k];
+                    degenerates |= remap[triangle[k]] == p1;
+                }
+                if (degenerates) {
+                    ++removed;
+                    continue;
+                }
+                glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+                glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+                flips = glm::dot(normalBefore, normalAfter) < MinFlipCosine * glm::length(normalBefore) * glm::length(normalAfter);
+            }
+            if (flips) {
+                continue;
+            }
+
+            collapseRemap[collapse.from] = collapse.to;
+            if (collapse.siblingFrom != NoVertex) {
+                collapseRemap[collapse.siblingFrom] = collapse.siblingTo;
+            }
+            quadrics[p1].Add(quadrics[p0]);
+            maxError = std::max(maxError, static_cast<double>(collapse.error));
+            remaining -= removed;
+            ++collapseCount;
+
+            touched[p0] = touched[p1] = 1;
+            for (uint32_t i = triangleOffsets[p0]; i < triangleOffsets[p0 + 1]; ++i) {
+                for (uint32_t k = 0; k < 3; ++k) {
+                    touched[remap[current[triangles[i] * 3 + k]]] = 1;
+                }
+            }
+        }
+
+        size_t write = 0;
+        for (size_t t = 0; t < current.size(); t += 3) {
+            uint32_t a = collapseRemap[current[t]], b = collapseRemap[current[t + 1]], c = collapseRemap[current[t + 2]];
+            if (remap[a] != remap[b] && remap[b] != remap[c] && remap[c] != remap[a]) {
+                current[write++] = a;
+                current[write++] = b;
+                current[write++] = c;
+            }
+        }
+        current.resize(write);
+
+        size_t removedTriangles = triangleCount - current.size() / 3;
+        if (current.size() / 3 > targetTriangleCounts[level] && removedTriangles * MinPassReduction < triangleCount) {
+            // (almost) everything left is locked, the last level is as far as the mesh goes
+            size_t previousSize = levels.empty() ? indices.size() : levels.back().size();
+            if (current.size() < previousSize) {
+                levels.push_back(current);
+                errors.push_back(static_cast<float>(std::sqrt(maxError)));
+            }
+            break;
+        }
+    }
+    return levels;
+}
+
+void MeshSimplifier::BuildLods(Mesh &mesh) {
+    mesh.lods.assign(1, { 0, static_cast<uint32_t>(mesh.indices.size()), 0.0f, 0, 0 });
+
+    std::vector<size_t> targets;
+    for (size_t triangles = mesh.indices.size() / 6; targets.size() + 1 < MaxLodCount && triangles >= MinLodTriangles; triangles /= 2) {
+        targets.push_back(triangles);
+    }
+    if (targets.empty()) {
+        return;
+    }
+
+    std::vector<float> errors;
+    std::vector<std::vector<uint32_t>> levels = Simplify(mesh.vertices, mesh.indices, targets, errors);
+    size_t previousSize = mesh.indices.size();
+    for (size_t i = 0; i < levels.size(); ++i) {
+        // a level that barely got simpler costs memory and a visible switch for nothing
+        if (levels[i].size() * 4 > previousSize * 3) {
+            break;
+        }
+        MeshOptimizer::OptimizeVertexCache(levels[i], mesh.vertices.size());
+        mesh.lods.push_back({
+            static_cast<uint32_t>(mesh.indices.size()),             // firstIndex
+            static_cast<uint32_t>(levels[i].size()),                // indexCount
+            errors[i],                                              // error
+            0,                                                      // firstMeshlet
+            0                                                       // meshletCount
+        });
+        mesh.indices.insert(mesh.indices.end(), levels[i].begin(), levels[i].end());
+        previousSize = levels[i].size();
+    }
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "CommonHeaders.h"
+#include "Vertex.h"
+#include "MeshLoader.h"
+
+// Quadric error metric simplification by half edge collapses: a vertex only ever moves onto a neighbour,
+// so every level indexes the vertex array of the full mesh and a LOD is nothing but an index range.
+// Open borders and attribute seams (one position, two wedges with different normals or texture
+// coordinates) only collapse along themselves, seams on both sides at once, so neither tears open.
+// Collapses are ordered by geometric error plus the normal change they drag across the surface,
+// LOD errors report the geometric part only.
+class MeshSimplifier {
+public:
+    static constexpr uint32_t MaxLodCount = 5;              // including the full mesh
+    static constexpr size_t MinLodTriangles = 64;
+
+    // simplifies towards every target triangle count in turn, largest first, and returns the indices reached for
+    // each; errors receives the largest collapse error committed up to that level, in model units. Fewer levels
+    // come back when no collapse is left.
+    static std::vector<std::vector<uint32_t>> Simplify(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices,
+        const std::vector<size_t> &targetTriangleCounts, std::vector<float> &errors);
+
+    // appends the levels, each with about half the triangles of the one before and cache optimized, behind the
+    // full mesh indices and records all of them in mesh.lods, leaving the meshlets to the caller
+    static void BuildLods(Mesh &mesh);
+};
@@ -0,0 +1,251 @@
+#include "Meshlet.h"
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+namespace {
+
+// below this the normals spread over more than a hemisphere (minus a margin) and no viewer sees only back faces
+const float MinConeSpread = 0.1f;
+// how many new vertices a fully perpendicular normal is worth when growing a meshlet
+const float ConeWeight = 2.0f;
+
+Meshlet ComputeBounds(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices, uint32_t firstIndex, uint32_t indexCount) {
+    Meshlet meshlet{};
+    meshlet.firstIndex = firstIndex;
+    meshlet.indexCount = indexCount;
+
+    glm::vec3 boundsMin = vertices[indices[firstIndex]].pos;
+    glm::vec3 boundsMax = boundsMin;
+    for (uint32_t i = firstIndex; i < firstIndex + indexCount; ++i) {
+        boundsMin = glm::min(boundsMin, vertices[indices[i]].pos);
+        boundsMax = glm::max(boundsMax, vertices[indices[i]].pos);
+    }
+    meshlet.center = (boundsMin + boundsMax) * 0.5f;
+    meshlet.radius = 0.0f;
+    for (uint32_t i = firstIndex; i < firstIndex + indexCount; ++i) {
+        meshlet.radius = std::max(meshlet.radius, glm::length(vertices[indices[i]].pos - meshlet.center));
+    }
+
+    // no culling unless a tight enough cone is found
+    meshlet.coneApex = meshlet.center;
+    meshlet.coneAxis = glm::vec3(0.0f);
+    meshlet.coneCutoff = 1.0f;
+
+    // one unit normal per triangle, zero for degenerate ones
+    std::vector<glm::vec3> normals;
+    normals.reserve(indexCount / 3);
+    glm::vec3 axis(0.0f);
+    for (uint32_t t = firstIndex; t + 2 < firstIndex + indexCount; t += 3) {
+        glm::vec3 p0 = vertices[indices[t]].pos;
+        glm::vec3 normal = glm::cross(vertices[indices[t + 1]].pos - p0, vertices[indices[t + 2]].pos - p0);
+        float length = glm::length(normal);
+        normals.push_back(length > 0.0f ? normal / length : glm::vec3(0.0f));
+        axis += normals.back();
+    }
+    float axisLength = glm::length(axis);
+    if (axisLength == 0.0f) {
+        return meshlet;
+    }
+    axis /= axisLength;
+
+    float minDot = 1.0f;
+    for (const glm::vec3 &normal : normals) {
+        if (glm::dot(normal, normal) > 0.0f) {
+            minDot = std::min(minDot, glm::dot(normal, axis));
+        }
+    }
+    if (minDot <= MinConeSpread) {
+        return meshlet;
+    }
+
+    // the apex goes behind the plane of every triangle, from there all of them face away
+    float maxT = 0.0f;
+    for (uint32_t i = 0; i < normals.size(); ++i) {
+        if (glm::dot(normals[i], normals[i]) > 0.0f) {
+            glm::vec3 p0 = vertices[indices[firstIndex + i * 3]].pos;
+            maxT = std::max(maxT, glm::dot(meshlet.center - p0, normals[i]) / glm::dot(axis, normals[i]));
+        }
+    }
+
+    meshlet.coneApex = meshlet.center - axis * maxT;
+    meshlet.coneAxis = axis;
+    meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+    return meshlet;
+}
+
+}
+
+void MeshletBuilder::Build(const std::vector<Vertex> &vertices, std::vector<uint32_t> &indices, uint32_t firstIndex, uint32_t indexCount,
+    std::vector<Meshlet> &meshlets) {
+    const uint32_t NoMeshlet = ~0u;
+    size_t firstMeshlet = meshlets.size();
+    uint32_t triangleCount = indexCount / 3;
+    const uint32_t *triangles = indices.data() + firstIndex;
+
+    // live triangles of every position, the first liveCount entries of a position have not been emitted yet;
+    // growing over positions rather than vertices crosses attribute seams
+    std::vector<uint32_t> remap = MeshOptimizer::RemapPositions(vertices);
+    std::vector<uint32_t> liveCount(vertices.size(), 0);
+    for (uint32_t i = 0; i < triangleCount * 3; ++i) {
+        ++liveCount[remap[triangles[i]]];
+    }
+    std::vector<uint32_t> offsets(vertices.size() + 1, 0);
+    for (size_t v = 0; v < vertices.size(); ++v) {
+        offsets[v + 1] = offsets[v] + liveCount[v];
+    }
+    std::vector<uint32_t> adjacency(triangleCount * 3);
+    {
+        std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+        for (uint32_t i = 0; i < triangleCount * 3; ++i) {
+            adjacency[cursor[remap[triangles[i]]]++] = i / 3;
+        }
+    }
+
+    std::vector<glm::vec3> normals(triangleCount);
+    for (uint32_t t = 0; t < triangleCount; ++t) {
+        glm::vec3 p0 = vertices[triangles[t * 3]].pos;
+        glm::vec3 normal = glm::cross(vertices[triangles[t * 3 + 1]].pos - p0, vertices[triangles[t * 3 + 2]].pos - p0);
+        float length = glm::length(normal);
+        normals[t] = length > 0.0f ? normal / length : glm::vec3(0.0f);
+    }
+
+    std::vector<uint32_t> vertexMeshlet(vertices.size(), NoMeshlet);
+    std::vector<uint32_t> positionMeshlet(vertices.size(), NoMeshlet);
+    std::vector<uint8_t> emitted(triangleCount, 0);
+    std::vector<uint32_t> result;
+    result.reserve(triangleCount * 3);
+    uint32_t meshletVertexCount = 0;
+    std::vector<uint32_t> meshletPositions;
+    uint32_t seedCursor = 0;
+    uint32_t meshletId = 0;
+
+    auto countNew = [&](uint32_t t) {
+        uint32_t count = 0;
+        for (uint32_t k = 0; k < 3; ++k) {
+            uint32_t v = triangles[t * 3 + k];
+            bool repeated = (k > 0 && triangles[t * 3] == v) || (k > 1 && triangles[t * 3 + 1] == v);
+            count += vertexMeshlet[v] != meshletId && !repeated;
+        }
+        return count;
+    };
+    auto emit = [&](uint32_t t) {
+        emitted[t] = 1;
+        for (uint32_t k = 0; k < 3; ++k) {
+            uint32_t v = triangles[t * 3 + k];
+            result.push_back(v);
+            if (vertexMeshlet[v] != meshletId) {
+                vertexMeshlet[v] = meshletId;
+                ++meshletVertexCount;
+            }
+            uint32_t p = remap[v];
+            if (positionMeshlet[p] != meshletId) {
+                positionMeshlet[p] = meshletId;
+                meshletPositions.push_back(p);
+            }
+            uint32_t *live = &adjacency[offsets[p]];
+            uint32_t *found = std::find(live, live + liveCount[p], t);
+            if (found != live + liveCount[p]) {
+                std::swap(*found, live[--liveCount[p]]);
+            }
+        }
+    };
+
+    while (true) {
+        // seeds follow the incoming order, so meshlets keep the locality of the cache optimized indices
+        while (seedCursor < triangleCount && emitted[seedCursor]) {
+            ++seedCursor;
+        }
+        if (seedCursor == triangleCount) {
+            break;
+        }
+
+        uint32_t meshletStart = static_cast<uint32_t>(result.size());
+        meshletVertexCount = 0;
+        meshletPositions.clear();
+        glm::vec3 axis = normals[seedCursor];
+        emit(seedCursor);
+        uint32_t meshletTriangles = 1;
+
+        // grow over shared positions, preferring triangles that add few vertices and keep the normal cone narrow
+        while (meshletTriangles < MaxTriangles) {
+            uint32_t best = NoMeshlet;
+            float bestScore = FLT_MAX;
+            glm::vec3 direction = glm::length(axis) > 0.0f ? axis / glm::length(axis) : glm::vec3(0.0f);
+            for (uint32_t p : meshletPositions) {
+                for (uint32_t i = 0; i < liveCount[p]; ++i) {
+                    uint32_t t = adjacency[offsets[p] + i];
+                    uint32_t newVertices = countNew(t);
+                    if (meshletVertexCount + newVertices > MaxVertices) {
+                        continue;
+                    }
+                    float score = newVertices + ConeWeight * (1.0f - glm::dot(normals[t], direction));
+                    if (score < bestScore) {
+                        bestScore = score;
+                        best = t;
+                    }
+                }
+            }
+            if (best == NoMeshlet) {
+                break;
+            }
+            axis += normals[best];
+            emit(best);
+            ++meshletTriangles;
+        }
+
+        meshlets.push_back({});
+        meshlets.back().firstIndex = firstIndex + meshletStart;
+        meshlets.back().indexCount = static_cast<uint32_t>(result.size()) - meshletStart;
+        ++meshletId;
+    }
+
+    std::copy(result.begin(), result.end(), indices.begin() + firstIndex);
+    for (size_t i = firstMeshlet; i < meshlets.size(); ++i) {
+        meshlets[i] = ComputeBounds(vertices, indices, meshlets[i].firstIndex, meshlets[i].indexCount);
+    }
+}
+
+MeshletCuller::MeshletCuller(const glm::mat4 &projection, const glm::mat4 &modelView) {
+    // Gribb-Hartmann planes from the rows of the combined matrix, depth in [0, 1]
+    glm::mat4 matrix = projection * modelView;
+    auto row = [&matrix](int i) { return glm::vec4(matrix[0][i], matrix[1][i], matrix[2][i], matrix[3][i]); };
+    m_Planes = {
+        row(3) + row(0),                                            // left
+        row(3) - row(0),                                            // right
+        row(3) + row(1),                                            // bottom
+        row(3) - row(1),                                            // top
+        row(2),                                                     // near
+        row(3) - row(2)                                             // far
+    };
+    for (glm::vec4 &plane : m_Planes) {
+        plane /= glm::length(glm::vec3(plane));
+    }
+
+    m_CameraPosition = glm::vec3(glm::inverse(modelView) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+
+    float scaleX = glm::length(glm::vec3(modelView[0]));
+    float scaleY = glm::length(glm::vec3(modelView[1]));
+    float scaleZ = glm::length(glm::vec3(modelView[2]));
+    float tolerance = 1e-3f * scaleX;
+    // a mirroring transform turns front faces into back faces for the rasterizer, but not for the cones
+    m_ConeCulling = std::abs(scaleX - scaleY) <= tolerance && std::abs(scaleX - scaleZ) <= tolerance
+        && glm::determinant(glm::mat3(modelView)) > 0.0f;
+}
+
+bool MeshletCuller::IsVisible(const Meshlet &meshlet) const {
+    for (const glm::vec4 &plane : m_Planes) {
+        if (glm::dot(glm::vec3(plane), meshlet.center) + plane.w < -meshlet.radius) {
+            return false;
+        }
+    }
+    if (m_ConeCulling) {
+        glm::vec3 view = meshlet.coneApex - m_CameraPosition;
+        float distance = glm::length(view);
+        if (distance > 0.0f && glm::dot(view, meshlet.coneAxis) >= meshlet.coneCutoff * distance) {
+            return false;
+        }
+    }
+    return true;
+}
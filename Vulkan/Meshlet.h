@@ -0,0 +1,43 @@
+#pragma once
+
+#include "CommonHeaders.h"
+#include "Vertex.h"
+
+// A range of triangles of one LOD touching at most MaxVertices vertices, with the bounds the
+// culling stage tests. The cone holds every triangle normal; a viewer inside the negative cone behind
+// apex sees only back faces.
+struct Meshlet {
+    glm::vec3 center;                                       // bounding sphere, model space
+    float radius;
+    glm::vec3 coneApex;
+    float coneCutoff;                                       // sine of the cone half angle, 1 disables cone culling
+    glm::vec3 coneAxis;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+};
+
+class MeshletBuilder {
+public:
+    static constexpr uint32_t MaxVertices = 64;
+    static constexpr uint32_t MaxTriangles = 124;
+
+    // partitions indices [firstIndex, firstIndex + indexCount) and rewrites that range meshlet by meshlet, so
+    // every meshlet is a range of the index buffer; meshlets grow over shared positions from seeds taken in
+    // the incoming order and favour triangles facing like the ones already in, which keeps the cones tight
+    static void Build(const std::vector<Vertex> &vertices, std::vector<uint32_t> &indices, uint32_t firstIndex, uint32_t indexCount,
+        std::vector<Meshlet> &meshlets);
+};
+
+// frustum and viewer of one instance in its model space
+class MeshletCuller {
+public:
+    // modelView must not contain the dequantization, meshlet bounds are in model space
+    MeshletCuller(const glm::mat4 &projection, const glm::mat4 &modelView);
+
+    bool IsVisible(const Meshlet &meshlet) const;
+
+private:
+    std::array<glm::vec4, 6> m_Planes;                      // normalized, inside is positive
+    glm::vec3 m_CameraPosition;
+    bool m_ConeCulling;                                     // cones only hold under uniform scale without mirroring
+};
@@ -3,23 +3,16 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
-#define TINYOBJLOADER_IMPLEMENTATION
-#include <tiny_obj_loader.h>
 
-
-Model::Model(std::vector<std::string> modelFilenames, std::string textureFilename) :
-    m_VertexBuffer(VK_NULL_HANDLE), m_IndexBuffer(VK_NULL_HANDLE),
-    m_VertexBufferMemory(VK_NULL_HANDLE), m_IndexBufferMemory(VK_NULL_HANDLE),
-    m_TextureImage(VK_NULL_HANDLE), m_TextureImageMemory(VK_NULL_HANDLE), m_TextureImageView(VK_NULL_HANDLE),
+Model::Model(std::vector<std::string> modelFilenames, std::string textureFilename, VertexEncoding encoding) :
+    m_VertexBuffer(VK_NULL_HANDLE), m_VertexBufferMemory(),
+    m_TextureImage(VK_NULL_HANDLE), m_TextureImageMemory(), m_TextureImageView(VK_NULL_HANDLE),
     m_VkFactory(VulkanFactory::GetInstance()){
-    for (const auto& modelFilename : modelFilenames) {
-        LoadModel(modelFilename);
-    }
+    m_Mesh = EncodeMesh(MeshLoader::Load(modelFilenames), encoding);
     CreateDescriptorSetLayout();
     CreateTextureImage(textureFilename);
     CreateTextureImageView();
     CreateVertexBuffer();
-    CreateIndexBuffer();
     UpdateWindowSize();
 }
 
@@ -44,125 +37,44 @@ void Model::CreateTextureImage(std::string texPath) {
         throw std::runtime_error("cannot load texture");
     }
 
-    VkDeviceSize imageSize = (VkDeviceSize)texWidth * texHeight * 4;
-
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-
-    m_VkFactory->CreateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        stagingBuffer, stagingBufferMemory);
-
-    void* data;
-    vkMapMemory(m_VkFactory->GetDevice(), stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, imageSize);
-    vkUnmapMemory(m_VkFactory->GetDevice(), stagingBufferMemory);
-
-    stbi_image_free(pixels);
-
     m_VkFactory->CreateImage(texWidth, texHeight, 1, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
         VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
         m_TextureImage, m_TextureImageMemory, 1);
 
     m_VkFactory->TransitionImageLayout(m_TextureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1);
-    m_VkFactory->CopyBufferToImage(stagingBuffer, m_TextureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), 1, 0);
+    m_VkFactory->UploadToImage(m_TextureImage, pixels, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), 1, 4, 0);
     m_VkFactory->TransitionImageLayout(m_TextureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1);
 
-    vkDestroyBuffer(m_VkFactory->GetDevice(), stagingBuffer, nullptr);
-    vkFreeMemory(m_VkFactory->GetDevice(), stagingBufferMemory, nullptr);
+    stbi_image_free(pixels);
 }
 
 void Model::CreateTextureImageView() {
     m_TextureImageView = m_VkFactory->CreateImageView(m_TextureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_2D, 1);
 }
 
-void Model::LoadModel(std::string modelPath) {
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-
-    std::string warning, error;
-
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warning, &error, modelPath.c_str())) {
-        throw std::runtime_error(warning + error);
-    }
-
-    std::unordered_map<Vertex, uint32_t> uniqueVertices;
-
-    for (auto& shape : shapes) {
-        for (const auto& index : shape.mesh.indices) {
-            Vertex vertex{};
-
-            vertex.pos = {
-                attrib.vertices[3 * index.vertex_index + 0],
-                attrib.vertices[3 * index.vertex_index + 1],
-                attrib.vertices[3 * index.vertex_index + 2]
-            };
-
-            if (index.texcoord_index == -1) {
-                vertex.texCoord = { 0.0, 0.0 };
-            }
-            else {
-                vertex.texCoord = {
-                    attrib.texcoords[2 * index.texcoord_index + 0],
-                    1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-                };
-            }
-            vertex.normal = {
-                attrib.normals[3 * index.normal_index + 0],
-                attrib.normals[3 * index.normal_index + 1],
-                attrib.normals[3 * index.normal_index + 2]
-            };
-
-            if (uniqueVertices.count(vertex) == 0) {
-                uniqueVertices[vertex] = static_cast<uint32_t>(m_Vertices.size());
-                m_Vertices.push_back(vertex);
-            }
-
-            m_Indices.push_back(uniqueVertices[vertex]);
-        }
-    }
-}
-
 void Model::CreateVertexBuffer() {
-    VkDeviceSize bufferSize = sizeof(m_Vertices[0]) * m_Vertices.size();
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-
-    m_VkFactory->CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-    void* data;
-    vkMapMemory(m_VkFactory->GetDevice(), stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, m_Vertices.data(), bufferSize);
-    vkUnmapMemory(m_VkFactory->GetDevice(), stagingBufferMemory);
-
+    VkDeviceSize bufferSize = m_Mesh.vertexData.size();
     m_VkFactory->CreateBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_VertexBuffer, m_VertexBufferMemory);
-
-    m_VkFactory->CopyBuffer(stagingBuffer, m_VertexBuffer, bufferSize);
-
-    vkDestroyBuffer(m_VkFactory->GetDevice(), stagingBuffer, nullptr);
-    vkFreeMemory(m_VkFactory->GetDevice(), stagingBufferMemory, nullptr);
+    m_VkFactory->UploadToBuffer(m_VertexBuffer, 0, m_Mesh.vertexData.data(), bufferSize);
 }
 
-void Model::CreateIndexBuffer() {
-    VkDeviceSize bufferSize = sizeof(m_Indices[0]) * m_Indices.size();
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-
-    m_VkFactory->CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-    void* data;
-    vkMapMemory(m_VkFactory->GetDevice(), stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, m_Indices.data(), bufferSize);
-    vkUnmapMemory(m_VkFactory->GetDevice(), stagingBufferMemory);
-
-    m_VkFactory->CreateBuffer(bufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_IndexBuffer, m_IndexBufferMemory);
-
-    m_VkFactory->CopyBuffer(stagingBuffer, m_IndexBuffer, bufferSize);
-
-    vkDestroyBuffer(m_VkFactory->GetDevice(), stagingBuffer, nullptr);
-    vkFreeMemory(m_VkFactory->GetDevice(), stagingBufferMemory, nullptr);
+void Model::ReserveIndexStream(uint32_t index, VkDeviceSize size) {
+    if (m_IndexStreams.size() <= index) {
+        m_IndexStreams.resize(index + 1, { VK_NULL_HANDLE, MemoryAllocation(), 0 });
+    }
+    IndexStream &stream = m_IndexStreams[index];
+    if (stream.size >= size) {
+        return;
+    }
+    // the fence of this swapchain image was waited for before recording, nothing reads the old buffer anymore
+    if (stream.buffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(m_VkFactory->GetDevice(), stream.buffer, nullptr);
+        m_VkFactory->FreeMemory(stream.memory);
+    }
+    m_VkFactory->CreateBuffer(size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stream.buffer, stream.memory);
+    stream.size = size;
 }
 
 void Model::Cleanup() {
@@ -172,12 +84,15 @@ void Model::Cleanup() {
     vkDestroyDescriptorSetLayout(m_VkFactory->GetDevice(), m_DescriptorSetLayout, nullptr);
     vkDestroySampler(m_VkFactory->GetDevice(), m_TextureSampler, nullptr);
     vkDestroyBuffer(m_VkFactory->GetDevice(), m_VertexBuffer, nullptr);
-    vkDestroyBuffer(m_VkFactory->GetDevice(), m_IndexBuffer, nullptr);
-    vkFreeMemory(m_VkFactory->GetDevice(), m_VertexBufferMemory, nullptr);
-    vkFreeMemory(m_VkFactory->GetDevice(), m_IndexBufferMemory, nullptr);
+    m_VkFactory->FreeMemory(m_VertexBufferMemory);
+    for (auto &stream : m_IndexStreams) {
+        vkDestroyBuffer(m_VkFactory->GetDevice(), stream.buffer, nullptr);
+        m_VkFactory->FreeMemory(stream.memory);
+    }
+    m_IndexStreams.clear();
     vkDestroyImageView(m_VkFactory->GetDevice(), m_TextureImageView, nullptr);
     vkDestroyImage(m_VkFactory->GetDevice(), m_TextureImage, nullptr);
-    vkFreeMemory(m_VkFactory->GetDevice(), m_TextureImageMemory, nullptr);
+    m_VkFactory->FreeMemory(m_TextureImageMemory);
 }
 
 VkCommandBuffer* Model::Draw(uint32_t index, VkCommandBufferBeginInfo* beginInfo, glm::mat4& viewMatrix, LightsPositions lp) {
@@ -189,8 +104,15 @@ VkCommandBuffer* Model::Draw(uint32_t index, VkCommandBufferBeginInfo* beginInfo
     vkResetCommandBuffer(m_CommandBuffers[index], 0);
     vkBeginCommandBuffer(m_CommandBuffers[index], beginInfo);
     vkCmdBindPipeline(m_CommandBuffers[index], VK_PIPELINE_BIND_POINT_GRAPHICS, m_GraphicsPipeline);
-    vkCmdBindVertexBuffers(m_CommandBuffers[index], 0, 1, &m_VertexBuffer, &offsets);
-    vkCmdBindIndexBuffer(m_CommandBuffers[index], m_IndexBuffer, offsets, VK_INDEX_TYPE_UINT32);
+    // both vertex streams live in the same buffer
+    VkBuffer vertexBuffers[2] = { m_VertexBuffer, m_VertexBuffer };
+    VkDeviceSize vertexOffsets[2] = { 0, m_Mesh.attributeOffset };
+    vkCmdBindVertexBuffers(m_CommandBuffers[index], 0, 2, vertexBuffers, vertexOffsets);
+    VkDeviceSize indexSize = m_Mesh.indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+    // no instance can emit more than the finest LOD
+    ReserveIndexStream(index, std::max<VkDeviceSize>(m_Mesh.lods[0].indexCount * indexSize * m_Instances.size(), sizeof(uint32_t)));
+    uint8_t *stream = static_cast<uint8_t*>(m_VkFactory->MapMemory(m_IndexStreams[index].memory));
+    vkCmdBindIndexBuffer(m_CommandBuffers[index], m_IndexStreams[index].buffer, offsets, m_Mesh.indexType);
     vkCmdBindDescriptorSets(m_CommandBuffers[index], VK_PIPELINE_BIND_POINT_GRAPHICS, m_GraphicsPipelineLayout,
                             0, 1, &m_DescriptorSets[index], 0, nullptr);
     vkCmdPushConstants(m_CommandBuffers[index], m_GraphicsPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(UniformBufferObject), sizeof(lp), &lp);
@@ -199,10 +121,30 @@ VkCommandBuffer* Model::Draw(uint32_t index, VkCommandBufferBeginInfo* beginInfo
     ubo.projection = glm::perspective(glm::radians(60.0f), m_Width / (float)m_Height, 0.1f, 20.0f);
     ubo.projection[1][1] *= -1;
     ubo.view = viewMatrix;
+    float pixelsPerUnit = m_Height / (2.0f * std::tan(glm::radians(60.0f) * 0.5f));
+    uint32_t streamSize = 0;
     for (auto& instance : m_Instances) {
-        ubo.model = instance.GetModelMatrix(time);
+        glm::mat4 modelMatrix = instance.GetModelMatrix(time);
+        glm::mat4 modelView = viewMatrix * modelMatrix;
+        const MeshLod &lod = m_Mesh.lods[m_Mesh.SelectLod(modelView, pixelsPerUnit)];
+
+        // off-screen and back-facing meshlets never reach the index stream
+        MeshletCuller culler(ubo.projection, modelView);
+        uint32_t firstIndex = streamSize;
+        for (uint32_t m = lod.firstMeshlet; m < lod.firstMeshlet + lod.meshletCount; ++m) {
+            const Meshlet &meshlet = m_Mesh.meshlets[m];
+            if (culler.IsVisible(meshlet)) {
+                memcpy(stream + streamSize * indexSize, m_Mesh.indexData.data() + meshlet.firstIndex * indexSize, meshlet.indexCount * indexSize);
+                streamSize += meshlet.indexCount;
+            }
+        }
+        if (streamSize == firstIndex) {
+            continue;
+        }
+
+        ubo.model = modelMatrix * m_Mesh.quantization.GetDequantizeMatrix();
         vkCmdPushConstants(m_CommandBuffers[index], m_GraphicsPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ubo), &ubo);
-        vkCmdDrawIndexed(m_CommandBuffers[index], static_cast<uint32_t>(m_Indices.size()), 1, 0, 0, 0);
+        vkCmdDrawIndexed(m_CommandBuffers[index], streamSize - firstIndex, 1, firstIndex, 0, 0);
     }
     vkEndCommandBuffer(m_CommandBuffers[index]);
     return &m_CommandBuffers[index];
@@ -235,6 +177,19 @@ void Model::CreateGraphicsPipeline() {
     m_VkFactory->CreateShaderModule(vertexShaderModule, "shaders/vert.spv");
     m_VkFactory->CreateShaderModule(fragmentShaderModule, "shaders/frag.spv");
 
+    VkBool32 packedVertex = m_Mesh.layout.IsPacked();
+    VkSpecializationMapEntry specializationEntry = {
+        0,                                                          // constantID
+        0,                                                          // offset
+        sizeof(VkBool32)                                            // size
+    };
+    VkSpecializationInfo specializationInfo = {
+        1,                                                          // mapEntryCount
+        &specializationEntry,                                       // pMapEntries
+        sizeof(packedVertex),                                       // dataSize
+        &packedVertex                                               // pData
+    };
+
     VkPipelineShaderStageCreateInfo vsStageCreateInfo = {
         VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,        // sType
         nullptr,                                                    // pNext
@@ -242,7 +197,7 @@ void Model::CreateGraphicsPipeline() {
         VK_SHADER_STAGE_VERTEX_BIT,                                 // stage
         vertexShaderModule,                                         // module
         "main",                                                     // pName
-        nullptr                                                     // pSpecializationInfo
+        &specializationInfo                                         // pSpecializationInfo
     };
 
     VkPipelineShaderStageCreateInfo fsStageCreateInfo = {
@@ -256,15 +211,15 @@ void Model::CreateGraphicsPipeline() {
     };
 
     std::vector<VkPipelineShaderStageCreateInfo> shaderStages = { vsStageCreateInfo, fsStageCreateInfo };
-    auto inputAttribute = Vertex::GetAttributeDescription();
-    auto bindingDescr = Vertex::GetBindingDescription();
+    auto &inputAttribute = m_Mesh.layout.attributes;
+    auto &bindingDescr = m_Mesh.layout.bindings;
 
     VkPipelineVertexInputStateCreateInfo vertexInputStateCreateInfo = {
         VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,  // sType
         nullptr,                                                    // pNext
         0,                                                          // flags
-        1,                                                          // vertexBindingDescriptionCount
-        &bindingDescr,                                              // pVertexBindingDescriptions
+        static_cast<uint32_t>(bindingDescr.size()),                 // vertexBindingDescriptionCount
+        bindingDescr.data(),                                        // pVertexBindingDescriptions
         static_cast<uint32_t>(inputAttribute.size()),               // vertexAttributeDescriptionCount
         inputAttribute.data()                                       // pVertexAttributeDescriptions
     };
@@ -3,10 +3,11 @@
 #include "Vertex.h"
 #include "VulkanFactory.h"
 #include "Interfaces.h"
+#include "VertexFormat.h"
 
 class Model : public DrawableInterface {
 public:
-    Model(std::vector<std::string> modelFilenames, std::string textureFilename);
+    Model(std::vector<std::string> modelFilenames, std::string textureFilename, VertexEncoding encoding = VertexEncoding::Packed);
     void Cleanup() override;
     void UpdateWindowSize() override;
 
@@ -56,29 +57,34 @@ private:
     std::vector<VkCommandBuffer> m_CommandBuffers;
 
     VkBuffer m_VertexBuffer;
-    VkBuffer m_IndexBuffer;
-    VkDeviceMemory m_VertexBufferMemory;
-    VkDeviceMemory m_IndexBufferMemory;
+    MemoryAllocation m_VertexBufferMemory;
+
+    // indices of the meshlets that survive culling, written every frame; one stream per swapchain image so
+    // recording a frame never touches the one still in flight
+    struct IndexStream {
+        VkBuffer buffer;
+        MemoryAllocation memory;
+        VkDeviceSize size;
+    };
+    std::vector<IndexStream> m_IndexStreams;
 
     VkDescriptorSetLayout m_DescriptorSetLayout;
     VkDescriptorPool m_DescriptorPool;
     std::vector<VkDescriptorSet> m_DescriptorSets;
     VkImage m_TextureImage;
-    VkDeviceMemory m_TextureImageMemory;
+    MemoryAllocation m_TextureImageMemory;
     VkImageView m_TextureImageView;
     VkSampler m_TextureSampler;
 
-    std::vector<Vertex> m_Vertices;
-    std::vector<uint32_t> m_Indices;
+    EncodedMesh m_Mesh;
 
     VkPipelineLayout m_GraphicsPipelineLayout;
     VkPipeline m_GraphicsPipeline;
 
     void CreateTextureImage(std::string);
     void CreateTextureImageView();
-    void LoadModel(std::string);
     void CreateVertexBuffer();
-    void CreateIndexBuffer();
+    void ReserveIndexStream(uint32_t index, VkDeviceSize size);
     void CreateDescriptorSetLayout();
     void CreateDescriptorPool();
     void CreateGraphicsPipeline();
@@ -0,0 +1,407 @@
+#include "ObjParser.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+#include "VertexWelder.h"
+#include <cstring>
+#include <cmath>
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include <tiny_obj_loader.h>
+
+namespace {
+
+// files below this size are parsed as one chunk, threads would cost more than they save
+constexpr size_t MinChunkSize = 256 * 1024;
+
+// relative (negative) face indices depend on how many elements earlier chunks defined,
+// they are resolved once all chunks are parsed
+struct IndexFixup {
+    uint32_t corner;
+    uint32_t attribute;                                     // 0 position, 1 texCoord, 2 normal
+    int32_t localIndex;
+};
+
+struct ObjChunk {
+    const char *begin;
+    const char *end;
+    ObjMesh mesh;
+    std::vector<IndexFixup> fixups;
+};
+
+const double Pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+inline bool IsSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline bool IsDigit(char c) {
+    return static_cast<unsigned>(c - '0') < 10;
+}
+
+inline const char *SkipSpaces(const char *p, const char *end) {
+    while (p < end && IsSpace(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+// locale independent decimal parser; up to 19 significant digits are accumulated exactly and scaled by one
+// power of ten, which matches strtod for everything exporters write
+const char *ParseFloat(const char *p, const char *end, float &out) {
+    p = SkipSpaces(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+
+    uint64_t mantissa = 0;
+    int32_t exponent = 0;
+    uint32_t digits = 0;
+    bool any = false;
+    for (; p < end && IsDigit(*p); ++p, any = true) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += mantissa != 0;
+        } else {
+            ++exponent;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (++p; p < end && IsDigit(*p); ++p, any = true) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa != 0;
+                --exponent;
+            }
+        }
+    }
+    if (!any) {
+        throw std::runtime_error("invalid number in OBJ file");
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        bool negativeExponent = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negativeExponent = *p == '-';
+            ++p;
+        }
+        int32_t e = 0;
+        for (; p < end && IsDigit(*p); ++p) {
+            if (e < 10000) {
+                e = e * 10 + (*p - '0');
+            }
+        }
+        exponent += negativeExponent ? -e : e;
+    }
+
+    double value = static_cast<double>(mantissa);
+    if (exponent < 0 && exponent >= -22) {
+        value /= Pow10[-exponent];
+    } else if (exponent > 0 && exponent <= 22) {
+        value *= Pow10[exponent];
+    } else if (exponent != 0) {
+        value *= std::pow(10.0, exponent);
+    }
+    out = static_cast<float>(negative ? -value : value);
+    return p;
+}
+
+const char *ParseInt(const char *p, const char *end, int32_t &out) {
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+    if (p == end || !IsDigit(*p)) {
+        throw std::runtime_error("invalid face index in OBJ file");
+    }
+    int32_t value = 0;
+    for (; p < end && IsDigit(*p); ++p) {
+        value = value * 10 + (*p - '0');
+    }
+    out = negative ? -value : value;
+    return p;
+}
+
+// converts a one based or relative OBJ index, relative ones are queued for the merge
+inline int32_t ResolveIndex(int32_t index, size_t localCount, uint32_t corner, uint32_t attribute, std::vector<IndexFixup> &fixups) {
+    if (index > 0) {
+        return index - 1;
+    }
+    if (index == 0) {
+        throw std::runtime_error("OBJ face index 0 is invalid");
+    }
+    fixups.push_back({ corner, attribute, static_cast<int32_t>(localCount) + index });
+    return 0;
+}
+
+const char *ParseCorner(const char *p, const char *end, const ObjMesh &mesh, ObjCorner &corner, uint32_t polygonCorner,
+    std::vector<IndexFixup> &fixups) {
+    int32_t index;
+    p = ParseInt(p, end, index);
+    corner = { ResolveIndex(index, mesh.positions.size(), polygonCorner, 0, fixups), -1, -1 };
+    if (p < end && *p == '/') {
+        ++p;
+        if (p < end && *p != '/') {
+            p = ParseInt(p, end, index);
+            corner.texCoord = ResolveIndex(index, mesh.texCoords.size(), polygonCorner, 1, fixups);
+        }
+        if (p < end && *p == '/') {
+            p = ParseInt(p + 1, end, index);
+            corner.normal = ResolveIndex(index, mesh.normals.size(), polygonCorner, 2, fixups);
+        }
+    }
+    return p;
+}
+
+// polygon and polygonFixups are scratch storage reused across faces of a chunk
+void ParseFace(const char *p, const char *end, ObjChunk &chunk, std::vector<ObjCorner> &polygon, std::vector<IndexFixup> &polygonFixups) {
+    polygon.clear();
+    polygonFixups.clear();
+    for (p = SkipSpaces(p, end); p < end; p = SkipSpaces(p, end)) {
+        ObjCorner corner;
+        p = ParseCorner(p, end, chunk.mesh, corner, static_cast<uint32_t>(polygon.size()), polygonFixups);
+        polygon.push_back(corner);
+    }
+    if (polygon.size() < 3) {
+        throw std::runtime_error("OBJ face with less than three corners");
+    }
+
+    std::vector<ObjCorner> &corners = chunk.mesh.corners;
+    for (uint32_t i = 2; i < polygon.size(); ++i) {
+        uint32_t base = static_cast<uint32_t>(corners.size());
+        corners.push_back(polygon[0]);
+        corners.push_back(polygon[i - 1]);
+        corners.push_back(polygon[i]);
+
+        // relative indices are rare, fan corners repeat them in every triangle they appear in
+        for (const IndexFixup &fixup : polygonFixups) {
+            if (fixup.corner == 0) {
+                chunk.fixups.push_back({ base, fixup.attribute, fixup.localIndex });
+            } else if (fixup.corner == i - 1) {
+                chunk.fixups.push_back({ base + 1, fixup.attribute, fixup.localIndex });
+            } else if (fixup.corner == i) {
+                chunk.fixups.push_back({ base + 2, fixup.attribute, fixup.localIndex });
+            }
+        }
+    }
+}
+
+void ParseChunk(ObjChunk &chunk) {
+    std::vector<ObjCorner> polygon;
+    std::vector<IndexFixup> polygonFixups;
+    ObjMesh &mesh = chunk.mesh;
+
+    // estimates from the chunk size keep most reallocation out of the hot loop
+    size_t bytes = chunk.end - chunk.begin;
+    mesh.positions.reserve(bytes / 64);
+    mesh.corners.reserve(bytes / 16);
+
+    for (const char *line = chunk.begin; line < chunk.end; ) {
+        const char *lineEnd = static_cast<const char*>(memchr(line, '\n', chunk.end - line));
+        if (!lineEnd) {
+            lineEnd = chunk.end;
+        }
+        const char *p = SkipSpaces(line, lineEnd);
+
+        if (lineEnd - p >= 2 && p[0] == 'v' && IsSpace(p[1])) {
+            glm::vec3 v;
+            p = ParseFloat(p + 2, lineEnd, v.x);
+            p = ParseFloat(p, lineEnd, v.y);
+            ParseFloat(p, lineEnd, v.z);
+            mesh.positions.push_back(v);
+        } else if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 'n' && IsSpace(p[2])) {
+            glm::vec3 n;
+            p = ParseFloat(p + 3, lineEnd, n.x);
+            p = ParseFloat(p, lineEnd, n.y);
+            ParseFloat(p, lineEnd, n.z);
+            mesh.normals.push_back(n);
+        } else if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 't' && IsSpace(p[2])) {
+            glm::vec2 t;
+            p = ParseFloat(p + 3, lineEnd, t.x);
+            ParseFloat(p, lineEnd, t.y);
+            mesh.texCoords.push_back(t);
+        } else if (lineEnd - p >= 2 && p[0] == 'f' && IsSpace(p[1])) {
+            ParseFace(p + 2, lineEnd, chunk, polygon, polygonFixups);
+        }
+        line = lineEnd + 1;
+    }
+}
+
+}
+
+ObjMesh ObjParser::Parse(const std::string &path, uint32_t threadCount) {
+    MappedFile file;
+    if (!file.Open(path)) {
+        throw std::runtime_error("cannot open " + path);
+    }
+    const char *data = reinterpret_cast<const char*>(file.GetData());
+    const char *dataEnd = data + file.GetSize();
+
+    ThreadPool *threadPool = ThreadPool::GetInstance();
+    if (threadCount == 0) {
+        threadCount = threadPool->GetThreadCount();
+    }
+    size_t chunkCount = std::max<size_t>(1, std::min<size_t>(threadCount, file.GetSize() / MinChunkSize));
+
+    // chunk borders are moved forward to the next line start so no line is split
+    std::vector<ObjChunk> chunks(chunkCount);
+    const char *begin = data;
+    for (size_t i = 0; i < chunkCount; ++i) {
+        const char *end = i + 1 == chunkCount ? dataEnd : data + file.GetSize() * (i + 1) / chunkCount;
+        if (end < begin) {
+            end = begin;
+        }
+        const char *newline = static_cast<const char*>(memchr(end, '\n', dataEnd - end));
+        end = newline ? newline + 1 : dataEnd;
+        chunks[i].begin = begin;
+        chunks[i].end = end;
+        begin = end;
+    }
+
+    threadPool->ParallelFor(static_cast<uint32_t>(chunkCount), [&](uint32_t i) {
+        ParseChunk(chunks[i]);
+    });
+
+    // prefix sums give every chunk its place in the merged streams
+    struct Offsets {
+        size_t positions, normals, texCoords, corners;
+    };
+    std::vector<Offsets> offsets(chunkCount + 1, Offsets{ 0, 0, 0, 0 });
+    for (size_t i = 0; i < chunkCount; ++i) {
+        const ObjMesh &m = chunks[i].mesh;
+        offsets[i + 1] = {
+            offsets[i].positions + m.positions.size(),
+            offsets[i].normals + m.normals.size(),
+            offsets[i].texCoords + m.texCoords.size(),
+            offsets[i].corners + m.corners.size()
+        };
+    }
+
+    ObjMesh mesh;
+    if (chunkCount == 1) {
+        mesh = std::move(chunks[0].mesh);
+    } else {
+        mesh.positions.resize(offsets[chunkCount].positions);
+        mesh.normals.resize(offsets[chunkCount].normals);
+        mesh.texCoords.resize(offsets[chunkCount].texCoords);
+        mesh.corners.resize(offsets[chunkCount].corners);
+
+        threadPool->ParallelFor(static_cast<uint32_t>(chunkCount), [&](uint32_t i) {
+            const ObjMesh &m = chunks[i].mesh;
+            std::copy(m.positions.begin(), m.positions.end(), mesh.positions.begin() + offsets[i].positions);
+            std::copy(m.normals.begin(), m.normals.end(), mesh.normals.begin() + offsets[i].normals);
+            std::copy(m.texCoords.begin(), m.texCoords.end(), mesh.texCoords.begin() + offsets[i].texCoords);
+            std::copy(m.corners.begin(), m.corners.end(), mesh.corners.begin() + offsets[i].corners);
+        });
+    }
+
+    for (size_t i = 0; i < chunkCount; ++i) {
+        for (const IndexFixup &fixup : chunks[i].fixups) {
+            ObjCorner &corner = mesh.corners[offsets[i].corners + fixup.corner];
+            if (fixup.attribute == 0) {
+                corner.position = static_cast<int32_t>(offsets[i].positions) + fixup.localIndex;
+            } else if (fixup.attribute == 1) {
+                corner.texCoord = static_cast<int32_t>(offsets[i].texCoords) + fixup.localIndex;
+            } else {
+                corner.normal = static_cast<int32_t>(offsets[i].normals) + fixup.localIndex;
+            }
+        }
+    }
+
+    for (const ObjCorner &corner : mesh.corners) {
+        if (corner.position < 0 || corner.position >= (int32_t)mesh.positions.size() ||
+            corner.texCoord >= (int32_t)mesh.texCoords.size() || corner.normal >= (int32_t)mesh.normals.size() ||
+            corner.texCoord < -1 || corner.normal < -1) {
+            throw std::runtime_error("face index out of range in " + path);
+        }
+    }
+    return mesh;
+}
+
+void ObjParser::Load(const std::string &path, std::vector<Vertex> &vertices, std::vector<uint32_t> &indices) {
+    ObjMesh mesh = ObjParser::Parse(path);
+
+    auto makeVertex = [&mesh](size_t cornerIndex) {
+        const ObjCorner &corner = mesh.corners[cornerIndex];
+        Vertex vertex{};
+        vertex.pos = mesh.positions[corner.position];
+        if (corner.texCoord == -1) {
+            vertex.texCoord = { 0.0f, 0.0f };
+        } else {
+            vertex.texCoord = { mesh.texCoords[corner.texCoord].x, 1.0f - mesh.texCoords[corner.texCoord].y };
+        }
+        if (corner.normal != -1) {
+            vertex.normal = mesh.normals[corner.normal];
+        } else {
+            // flat shading for faces without normals, degenerate triangles keep a zero normal
+            const ObjCorner *triangle = &mesh.corners[cornerIndex - cornerIndex % 3];
+            glm::vec3 p0 = mesh.positions[triangle[0].position];
+            glm::vec3 faceNormal = glm::cross(mesh.positions[triangle[1].position] - p0, mesh.positions[triangle[2].position] - p0);
+            float length = glm::length(faceNormal);
+            if (length > 0.0f) {
+                vertex.normal = faceNormal / length;
+            }
+        }
+        return vertex;
+    };
+
+    if (mesh.corners.size() >= VertexWelder::SortThreshold) {
+        std::vector<Vertex> corners;
+        corners.reserve(mesh.corners.size());
+        for (size_t i = 0; i < mesh.corners.size(); ++i) {
+            corners.push_back(makeVertex(i));
+        }
+        VertexWelder::WeldSorted(corners, vertices, indices);
+        return;
+    }
+
+    VertexWelder welder(vertices, mesh.corners.size());
+    indices.reserve(indices.size() + mesh.corners.size());
+    for (size_t i = 0; i < mesh.corners.size(); ++i) {
+        indices.push_back(welder.Weld(makeVertex(i)));
+    }
+}
+
+void ObjParser::Benchmark(const std::vector<std::string> &paths) {
+    using Clock = std::chrono::high_resolution_clock;
+    const double MiB = 1024.0 * 1024.0;
+
+    for (const auto &path : paths) {
+        MappedFile file;
+        if (!file.Open(path)) {
+            std::cout << path << ": cannot open" << std::endl;
+            continue;
+        }
+        double size = file.GetSize() / MiB;
+        file.Close();
+
+        auto start = Clock::now();
+        tinyobj::attrib_t attrib;
+        std::vector<tinyobj::shape_t> shapes;
+        std::vector<tinyobj::material_t> materials;
+        std::string warning, error;
+        if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warning, &error, path.c_str())) {
+            throw std::runtime_error(warning + error);
+        }
+        double tinyobjTime = std::chrono::duration<double>(Clock::now() - start).count();
+
+        start = Clock::now();
+        ObjMesh single = Parse(path, 1);
+        double singleTime = std::chrono::duration<double>(Clock::now() - start).count();
+
+        start = Clock::now();
+        ObjMesh mesh = Parse(path);
+        double parallelTime = std::chrono::duration<double>(Clock::now() - start).count();
+
+        std::cout << path << " (" << size << " MiB, " << mesh.corners.size() / 3 << " triangles): tinyobj "
+            << tinyobjTime * 1000.0 << " ms (" << size / tinyobjTime << " MiB/s), ObjParser 1 thread "
+            << singleTime * 1000.0 << " ms (" << size / singleTime << " MiB/s), ObjParser "
+            << ThreadPool::GetInstance()->GetThreadCount() << " threads " << parallelTime * 1000.0 << " ms ("
+            << size / parallelTime << " MiB/s)" << std::endl;
+    }
+}
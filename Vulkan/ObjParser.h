@@ -0,0 +1,34 @@
+#pragma once
+
+#include "CommonHeaders.h"
+#include "Vertex.h"
+
+// zero based attribute indices of one triangle corner, -1 when the face does not reference the attribute
+struct ObjCorner {
+    int32_t position;
+    int32_t texCoord;
+    int32_t normal;
+};
+
+struct ObjMesh {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::vec2> texCoords;
+    std::vector<ObjCorner> corners;                         // three per triangle, polygons are fan triangulated
+};
+
+// OBJ reader for the v/vn/vt/f subset the models use. The file is memory mapped and split on line
+// boundaries into chunks that are parsed on the thread pool, then the per-chunk streams are merged.
+// Everything else (groups, materials, smoothing, lines) is skipped.
+class ObjParser {
+public:
+    // threadCount 0 uses every thread of the pool, small files always use a single chunk
+    static ObjMesh Parse(const std::string &path, uint32_t threadCount = 0);
+
+    // parses the file and appends its deduplicated vertices, indices refer to the whole vertices array;
+    // corners without a normal get the normal of their triangle
+    static void Load(const std::string &path, std::vector<Vertex> &vertices, std::vector<uint32_t> &indices);
+
+    // prints parse throughput of tinyobj and of this parser for each file
+    static void Benchmark(const std::vector<std::string> &paths);
+};
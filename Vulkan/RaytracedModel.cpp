@@ -1,19 +1,16 @@
 #include "RaytracedModel.h"
+#include "MeshCache.h"
+#include "BlasCache.h"
+#include "ThreadPool.h"
+#include <algorithm>
 
 #include <stb_image.h>
-#include <tiny_obj_loader.h>
 
 
-RaytracedModel::RaytracedModel(std::vector<std::string> modelFilenames) :
-    m_VertexBuffer(VK_NULL_HANDLE), m_IndexBuffer(VK_NULL_HANDLE),
-    m_VertexBufferMemory(VK_NULL_HANDLE), m_IndexBufferMemory(VK_NULL_HANDLE),
+RaytracedModel::RaytracedModel(std::vector<std::string> modelFilenames, VertexEncoding encoding) :
     m_VkFactory(VulkanFactory::GetInstance()) {
-    for (const auto &modelFilename : modelFilenames) {
-        LoadModel(modelFilename);
-    }
+    AddMesh(modelFilenames, encoding);
     CreateDescriptorSetLayout();
-    CreateVertexBuffer();
-    CreateIndexBuffer();
     CreateDescriptorPool();
     //CreateTextureImage({ "textures/posx.jpg", "textures/negx.jpg", "textures/posy.jpg" , "textures/negy.jpg" , "textures/posz.jpg" , "textures/negz.jpg" });
     //CreateTextureImage({ "textures/posx2.jpg", "textures/negx2.jpg", "textures/posy2.jpg" , "textures/negy2.jpg" , "textures/posz2.jpg" , "textures/negz2.jpg" });
@@ -31,11 +28,15 @@ RaytracedModel::RaytracedModel(std::vector<std::string> modelFilenames) :
     }
     m_VkFactory->CreateMultipleTextureDescriptorSets(m_LTCDescriptorSets, imageInfos, m_LTCDescriptorSetLayout, m_LTCDescriptorPool);
     m_VkFactory->CreateTextureDescriptorSets(m_SkyboxDescriptorSets, m_TextureImageView, m_TextureSampler, m_SkyboxDescriptorSetLayout, m_SkyboxDescriptorPool);
+    CreateBlueNoiseImage();
+    m_VkFactory->CreateTextureDescriptorSets(m_BlueNoiseDescriptorSets, m_BlueNoiseImageView, m_BlueNoiseSampler, m_BlueNoiseDescriptorSetLayout, m_BlueNoiseDescriptorPool);
     CreateUniformBuffer();
     m_OffscreenRenderTargets.resize(m_VkFactory->GetSwapchainImages().size());
     for (uint32_t i = 0; i < m_VkFactory->GetSwapchainImages().size(); ++i) {
         m_OffscreenRenderTargets[i] = m_VkFactory->CreateOffscreenRenderer();
     }
+    m_AccumulatedFrames.assign(m_OffscreenRenderTargets.size(), 0);
+    m_CheckerboardParity.assign(m_OffscreenRenderTargets.size(), NoParity);
     CreatePostPipeline();
 
     std::vector<VkDescriptorSetLayout> layouts(m_VkFactory->GetSwapchainImages().size(), m_DescriptorSetLayout);
@@ -53,116 +54,74 @@ RaytracedModel::RaytracedModel(std::vector<std::string> modelFilenames) :
     }
     m_Width = m_VkFactory->GetExtent().width;
     m_Height = m_VkFactory->GetExtent().height;
+}
+
+uint32_t RaytracedModel::AddMesh(std::vector<std::string> modelFilenames, VertexEncoding encoding) {
+    m_Meshes.push_back({ EncodeMesh(MeshLoader::Load(modelFilenames), encoding), VK_NULL_HANDLE, MemoryAllocation(), VK_NULL_HANDLE, MemoryAllocation(), {},
+        modelFilenames.empty() ? std::string() : BlasCache::GetCachePath(modelFilenames[0]) });
+    CreateMeshBuffers(m_Meshes.back());
+    return static_cast<uint32_t>(m_Meshes.size() - 1);
+}
 
-    m_BufferAddresses.push_back({ m_VkFactory->GetBufferAddress(m_VertexBuffer), m_VkFactory->GetBufferAddress(m_IndexBuffer) });
+void RaytracedModel::CreateAddressTable() {
+    // indexed by the instance custom index, which is the mesh index
+    m_BufferAddresses.clear();
+    for (const SceneMesh &sceneMesh : m_Meshes) {
+        VkDeviceAddress vertexAddress = m_VkFactory->GetBufferAddress(sceneMesh.vertexBuffer);
+        m_BufferAddresses.push_back({
+            vertexAddress,                                                  // vertexAddress
+            vertexAddress + sceneMesh.mesh.attributeOffset,                 // attributeAddress
+            m_VkFactory->GetBufferAddress(sceneMesh.indexBuffer),           // indiceAddress
+            sceneMesh.mesh.quantization.center,                             // dequantizeOffset
+            sceneMesh.mesh.layout.IsPacked(),                               // packedVertices
+            sceneMesh.mesh.quantization.halfExtent,                         // dequantizeScale
+            sceneMesh.mesh.indexType == VK_INDEX_TYPE_UINT16                // shortIndices
+        });
+    }
 
-    m_VkFactory->CreateBuffer(m_BufferAddresses.size() * sizeof(BufferAddresses), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+    VkDeviceSize bufferSize = m_BufferAddresses.size() * sizeof(BufferAddresses);
+    m_VkFactory->CreateBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_AddressesStorageBuffer, m_AddressesStorageBufferMemory);
+    m_VkFactory->UploadToBuffer(m_AddressesStorageBuffer, 0, m_BufferAddresses.data(), bufferSize);
+}
 
-    VkCommandBuffer cmdBuff = m_VkFactory->BeginSingleTimeCommands();
-    vkCmdUpdateBuffer(cmdBuff, m_AddressesStorageBuffer, 0, m_BufferAddresses.size() * sizeof(BufferAddresses), m_BufferAddresses.data());
-    m_VkFactory->EndSingleTimeCommands(cmdBuff);
+void RaytracedModel::ResetAccumulation() {
+    std::fill(m_AccumulatedFrames.begin(), m_AccumulatedFrames.end(), 0u);
 }
 
 void RaytracedModel::UpdateWindowSize() {
     m_Width = m_VkFactory->GetExtent().width;
     m_Height = m_VkFactory->GetExtent().height;
-    // m_VkFactory->UpdateRtDescriptorSets(m_RtDescriptorSets);
-}
-
-void RaytracedModel::LoadModel(std::string modelPath) {
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-
-    std::string warning, error;
-
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warning, &error, modelPath.c_str())) {
-        throw std::runtime_error(warning + error);
-    }
-
-    std::unordered_map<Vertex, uint32_t> uniqueVertices;
-
-    for (auto &shape : shapes) {
-        for (const auto &index : shape.mesh.indices) {
-            Vertex vertex{};
-
-            vertex.pos = {
-                attrib.vertices[3 * index.vertex_index + 0],
-                attrib.vertices[3 * index.vertex_index + 1],
-                attrib.vertices[3 * index.vertex_index + 2]
-            };
-
-            if (index.texcoord_index == -1) {
-                vertex.texCoord = { 0.0, 0.0 };
-            } else {
-                vertex.texCoord = {
-                    attrib.texcoords[2 * index.texcoord_index + 0],
-                    1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-                };
-            }
-            vertex.normal = {
-                attrib.normals[3 * index.normal_index + 0],
-                attrib.normals[3 * index.normal_index + 1],
-                attrib.normals[3 * index.normal_index + 2]
-            };
-
-            if (uniqueVertices.count(vertex) == 0) {
-                uniqueVertices[vertex] = static_cast<uint32_t>(m_Vertices.size());
-                m_Vertices.push_back(vertex);
-            }
-
-            m_Indices.push_back(uniqueVertices[vertex]);
-        }
+    // RecreateSwapChain left the device idle
+    for (OffscreenRender &target : m_OffscreenRenderTargets) {
+        m_VkFactory->ResizeOffscreenRenderer(target);
     }
+    m_VkFactory->UpdateRtDescriptorSets(m_RtDescriptorSets, m_OffscreenRenderTargets);
+    ResetAccumulation();
+    m_Denoiser.Resize();
+    m_Checkerboard.Resize();
 }
 
-
-void RaytracedModel::CreateVertexBuffer() {
-    VkDeviceSize bufferSize = sizeof(m_Vertices[0]) * m_Vertices.size();
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-
-    m_VkFactory->CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-    void *data;
-    vkMapMemory(m_VkFactory->GetDevice(), stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, m_Vertices.data(), bufferSize);
-    vkUnmapMemory(m_VkFactory->GetDevice(), stagingBufferMemory);
-
+void RaytracedModel::CreateMeshBuffers(SceneMesh& sceneMesh) {
+    const EncodedMesh &mesh = sceneMesh.mesh;
+    VkDeviceSize bufferSize = mesh.vertexData.size();
     m_VkFactory->CreateBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_VertexBuffer, m_VertexBufferMemory);
-
-    m_VkFactory->CopyBuffer(stagingBuffer, m_VertexBuffer, bufferSize);
-
-    vkDestroyBuffer(m_VkFactory->GetDevice(), stagingBuffer, nullptr);
-    vkFreeMemory(m_VkFactory->GetDevice(), stagingBufferMemory, nullptr);
-}
-
-void RaytracedModel::CreateIndexBuffer() {
-    VkDeviceSize bufferSize = sizeof(m_Indices[0]) * m_Indices.size();
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-
-    m_VkFactory->CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-    void *data;
-    vkMapMemory(m_VkFactory->GetDevice(), stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, m_Indices.data(), bufferSize);
-    vkUnmapMemory(m_VkFactory->GetDevice(), stagingBufferMemory);
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, sceneMesh.vertexBuffer, sceneMesh.vertexBufferMemory);
+    m_VkFactory->UploadToBuffer(sceneMesh.vertexBuffer, 0, mesh.vertexData.data(), bufferSize);
 
+    bufferSize = mesh.indexData.size();
     m_VkFactory->CreateBuffer(bufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_IndexBuffer, m_IndexBufferMemory);
-
-    m_VkFactory->CopyBuffer(stagingBuffer, m_IndexBuffer, bufferSize);
-
-    vkDestroyBuffer(m_VkFactory->GetDevice(), stagingBuffer, nullptr);
-    vkFreeMemory(m_VkFactory->GetDevice(), stagingBufferMemory, nullptr);
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, sceneMesh.indexBuffer, sceneMesh.indexBufferMemory);
+    m_VkFactory->UploadToBuffer(sceneMesh.indexBuffer, 0, mesh.indexData.data(), bufferSize);
 }
 
 void RaytracedModel::Cleanup() {
     vkDestroyPipelineLayout(m_VkFactory->GetDevice(), m_RtPipelineLayout, nullptr);
     vkDestroyPipeline(m_VkFactory->GetDevice(), m_RtPipeline, nullptr);
+    vkDestroyPipelineLayout(m_VkFactory->GetDevice(), m_AdaptivePipelineLayout, nullptr);
+    vkDestroyPipeline(m_VkFactory->GetDevice(), m_AdaptivePipeline, nullptr);
+    m_Denoiser.Cleanup();
+    m_Checkerboard.Cleanup();
     vkDestroyDescriptorPool(m_VkFactory->GetDevice(), m_DescriptorPool, nullptr);
     vkDestroyDescriptorSetLayout(m_VkFactory->GetDevice(), m_DescriptorSetLayout, nullptr);
     vkDestroyDescriptorPool(m_VkFactory->GetDevice(), m_RtDescriptorPool, nullptr);
@@ -171,26 +130,75 @@ void RaytracedModel::Cleanup() {
     vkDestroyDescriptorSetLayout(m_VkFactory->GetDevice(), m_SkyboxDescriptorSetLayout, nullptr);
     vkDestroyDescriptorPool(m_VkFactory->GetDevice(), m_LTCDescriptorPool, nullptr);
     vkDestroyDescriptorSetLayout(m_VkFactory->GetDevice(), m_LTCDescriptorSetLayout, nullptr);
-    vkDestroyBuffer(m_VkFactory->GetDevice(), m_VertexBuffer, nullptr);
-    vkDestroyBuffer(m_VkFactory->GetDevice(), m_IndexBuffer, nullptr);
-    vkFreeMemory(m_VkFactory->GetDevice(), m_VertexBufferMemory, nullptr);
-    vkFreeMemory(m_VkFactory->GetDevice(), m_IndexBufferMemory, nullptr);
+    vkDestroyDescriptorPool(m_VkFactory->GetDevice(), m_BlueNoiseDescriptorPool, nullptr);
+    vkDestroyDescriptorSetLayout(m_VkFactory->GetDevice(), m_BlueNoiseDescriptorSetLayout, nullptr);
+    vkDestroySampler(m_VkFactory->GetDevice(), m_BlueNoiseSampler, nullptr);
+    vkDestroyImageView(m_VkFactory->GetDevice(), m_BlueNoiseImageView, nullptr);
+    vkDestroyImage(m_VkFactory->GetDevice(), m_BlueNoiseImage, nullptr);
+    m_VkFactory->FreeMemory(m_BlueNoiseImageMemory);
+    for (SceneMesh &sceneMesh : m_Meshes) {
+        vkDestroyBuffer(m_VkFactory->GetDevice(), sceneMesh.vertexBuffer, nullptr);
+        vkDestroyBuffer(m_VkFactory->GetDevice(), sceneMesh.indexBuffer, nullptr);
+        m_VkFactory->FreeMemory(sceneMesh.vertexBufferMemory);
+        m_VkFactory->FreeMemory(sceneMesh.indexBufferMemory);
+        m_VkFactory->DestroyAccelerationStructure(sceneMesh.blas);
+    }
+    vkDestroyBuffer(m_VkFactory->GetDevice(), m_AddressesStorageBuffer, nullptr);
+    m_VkFactory->FreeMemory(m_AddressesStorageBufferMemory);
+    m_VkFactory->DestroyTLAS(m_Tlas);
 }
 
 void RaytracedModel::PrepareForRayTracing() {
-    m_Blas = m_VkFactory->CreateBLAS(m_VertexBuffer, m_IndexBuffer, (uint32_t)(m_Vertices.size()), (uint32_t)(m_Indices.size() / 3));
-    VkTransformMatrixKHR matrix;
-    glm::mat4 transformMatrix = m_Instances[0].GetModelMatrix(0.0f);
-    memcpy(&matrix, &transformMatrix, sizeof(VkTransformMatrixKHR));
-    m_tlasInstance = {
-        matrix,                                                     // transform
-        0,                                                          // instanceCustomIndex
-        0xFF,                                                       // mask
-        0,                                                          // instanceShaderBindingTableRecordOffset
-        VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR,  // flags
-        m_VkFactory->GetAccelerationStructureAddress(m_Blas.as)     // accelerationStructureReference
-    };
-    m_VkFactory->CreateTLAS(m_Tlas, m_tlasInstance, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR, (uint32_t)(m_Vertices.size()), false);
+    std::vector<BlasInput> blasInputs;
+    for (const SceneMesh &sceneMesh : m_Meshes) {
+        const EncodedMesh &mesh = sceneMesh.mesh;
+        blasInputs.push_back({
+            sceneMesh.vertexBuffer,                                     // vertexBuffer
+            mesh.layout.GetPositionFormat(),                            // vertexFormat
+            mesh.layout.GetPositionStride(),                            // vertexStride
+            mesh.vertexCount,                                           // vertexNo
+            sceneMesh.indexBuffer,                                      // indexBuffer
+            mesh.indexType,                                             // indexType
+            mesh.lods[0].indexCount / 3,                                // primitiveNo
+            mesh.quantization.GetDequantizeMatrix(),                    // transform
+            sceneMesh.blasCachePath,                                    // cachePath
+            0,                                                          // cacheKey
+            mesh.vertexData.data(),                                     // hostVertexData
+            mesh.indexData.data()                                       // hostIndexData
+        });
+
+        // the position stream and the indices are all the build reads, the rest of the input says how
+        BlasInput &input = blasInputs.back();
+        uint64_t key = MeshCache::HashBytes(mesh.vertexData.data(), static_cast<size_t>(mesh.attributeOffset));
+        key = MeshCache::HashBytes(mesh.indexData.data(), mesh.indexData.size(), key);
+        const uint64_t parameters[] = { input.vertexFormat, input.vertexStride, input.vertexNo, input.indexType, input.primitiveNo };
+        key = MeshCache::HashBytes(parameters, sizeof(parameters), key);
+        input.cacheKey = MeshCache::HashBytes(&input.transform, sizeof(input.transform), key);
+    }
+    std::vector<AccelerationStructure> blases = m_VkFactory->CreateBLASes(blasInputs);
+    for (size_t i = 0; i < m_Meshes.size(); ++i) {
+        m_Meshes[i].blas = blases[i];
+    }
+    CreateAddressTable();
+
+    m_TlasInstances.clear();
+    for (const Instance &instance : m_Instances) {
+        // the hit region has HitGroupCount records, a larger offset would read past it
+        if (instance.GetHitGroup() >= VulkanFactory::HitGroupCount) {
+            throw std::runtime_error("instance hit group out of range");
+        }
+        m_TlasInstances.push_back({
+            {},                                                         // transform, written every frame
+            instance.GetMesh(),                                         // instanceCustomIndex
+            0xFF,                                                       // mask
+            instance.GetHitGroup(),                                     // instanceShaderBindingTableRecordOffset
+            VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR,  // flags
+            m_VkFactory->GetAccelerationStructureAddress(m_Meshes[instance.GetMesh()].blas.as) // accelerationStructureReference
+        });
+    }
+    // built by the first frame, the descriptor sets only need the handle
+    m_VkFactory->CreateTLAS(m_Tlas, static_cast<uint32_t>(m_TlasInstances.size()),
+        VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR);
 
     std::vector<VkDescriptorPoolSize> descrPoolSize = {
         {
@@ -201,28 +209,52 @@ void RaytracedModel::PrepareForRayTracing() {
         {
             VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,                       // type
             static_cast<uint32_t>(
-                m_VkFactory->GetSwapchainImages().size())           // descriptorCount
+                m_VkFactory->GetSwapchainImages().size() * 6)       // descriptorCount
         }
     };
     m_VkFactory->CreateDescriptorPool(descrPoolSize, m_RtDescriptorPool);
 
-    std::vector<VkImageView> imageViews{};
-    for (OffscreenRender &off : m_OffscreenRenderTargets) {
-        imageViews.push_back(off.targetImageView);
-    }
-
-    m_VkFactory->CreateRtDescriptorSets(m_Tlas, m_RtDescriptorSetLayout, m_RtDescriptorPool, m_RtDescriptorSets, imageViews);
+    m_VkFactory->CreateRtDescriptorSets(m_Tlas.structure, m_RtDescriptorSetLayout, m_RtDescriptorPool, m_RtDescriptorSets, m_OffscreenRenderTargets);
     CreateRtPipeline();
+    CreateAdaptivePipeline();
+    m_Denoiser.Init(m_RtDescriptorSetLayout);
+    m_Checkerboard.Init(m_RtDescriptorSetLayout, static_cast<uint32_t>(m_OffscreenRenderTargets.size()));
     m_VkFactory->CreateShaderBindingTable(m_RtPipeline, m_RgenRegion, m_MissRegion, m_HitRegion, m_CallRegion, m_RtSBTBuffer, m_RtSBTBufferMemory);
 }
 
 void RaytracedModel::Raytrace(VkCommandBuffer cmdBuff, glm::mat4 viewMatrix, float time, uint32_t index) {
-    VkTransformMatrixKHR matrix;
-    glm::mat4 transformMatrix = m_Instances[0].GetModelMatrix(time);
-    memcpy(&matrix, &transformMatrix, sizeof(VkTransformMatrixKHR));
-    m_tlasInstance.transform = matrix;
-    m_VkFactory->CreateTLAS(m_Tlas, m_tlasInstance, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR, (uint32_t)(m_Vertices.size()), true);
+    bool changed = viewMatrix != m_LastViewMatrix || m_RtPC.useLtc != m_LastConstants.useLtc || m_RtPC.ax != m_LastConstants.ax || m_RtPC.ay != m_LastConstants.ay
+        || m_RtPC.sequence != m_LastConstants.sequence || m_RtPC.checkerboard != m_LastConstants.checkerboard;
+    for (size_t i = 0; i < m_Instances.size(); ++i) {
+        // VkTransformMatrixKHR is the upper 3x4 of the model matrix, row major
+        glm::mat4 rows = glm::transpose(m_Instances[i].GetModelMatrix(time));
+        changed |= memcmp(&m_TlasInstances[i].transform, &rows, sizeof(VkTransformMatrixKHR)) != 0;
+        memcpy(&m_TlasInstances[i].transform, &rows, sizeof(VkTransformMatrixKHR));
+    }
+    if (changed) {
+        // the history is left from before checkerboarding was last switched off
+        if (m_RtPC.checkerboard && !m_LastConstants.checkerboard) {
+            m_Checkerboard.Reset();
+            m_CheckerboardParity.assign(m_OffscreenRenderTargets.size(), NoParity);
+        }
+        ResetAccumulation();
+        m_LastViewMatrix = viewMatrix;
+        m_LastConstants = m_RtPC;
+    }
+    m_RtPC.frame = m_FrameIndex++;
+    m_RtPC.accumulated = m_AccumulatedFrames[index];
+    // a converged target already holds the final image
+    m_Traced = m_AccumulatedFrames[index] < MaxAccumulatedFrames;
+    if (m_Traced && m_RtPC.checkerboard) {
+        uint32_t &parity = m_CheckerboardParity[index];
+        parity = parity == NoParity ? m_LastCheckerboardParity ^ 1 : parity ^ 1;
+        m_LastCheckerboardParity = parity;
+        m_RtPC.checkerboardParity = parity;
+    }
 
+    // whatever load time left in the upload batch goes ahead of this frame, a no-op once it is empty
+    m_VkFactory->SubmitUploads();
+    m_VkFactory->BuildTLAS(cmdBuff, m_Tlas, m_TlasInstances.data(), static_cast<uint32_t>(m_TlasInstances.size()), index);
 
     RtUniformBufferObject ubo{};
     glm::mat4 proj = glm::perspective(glm::radians(60.0f), m_Width / (float)m_Height, 0.1f, 200.0f);
@@ -230,6 +262,8 @@ void RaytracedModel::Raytrace(VkCommandBuffer cmdBuff, glm::mat4 viewMatrix, flo
     ubo.viewProj = viewMatrix * proj;
     ubo.viewInverse = glm::inverse(viewMatrix);
     ubo.projInverse = glm::inverse(proj);
+    ubo.prevViewProj = m_PrevViewProj;
+    m_PrevViewProj = proj * viewMatrix;
 
     UpdateUniformBuffer(cmdBuff, ubo);
 
@@ -270,7 +304,8 @@ void RaytracedModel::Raytrace(VkCommandBuffer cmdBuff, glm::mat4 viewMatrix, flo
     };
     vkUpdateDescriptorSets(m_VkFactory->GetDevice(), (uint32_t)(writeDescriptorSet.size()), writeDescriptorSet.data(), 0, nullptr);
 
-    std::vector<VkDescriptorSet> descSets{ m_RtDescriptorSets[index], m_DescriptorSets[index], m_SkyboxDescriptorSets[index], m_LTCDescriptorSets[index] };
+    std::vector<VkDescriptorSet> descSets{ m_RtDescriptorSets[index], m_DescriptorSets[index], m_SkyboxDescriptorSets[index], m_LTCDescriptorSets[index],
+        m_BlueNoiseDescriptorSets[index] };
     vkCmdBindPipeline(cmdBuff, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, m_RtPipeline);
     vkCmdBindDescriptorSets(cmdBuff, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, m_RtPipelineLayout, 0,
         (uint32_t)(descSets.size()), descSets.data(), 0, nullptr);
@@ -278,7 +313,48 @@ void RaytracedModel::Raytrace(VkCommandBuffer cmdBuff, glm::mat4 viewMatrix, flo
         VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR,
         0, sizeof(RtPushConstants), &m_RtPC);
 
-    m_VkFactory->TraceRays(cmdBuff, &m_RgenRegion, &m_MissRegion, &m_HitRegion, &m_CallRegion);
+    if (m_Traced) {
+        RecordAdaptiveSampling(cmdBuff, index);
+        if (m_RtPC.checkerboard) {
+            m_VkFactory->TraceRays(cmdBuff, &m_RgenRegion, &m_MissRegion, &m_HitRegion, &m_CallRegion, (m_Width + 1) / 2, m_Height);
+            m_Checkerboard.Reconstruct(cmdBuff, m_RtDescriptorSets[index], index, m_RtPC.checkerboardParity);
+        }
+        else {
+            m_VkFactory->TraceRays(cmdBuff, &m_RgenRegion, &m_MissRegion, &m_HitRegion, &m_CallRegion, m_Width, m_Height);
+        }
+        ++m_AccumulatedFrames[index];
+    }
+}
+
+void RaytracedModel::Denoise(VkCommandBuffer cmdBuff, uint32_t index) {
+    // an untraced target still holds its denoised image
+    if (m_Traced) {
+        m_Denoiser.Denoise(cmdBuff, m_RtDescriptorSets[index]);
+    }
+}
+
+void RaytracedModel::RecordAdaptiveSampling(VkCommandBuffer cmdBuff, uint32_t index) {
+    // the last trace into this target wrote the statistics read here, and still read the counts written here
+    VkMemoryBarrier barrier{
+        VK_STRUCTURE_TYPE_MEMORY_BARRIER,                           // sType
+        nullptr,                                                    // pNext
+        VK_ACCESS_SHADER_WRITE_BIT,                                 // srcAccessMask
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT      // dstAccessMask
+    };
+    vkCmdPipelineBarrier(cmdBuff, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    AdaptiveSamplingConstants constants{
+        m_RtPC.accumulated,                                         // accumulated
+        SamplesPerFrame,                                            // baseSamples
+        MaxSamplesPerFrame,                                         // maxSamples
+        ConvergenceThreshold                                        // threshold
+    };
+    vkCmdBindPipeline(cmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, m_AdaptivePipeline);
+    vkCmdBindDescriptorSets(cmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, m_AdaptivePipelineLayout, 0, 1, &m_RtDescriptorSets[index], 0, nullptr);
+    vkCmdPushConstants(cmdBuff, m_AdaptivePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(AdaptiveSamplingConstants), &constants);
+    vkCmdDispatch(cmdBuff, (m_Width + 7) / 8, (m_Height + 7) / 8, 1);
+
+    vkCmdPipelineBarrier(cmdBuff, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
 }
 
 void RaytracedModel::Postprocess(VkCommandBuffer cmdBuff, uint32_t idx) {
@@ -321,7 +397,48 @@ void RaytracedModel::CreateDescriptorSetLayout() {
             1,                                                      // binding
             VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,                       // descriptorType
             1,                                                      // descriptorCount
-            VK_SHADER_STAGE_RAYGEN_BIT_KHR,                         // stageFlags
+            VK_SHADER_STAGE_RAYGEN_BIT_KHR |
+            VK_SHADER_STAGE_COMPUTE_BIT,                            // stageFlags
+            nullptr                                                 // pImmutableSamplers
+        },
+        {
+            2,                                                      // binding
+            VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,                       // descriptorType
+            1,                                                      // descriptorCount
+            VK_SHADER_STAGE_RAYGEN_BIT_KHR |
+            VK_SHADER_STAGE_COMPUTE_BIT,                            // stageFlags
+            nullptr                                                 // pImmutableSamplers
+        },
+        {
+            3,                                                      // binding
+            VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,                       // descriptorType
+            1,                                                      // descriptorCount
+            VK_SHADER_STAGE_RAYGEN_BIT_KHR |
+            VK_SHADER_STAGE_COMPUTE_BIT,                            // stageFlags
+            nullptr                                                 // pImmutableSamplers
+        },
+        {
+            4,                                                      // binding
+            VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,                       // descriptorType
+            1,                                                      // descriptorCount
+            VK_SHADER_STAGE_RAYGEN_BIT_KHR |
+            VK_SHADER_STAGE_COMPUTE_BIT,                            // stageFlags
+            nullptr                                                 // pImmutableSamplers
+        },
+        {
+            5,                                                      // binding
+            VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,                       // descriptorType
+            1,                                                      // descriptorCount
+            VK_SHADER_STAGE_RAYGEN_BIT_KHR |
+            VK_SHADER_STAGE_COMPUTE_BIT,                            // stageFlags
+            nullptr                                                 // pImmutableSamplers
+        },
+        {
+            6,                                                      // binding
+            VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,                       // descriptorType
+            1,                                                      // descriptorCount
+            VK_SHADER_STAGE_RAYGEN_BIT_KHR |
+            VK_SHADER_STAGE_COMPUTE_BIT,                            // stageFlags
             nullptr                                                 // pImmutableSamplers
         }
     };
@@ -362,6 +479,17 @@ void RaytracedModel::CreateDescriptorSetLayout() {
     } };
 
     m_VkFactory->CreateDescriptorSetLayout(ltcLayoutBinding, m_LTCDescriptorSetLayout);
+
+    std::vector<VkDescriptorSetLayoutBinding> blueNoiseLayoutBinding = { {
+        0,                                                          // binding
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,                  // descriptorType
+        1,                                                          // descriptorCount
+        VK_SHADER_STAGE_RAYGEN_BIT_KHR |
+        VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,                        // stageFlags
+        nullptr                                                     // pImmutableSamplers
+    } };
+
+    m_VkFactory->CreateDescriptorSetLayout(blueNoiseLayoutBinding, m_BlueNoiseDescriptorSetLayout);
 }
 
 void RaytracedModel::CreateDescriptorPool() {
@@ -395,13 +523,33 @@ void RaytracedModel::CreateDescriptorPool() {
     } };
 
     m_VkFactory->CreateDescriptorPool(ltcPoolSize, m_LTCDescriptorPool);
+
+    std::vector<VkDescriptorPoolSize> blueNoisePoolSize = { {
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,                  // type
+        static_cast<uint32_t>(
+            m_VkFactory->GetSwapchainImages().size())               // descriptorCount
+    } };
+
+    m_VkFactory->CreateDescriptorPool(blueNoisePoolSize, m_BlueNoiseDescriptorPool);
 }
 
 void RaytracedModel::CreateRtPipeline() {
-    std::vector<VkDescriptorSetLayout> layouts{ m_RtDescriptorSetLayout, m_DescriptorSetLayout, m_SkyboxDescriptorSetLayout, m_LTCDescriptorSetLayout };
+    std::vector<VkDescriptorSetLayout> layouts{ m_RtDescriptorSetLayout, m_DescriptorSetLayout, m_SkyboxDescriptorSetLayout, m_LTCDescriptorSetLayout,
+        m_BlueNoiseDescriptorSetLayout };
     m_VkFactory->CreateRtPipeline(layouts, m_RtPipelineLayout, m_RtPipeline, m_ShaderGroups);
 }
 
+void RaytracedModel::CreateAdaptivePipeline() {
+    std::vector<VkDescriptorSetLayout> layouts{ m_RtDescriptorSetLayout };
+    std::vector<VkPushConstantRange> pushConstantRanges{ {
+        VK_SHADER_STAGE_COMPUTE_BIT,                                // stageFlags
+        0,                                                          // offset
+        sizeof(AdaptiveSamplingConstants)                           // size
+    } };
+    m_VkFactory->CreateGraphicsPipelineLayout(layouts, pushConstantRanges, m_AdaptivePipelineLayout);
+    m_VkFactory->CreateComputePipeline("shaders/adaptiveComp.spv", m_AdaptivePipelineLayout, m_AdaptivePipeline);
+}
+
 void RaytracedModel::CreateUniformBuffer() {
     m_VkFactory->CreateBuffer(sizeof(RtUniformBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_UniformBuffer, m_UniformBufferMemory);
@@ -490,27 +638,7 @@ void RaytracedModel::CreatePostPipeline() {
 void RaytracedModel::CreateTextureImage(std::vector<std::string> textures) {
     int texWidth = 0, texHeight = 0, texChannels = 0;
     assert(textures.size() == 6);
-    stbi_load(textures[0].c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-    std::vector<VkBuffer> stagingBuffer(6);
-    std::vector<VkDeviceMemory> stagingBufferMemory(6);
-    uint32_t faceSize = (VkDeviceSize)texWidth * texHeight * 4;
-    for (uint32_t i = 0; i < 6; ++i) {
-        stbi_uc *pixels = stbi_load(textures[i].c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-
-        if (!pixels) {
-            throw std::runtime_error("cannot load texture");
-        }
-
-        m_VkFactory->CreateBuffer(faceSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            stagingBuffer[i], stagingBufferMemory[i]);
-
-        void *data;
-        vkMapMemory(m_VkFactory->GetDevice(), stagingBufferMemory[i], 0, faceSize, 0, &data);
-        memcpy(data, pixels, faceSize);
-        vkUnmapMemory(m_VkFactory->GetDevice(), stagingBufferMemory[i]);
-
-        stbi_image_free(pixels);
-    }
+    stbi_info(textures[0].c_str(), &texWidth, &texHeight, &texChannels);
 
     uint32_t mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
 
@@ -520,53 +648,67 @@ void RaytracedModel::CreateTextureImage(std::vector<std::string> textures) {
 
     m_VkFactory->TransitionImageLayout(m_TextureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 6, mipLevels);
     for (uint32_t i = 0; i < textures.size(); ++i) {
-        m_VkFactory->CopyBufferToImage(stagingBuffer[i], m_TextureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), 1, i);
+        stbi_uc *pixels = stbi_load(textures[i].c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+
+        if (!pixels) {
+            throw std::runtime_error("cannot load texture");
+        }
+
+        m_VkFactory->UploadToImage(m_TextureImage, pixels, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), 1, 4, i);
+        stbi_image_free(pixels);
     }
     
     m_VkFactory->GenerateMipMaps(m_TextureImage, texWidth, texHeight, mipLevels, 6);
 
-    for (auto &memory : stagingBufferMemory) {
-        vkFreeMemory(m_VkFactory->GetDevice(), memory, nullptr);
-    }
-    for (auto &buffer : stagingBuffer) {
-        vkDestroyBuffer(m_VkFactory->GetDevice(), buffer, nullptr);
-    }
-
     m_TextureImageView = m_VkFactory->CreateImageView(m_TextureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_CUBE, 6, mipLevels);
 }
 
 void RaytracedModel::CreateLTCImage() {
 #include "LTCanisotropicMatrices.inc"
-    std::array<VkBuffer, 3> stagingBuffer{};
-    std::array<VkDeviceMemory, 3> stagingBufferMemory{};
-
-    void *data;
-    for (uint32_t c = 0; c < stagingBuffer.size(); ++c) {
-        m_VkFactory->CreateBuffer(LTCsize / 9 * 4, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            stagingBuffer[c], stagingBufferMemory[c]);
-        vkMapMemory(m_VkFactory->GetDevice(), stagingBufferMemory[c], 0, LTCsize / 9 * 4, 0, &data);
+    std::vector<float> data(LTCsize / 9 * 4 / sizeof(float));
+
+    for (uint32_t c = 0; c < m_LTCImage.size(); ++c) {
         for (int alpha = 0; alpha < 8; ++alpha) {
             for (int lambda = 0; lambda < 8; ++lambda) {
                 for (int theta = 0; theta < 8; ++theta) {
                     for (int phi = 0; phi < 8; ++phi) {
-                        static_cast<float*>(data)[0 + 4 * (alpha + 8 * (lambda + 8 * (theta + 8 * phi)))] = anisomats[alpha][lambda][theta][phi][3 * c + 0];
-                        static_cast<float*>(data)[1 + 4 * (alpha + 8 * (lambda + 8 * (theta + 8 * phi)))] = anisomats[alpha][lambda][theta][phi][3 * c + 1];
-                        static_cast<float*>(data)[2 + 4 * (alpha + 8 * (lambda + 8 * (theta + 8 * phi)))] = anisomats[alpha][lambda][theta][phi][3 * c + 2];
-                        static_cast<float*>(data)[3 + 4 * (alpha + 8 * (lambda + 8 * (theta + 8 * phi)))] = 0.0;
+                        data[0 + 4 * (alpha + 8 * (lambda + 8 * (theta + 8 * phi)))] = anisomats[alpha][lambda][theta][phi][3 * c + 0];
+                        data[1 + 4 * (alpha + 8 * (lambda + 8 * (theta + 8 * phi)))] = anisomats[alpha][lambda][theta][phi][3 * c + 1];
+                        data[2 + 4 * (alpha + 8 * (lambda + 8 * (theta + 8 * phi)))] = anisomats[alpha][lambda][theta][phi][3 * c + 2];
+                        data[3 + 4 * (alpha + 8 * (lambda + 8 * (theta + 8 * phi)))] = 0.0;
                     }
                 }
             }
         }
-        vkUnmapMemory(m_VkFactory->GetDevice(), stagingBufferMemory[c]);
         m_VkFactory->CreateImage(8, 8, 64, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_LTCImage[c], m_LTCImageMemory[c], 1);
         m_VkFactory->TransitionImageLayout(m_LTCImage[c], VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1);
-        m_VkFactory->CopyBufferToImage(stagingBuffer[c], m_LTCImage[c], 8, 8, 64, 0);
+        m_VkFactory->UploadToImage(m_LTCImage[c], data.data(), 8, 8, 64, 4 * sizeof(float), 0);
         m_VkFactory->TransitionImageLayout(m_LTCImage[c], VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1);
 
         m_LTCImageView[c] = m_VkFactory->CreateImageView(m_LTCImage[c], VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_3D, 1);
-        vkFreeMemory(m_VkFactory->GetDevice(), stagingBufferMemory[c], nullptr);
-        vkDestroyBuffer(m_VkFactory->GetDevice(), stagingBuffer[c], nullptr);
     }
 }
 
+
+void RaytracedModel::CreateBlueNoiseImage() {
+    std::array<std::vector<float>, 2> channels;
+    ThreadPool::GetInstance()->ParallelFor(static_cast<uint32_t>(channels.size()), [&](uint32_t c) {
+        channels[c] = BlueNoise::Generate(c + 1);
+    });
+    std::vector<float> data(BlueNoise::Size * BlueNoise::Size * 2);
+    for (uint32_t i = 0; i < BlueNoise::Size * BlueNoise::Size; ++i) {
+        data[i * 2 + 0] = channels[0][i];
+        data[i * 2 + 1] = channels[1][i];
+    }
+
+    // read with texelFetch only, so the float format needs no filtering support
+    m_VkFactory->CreateImage(BlueNoise::Size, BlueNoise::Size, 1, VK_FORMAT_R32G32_SFLOAT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_BlueNoiseImage, m_BlueNoiseImageMemory, 1);
+    m_VkFactory->TransitionImageLayout(m_BlueNoiseImage, VK_FORMAT_R32G32_SFLOAT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1);
+    m_VkFactory->UploadToImage(m_BlueNoiseImage, data.data(), BlueNoise::Size, BlueNoise::Size, 1, 2 * sizeof(float), 0);
+    m_VkFactory->TransitionImageLayout(m_BlueNoiseImage, VK_FORMAT_R32G32_SFLOAT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1);
+
+    m_BlueNoiseImageView = m_VkFactory->CreateImageView(m_BlueNoiseImage, VK_FORMAT_R32G32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_2D, 1);
+    m_VkFactory->CreateTextureSampler(m_BlueNoiseSampler);
+}
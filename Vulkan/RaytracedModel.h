@@ -3,20 +3,49 @@
 #include "Vertex.h"
 #include "VulkanFactory.h"
 #include "Interfaces.h"
+#include "VertexFormat.h"
+#include "Denoiser.h"
+#include "Checkerboard.h"
+#include "BlueNoise.h"
 
+// per mesh record the hit shader reads through gl_InstanceCustomIndexEXT, scalar layout
 struct BufferAddresses {
-    VkDeviceAddress vertexAddress;
+    VkDeviceAddress vertexAddress;                          // position stream
+    VkDeviceAddress attributeAddress;
     VkDeviceAddress indiceAddress;
+    glm::vec3 dequantizeOffset;
+    VkBool32 packedVertices;
+    glm::vec3 dequantizeScale;
+    VkBool32 shortIndices;
 };
 
+// push constants of the pass turning per pixel statistics into the sample counts of the next frame
+struct AdaptiveSamplingConstants {
+    uint32_t accumulated;                                   // frames averaged so far, too few give every pixel baseSamples
+    uint32_t baseSamples;
+    uint32_t maxSamples;
+    float threshold;                                        // relative standard error below which a pixel stops sampling
+};
+
+// A ray traced scene: every mesh gets one BLAS and one address table entry, every instance is a TLAS record
+// referencing the BLAS of its mesh, so repeating a mesh costs one instance rather than another copy of its geometry.
 class RaytracedModel{
 public:
-    RaytracedModel(std::vector<std::string> modelFilenames);
+    // the files form mesh 0
+    RaytracedModel(std::vector<std::string> modelFilenames, VertexEncoding encoding = VertexEncoding::Packed);
     void Cleanup();
     void UpdateWindowSize();
 
+    // the files are merged into one mesh; returns its index for AddInstance
+    uint32_t AddMesh(std::vector<std::string> modelFilenames, VertexEncoding encoding = VertexEncoding::Packed);
+
+    // meshes and instances must all be added before PrepareForRayTracing; hitGroup is the SBT record offset,
+    // below VulkanFactory::HitGroupCount
     void AddInstance(glm::vec3 tv, glm::vec3 sv, glm::vec3 rv) {
-        Instance instance(tv, sv, rv);
+        AddInstance(0, tv, sv, rv);
+    }
+    void AddInstance(uint32_t mesh, glm::vec3 tv, glm::vec3 sv, glm::vec3 rv, uint32_t hitGroup = 0) {
+        Instance instance(mesh, hitGroup, tv, sv, rv);
         m_Instances.push_back(instance);
     }
 
@@ -27,7 +56,16 @@ public:
         m_RtPC.ax = alphaX;
         m_RtPC.ay = alphaY;
     }
+    void SetSampleSequence(SampleSequence sequence) {
+        m_RtPC.sequence = sequence;
+    }
+    // traces every other pixel and reconstructs the rest, about half the rays per frame
+    void SetCheckerboard(bool checkerboard) {
+        m_RtPC.checkerboard = checkerboard;
+    }
     void Raytrace(VkCommandBuffer cmdBuff, glm::mat4 viewMatrix, float time, uint32_t index);
+    // filters the target of the last Raytrace in place, goes between Raytrace and Postprocess
+    void Denoise(VkCommandBuffer cmdBuff, uint32_t index);
     void Postprocess(VkCommandBuffer cmdBuff, uint32_t idx);
 
 private:
@@ -35,8 +73,13 @@ private:
         glm::vec3 m_Translation;
         glm::vec3 m_Scale;
         glm::vec3 m_Rotation;
+        uint32_t m_Mesh;
+        uint32_t m_HitGroup;
     public:
-        Instance(glm::vec3 tv, glm::vec3 sv, glm::vec3 rv) : m_Translation(tv), m_Scale(sv), m_Rotation(rv) {}
+        Instance(uint32_t mesh, uint32_t hitGroup, glm::vec3 tv, glm::vec3 sv, glm::vec3 rv) :
+            m_Translation(tv), m_Scale(sv), m_Rotation(rv), m_Mesh(mesh), m_HitGroup(hitGroup) {}
+        uint32_t GetMesh() const { return m_Mesh; }
+        uint32_t GetHitGroup() const { return m_HitGroup; }
         glm::mat4 GetModelMatrix(float time) {
             glm::mat4 mat(1.0f);
             mat = glm::translate(mat, m_Translation);
@@ -51,23 +94,35 @@ private:
 
     uint32_t m_Width, m_Height;
 
-    VkBuffer m_VertexBuffer;
-    VkDeviceMemory m_VertexBufferMemory;
-    VkBuffer m_IndexBuffer;
-    VkDeviceMemory m_IndexBufferMemory;
+    struct SceneMesh {
+        EncodedMesh mesh;
+        VkBuffer vertexBuffer;
+        MemoryAllocation vertexBufferMemory;
+        VkBuffer indexBuffer;
+        MemoryAllocation indexBufferMemory;
+        AccelerationStructure blas;
+        std::string blasCachePath;                          // next to the first source file
+    };
+    std::vector<SceneMesh> m_Meshes;
+
     VkBuffer m_UniformBuffer;
-    VkDeviceMemory m_UniformBufferMemory;
+    MemoryAllocation m_UniformBufferMemory;
 
     VkImage m_TextureImage;
-    VkDeviceMemory m_TextureImageMemory;
+    MemoryAllocation m_TextureImageMemory;
     VkImageView m_TextureImageView;
     VkSampler m_TextureSampler;
 
     std::array<VkImage, 3> m_LTCImage;
-    std::array <VkDeviceMemory, 3> m_LTCImageMemory;
+    std::array <MemoryAllocation, 3> m_LTCImageMemory;
     std::array <VkImageView, 3> m_LTCImageView;
     std::array <VkSampler, 3> m_LTCSampler;
 
+    VkImage m_BlueNoiseImage;                               // BlueNoise::Size squared, two independent channels
+    MemoryAllocation m_BlueNoiseImageMemory;
+    VkImageView m_BlueNoiseImageView;
+    VkSampler m_BlueNoiseSampler;
+
     VkDescriptorSetLayout m_DescriptorSetLayout;
     VkDescriptorPool m_DescriptorPool;
     std::vector<VkDescriptorSet> m_DescriptorSets;
@@ -80,48 +135,82 @@ private:
     VkDescriptorSetLayout m_LTCDescriptorSetLayout;
     VkDescriptorPool m_LTCDescriptorPool;
     std::vector<VkDescriptorSet> m_LTCDescriptorSets;
+    VkDescriptorSetLayout m_BlueNoiseDescriptorSetLayout;
+    VkDescriptorPool m_BlueNoiseDescriptorPool;
+    std::vector<VkDescriptorSet> m_BlueNoiseDescriptorSets;
 
     std::vector<BufferAddresses> m_BufferAddresses;
     VkBuffer m_AddressesStorageBuffer;
-    VkDeviceMemory m_AddressesStorageBufferMemory;
+    MemoryAllocation m_AddressesStorageBufferMemory;
 
     std::vector<OffscreenRender> m_OffscreenRenderTargets;
 
-    std::vector<Vertex> m_Vertices;
-    std::vector<uint32_t> m_Indices;
-
     VkPipelineLayout m_RtPipelineLayout;
     VkPipeline m_RtPipeline;
 
     VkPipelineLayout m_PostPipelineLayout;
     VkPipeline m_PostPipeline;
 
-    VkAccelerationStructureInstanceKHR m_tlasInstance;
-    AccelerationStructure m_Blas;
-    AccelerationStructure m_Tlas;
+    VkPipelineLayout m_AdaptivePipelineLayout;              // the ray tracing set only
+    VkPipeline m_AdaptivePipeline;
+
+    Denoiser m_Denoiser;
+    Checkerboard m_Checkerboard;
+
+    std::vector<VkAccelerationStructureInstanceKHR> m_TlasInstances;   // everything but the transform is fixed
+    TopLevelAS m_Tlas;
     VkBuffer m_RtSBTBuffer;
-    VkDeviceMemory m_RtSBTBufferMemory;
+    MemoryAllocation m_RtSBTBufferMemory;
     std::vector<VkRayTracingShaderGroupCreateInfoKHR> m_ShaderGroups{};
     VkStridedDeviceAddressRegionKHR m_RgenRegion{};
     VkStridedDeviceAddressRegionKHR m_MissRegion{};
     VkStridedDeviceAddressRegionKHR m_HitRegion{};
     VkStridedDeviceAddressRegionKHR m_CallRegion{};
 
+    // progressive mode: a few samples per frame averaged into the accumulation image of each target until the view,
+    // an instance or the constants change; a target that has averaged MaxAccumulatedFrames frames is left alone
+    static constexpr uint32_t SamplesPerFrame = 4;
+    static constexpr uint32_t MaxAccumulatedFrames = 1024;
+    // noisy pixels get up to MaxSamplesPerFrame, converged ones none
+    static constexpr uint32_t MaxSamplesPerFrame = 16;
+    static constexpr float ConvergenceThreshold = 0.02f;
+
     RtPushConstants m_RtPC{
         false,
         0.5f,
-        0.9f
+        0.9f,
+        0,
+        SamplesPerFrame,
+        0,
+        SampleSequence::Sobol,
+        0,
+        0
     };
-
-    void LoadModel(std::string);
-    void CreateVertexBuffer();
-    void CreateIndexBuffer();
+    uint32_t m_FrameIndex = 0;
+    std::vector<uint32_t> m_AccumulatedFrames;              // per offscreen target
+    glm::mat4 m_LastViewMatrix{ 0.0f };
+    RtPushConstants m_LastConstants{};
+    glm::mat4 m_PrevViewProj{ 1.0f };
+    bool m_Traced = false;                                  // the last Raytrace traced its target
+
+    // Each target alternates its own half, so every one of its pixels is traced every other frame whatever the
+    // number of targets; a target's first frame takes the half the frame before it skipped.
+    static constexpr uint32_t NoParity = ~0u;
+    std::vector<uint32_t> m_CheckerboardParity;             // per offscreen target, the half its last frame traced
+    uint32_t m_LastCheckerboardParity = 1;
+
+    void CreateMeshBuffers(SceneMesh &sceneMesh);
+    void CreateAddressTable();
+    void ResetAccumulation();
     void CreateDescriptorSetLayout();
     void CreateDescriptorPool();
     void CreateTextureImage(std::vector<std::string>);
     void CreateLTCImage();
+    void CreateBlueNoiseImage();
     void CreateRtPipeline();
     void CreateUniformBuffer();
     void UpdateUniformBuffer(VkCommandBuffer cmdBuff, RtUniformBufferObject& ubo);
     void CreatePostPipeline();
+    void CreateAdaptivePipeline();
+    void RecordAdaptiveSampling(VkCommandBuffer cmdBuff, uint32_t index);
 };
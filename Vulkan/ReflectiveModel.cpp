@@ -1,17 +1,14 @@
 #include "ReflectiveModel.h"
 
 #include <stb_image.h>
-#include <tiny_obj_loader.h>
 
 
-ReflectiveModel::ReflectiveModel(std::vector<std::string> modelFilenames) :
+ReflectiveModel::ReflectiveModel(std::vector<std::string> modelFilenames, VertexEncoding encoding) :
     m_VertexBuffer(VK_NULL_HANDLE), m_IndexBuffer(VK_NULL_HANDLE),
-    m_VertexBufferMemory(VK_NULL_HANDLE), m_IndexBufferMemory(VK_NULL_HANDLE),
-    m_TextureImage(VK_NULL_HANDLE), m_TextureImageMemory(VK_NULL_HANDLE), m_TextureImageView(VK_NULL_HANDLE),
+    m_VertexBufferMemory(), m_IndexBufferMemory(),
+    m_TextureImage(VK_NULL_HANDLE), m_TextureImageMemory(), m_TextureImageView(VK_NULL_HANDLE),
     m_VkFactory(VulkanFactory::GetInstance()) {
-    for (const auto& modelFilename : modelFilenames) {
-        LoadModel(modelFilename);
-    }
+    m_Mesh = EncodeMesh(MeshLoader::Load(modelFilenames), encoding);
     CreateDescriptorSetLayout();
     CreateTextureImage({ "textures/posx.jpg", "textures/negx.jpg", "textures/posy.jpg" , "textures/negy.jpg" , "textures/posz.jpg" , "textures/negz.jpg" });
     CreateTextureImageView();
@@ -36,27 +33,7 @@ void ReflectiveModel::UpdateWindowSize() {
 void ReflectiveModel::CreateTextureImage(std::vector<std::string> textures) {
     int texWidth = 0, texHeight = 0, texChannels = 0;
     assert(textures.size() == 6);
-    stbi_load(textures[0].c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-    std::vector<VkBuffer> stagingBuffer(6);
-    std::vector<VkDeviceMemory> stagingBufferMemory(6);
-    uint32_t faceSize = (VkDeviceSize)texWidth * texHeight * 4;
-    for (uint32_t i = 0; i < 6; ++i) {
-        stbi_uc* pixels = stbi_load(textures[i].c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-
-        if (!pixels) {
-            throw std::runtime_error("cannot load texture");
-        }
-
-        m_VkFactory->CreateBuffer(faceSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            stagingBuffer[i], stagingBufferMemory[i]);
-
-        void* data;
-        vkMapMemory(m_VkFactory->GetDevice(), stagingBufferMemory[i], 0, faceSize, 0, &data);
-        memcpy(data, pixels, faceSize);
-        vkUnmapMemory(m_VkFactory->GetDevice(), stagingBufferMemory[i]);
-
-        stbi_image_free(pixels);
-    }
+    stbi_info(textures[0].c_str(), &texWidth, &texHeight, &texChannels);
 
     m_VkFactory->CreateImage(texWidth, texHeight, 1, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
         VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
@@ -64,110 +41,34 @@ void ReflectiveModel::CreateTextureImage(std::vector<std::string> textures) {
 
     m_VkFactory->TransitionImageLayout(m_TextureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 6);
     for (uint32_t i = 0; i < textures.size(); ++i) {
-        m_VkFactory->CopyBufferToImage(stagingBuffer[i], m_TextureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), 1, i);
-    }
-    m_VkFactory->TransitionImageLayout(m_TextureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 6);
+        stbi_uc* pixels = stbi_load(textures[i].c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
 
-    for (auto& memory : stagingBufferMemory) {
-        vkFreeMemory(m_VkFactory->GetDevice(), memory, nullptr);
-    }
-    for (auto& buffer : stagingBuffer) {
-        vkDestroyBuffer(m_VkFactory->GetDevice(), buffer, nullptr);
+        if (!pixels) {
+            throw std::runtime_error("cannot load texture");
+        }
+
+        m_VkFactory->UploadToImage(m_TextureImage, pixels, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), 1, 4, i);
+        stbi_image_free(pixels);
     }
+    m_VkFactory->TransitionImageLayout(m_TextureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 6);
 }
 
 void ReflectiveModel::CreateTextureImageView() {
     m_TextureImageView = m_VkFactory->CreateImageView(m_TextureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_CUBE, 6);
 }
 
-void ReflectiveModel::LoadModel(std::string modelPath) {
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-
-    std::string warning, error;
-
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warning, &error, modelPath.c_str())) {
-        throw std::runtime_error(warning + error);
-    }
-
-    std::unordered_map<Vertex, uint32_t> uniqueVertices;
-
-    for (auto& shape : shapes) {
-        for (const auto& index : shape.mesh.indices) {
-            Vertex vertex{};
-
-            vertex.pos = {
-                attrib.vertices[3 * index.vertex_index + 0],
-                attrib.vertices[3 * index.vertex_index + 1],
-                attrib.vertices[3 * index.vertex_index + 2]
-            };
-
-            if (index.texcoord_index == -1) {
-                vertex.texCoord = { 0.0, 0.0 };
-            }
-            else {
-                vertex.texCoord = {
-                    attrib.texcoords[2 * index.texcoord_index + 0],
-                    1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-                };
-            }
-            vertex.normal = {
-                attrib.normals[3 * index.normal_index + 0],
-                attrib.normals[3 * index.normal_index + 1],
-                attrib.normals[3 * index.normal_index + 2]
-            };
-
-            if (uniqueVertices.count(vertex) == 0) {
-                uniqueVertices[vertex] = static_cast<uint32_t>(m_Vertices.size());
-                m_Vertices.push_back(vertex);
-            }
-
-            m_Indices.push_back(uniqueVertices[vertex]);
-        }
-    }
-}
-
 void ReflectiveModel::CreateVertexBuffer() {
-    VkDeviceSize bufferSize = sizeof(m_Vertices[0]) * m_Vertices.size();
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-
-    m_VkFactory->CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-    void* data;
-    vkMapMemory(m_VkFactory->GetDevice(), stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, m_Vertices.data(), bufferSize);
-    vkUnmapMemory(m_VkFactory->GetDevice(), stagingBufferMemory);
-
+    VkDeviceSize bufferSize = m_Mesh.vertexData.size();
     m_VkFactory->CreateBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_VertexBuffer, m_VertexBufferMemory);
-
-    m_VkFactory->CopyBuffer(stagingBuffer, m_VertexBuffer, bufferSize);
-
-    vkDestroyBuffer(m_VkFactory->GetDevice(), stagingBuffer, nullptr);
-    vkFreeMemory(m_VkFactory->GetDevice(), stagingBufferMemory, nullptr);
+    m_VkFactory->UploadToBuffer(m_VertexBuffer, 0, m_Mesh.vertexData.data(), bufferSize);
 }
 
 void ReflectiveModel::CreateIndexBuffer() {
-    VkDeviceSize bufferSize = sizeof(m_Indices[0]) * m_Indices.size();
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-
-    m_VkFactory->CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-    void* data;
-    vkMapMemory(m_VkFactory->GetDevice(), stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, m_Indices.data(), bufferSize);
-    vkUnmapMemory(m_VkFactory->GetDevice(), stagingBufferMemory);
-
+    VkDeviceSize bufferSize = m_Mesh.indexData.size();
     m_VkFactory->CreateBuffer(bufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_IndexBuffer, m_IndexBufferMemory);
-
-    m_VkFactory->CopyBuffer(stagingBuffer, m_IndexBuffer, bufferSize);
-
-    vkDestroyBuffer(m_VkFactory->GetDevice(), stagingBuffer, nullptr);
-    vkFreeMemory(m_VkFactory->GetDevice(), stagingBufferMemory, nullptr);
+    m_VkFactory->UploadToBuffer(m_IndexBuffer, 0, m_Mesh.indexData.data(), bufferSize);
 }
 
 void ReflectiveModel::Cleanup() {
@@ -178,11 +79,11 @@ void ReflectiveModel::Cleanup() {
     vkDestroySampler(m_VkFactory->GetDevice(), m_TextureSampler, nullptr);
     vkDestroyBuffer(m_VkFactory->GetDevice(), m_VertexBuffer, nullptr);
     vkDestroyBuffer(m_VkFactory->GetDevice(), m_IndexBuffer, nullptr);
-    vkFreeMemory(m_VkFactory->GetDevice(), m_VertexBufferMemory, nullptr);
-    vkFreeMemory(m_VkFactory->GetDevice(), m_IndexBufferMemory, nullptr);
+    m_VkFactory->FreeMemory(m_VertexBufferMemory);
+    m_VkFactory->FreeMemory(m_IndexBufferMemory);
     vkDestroyImageView(m_VkFactory->GetDevice(), m_TextureImageView, nullptr);
     vkDestroyImage(m_VkFactory->GetDevice(), m_TextureImage, nullptr);
-    vkFreeMemory(m_VkFactory->GetDevice(), m_TextureImageMemory, nullptr);
+    m_VkFactory->FreeMemory(m_TextureImageMemory);
 }
 
 VkCommandBuffer* ReflectiveModel::Draw(uint32_t index, VkCommandBufferBeginInfo* beginInfo, glm::mat4& viewMatrix, LightsPositions lp) {
@@ -194,8 +95,11 @@ VkCommandBuffer* ReflectiveModel::Draw(uint32_t index, VkCommandBufferBeginInfo*
     vkResetCommandBuffer(m_CommandBuffers[index], 0);
     vkBeginCommandBuffer(m_CommandBuffers[index], beginInfo);
     vkCmdBindPipeline(m_CommandBuffers[index], VK_PIPELINE_BIND_POINT_GRAPHICS, m_GraphicsPipeline);
-    vkCmdBindVertexBuffers(m_CommandBuffers[index], 0, 1, &m_VertexBuffer, &offsets);
-    vkCmdBindIndexBuffer(m_CommandBuffers[index], m_IndexBuffer, offsets, VK_INDEX_TYPE_UINT32);
+    // both vertex streams live in the same buffer
+    VkBuffer vertexBuffers[2] = { m_VertexBuffer, m_VertexBuffer };
+    VkDeviceSize vertexOffsets[2] = { 0, m_Mesh.attributeOffset };
+    vkCmdBindVertexBuffers(m_CommandBuffers[index], 0, 2, vertexBuffers, vertexOffsets);
+    vkCmdBindIndexBuffer(m_CommandBuffers[index], m_IndexBuffer, offsets, m_Mesh.indexType);
     vkCmdBindDescriptorSets(m_CommandBuffers[index], VK_PIPELINE_BIND_POINT_GRAPHICS, m_GraphicsPipelineLayout,
         0, 1, &m_DescriptorSets[index], 0, nullptr);
     vkCmdPushConstants(m_CommandBuffers[index], m_GraphicsPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(UniformBufferObject), sizeof(lp), &lp);
@@ -204,10 +108,13 @@ VkCommandBuffer* ReflectiveModel::Draw(uint32_t index, VkCommandBufferBeginInfo*
     ubo.projection = glm::perspective(glm::radians(60.0f), m_Width / (float)m_Height, 0.1f, 20.0f);
     ubo.projection[1][1] *= -1;
     ubo.view = viewMatrix;
+    float pixelsPerUnit = m_Height / (2.0f * std::tan(glm::radians(60.0f) * 0.5f));
     for (auto& instance : m_Instances) {
-        ubo.model = instance.GetModelMatrix(time);
+        glm::mat4 modelMatrix = instance.GetModelMatrix(time);
+        ubo.model = modelMatrix * m_Mesh.quantization.GetDequantizeMatrix();
+        const MeshLod &lod = m_Mesh.lods[m_Mesh.SelectLod(viewMatrix * modelMatrix, pixelsPerUnit)];
         vkCmdPushConstants(m_CommandBuffers[index], m_GraphicsPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ubo), &ubo);
-        vkCmdDrawIndexed(m_CommandBuffers[index], static_cast<uint32_t>(m_Indices.size()), 1, 0, 0, 0);
+        vkCmdDrawIndexed(m_CommandBuffers[index], lod.indexCount, 1, lod.firstIndex, 0, 0);
     }
     vkEndCommandBuffer(m_CommandBuffers[index]);
     return &m_CommandBuffers[index];
@@ -240,6 +147,19 @@ void ReflectiveModel::CreateGraphicsPipeline() {
     m_VkFactory->CreateShaderModule(vertexShaderModule, "shaders/vert.spv");
     m_VkFactory->CreateShaderModule(fragmentShaderModule, "shaders/reflectiveFrag.spv");
 
+    VkBool32 packedVertex = m_Mesh.layout.IsPacked();
+    VkSpecializationMapEntry specializationEntry = {
+        0,                                                          // constantID
+        0,                                                          // offset
+        sizeof(VkBool32)                                            // size
+    };
+    VkSpecializationInfo specializationInfo = {
+        1,                                                          // mapEntryCount
+        &specializationEntry,                                       // pMapEntries
+        sizeof(packedVertex),                                       // dataSize
+        &packedVertex                                               // pData
+    };
+
     VkPipelineShaderStageCreateInfo vsStageCreateInfo = {
         VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,        // sType
         nullptr,                                                    // pNext
@@ -247,7 +167,7 @@ void ReflectiveModel::CreateGraphicsPipeline() {
         VK_SHADER_STAGE_VERTEX_BIT,                                 // stage
         vertexShaderModule,                                         // module
         "main",                                                     // pName
-        nullptr                                                     // pSpecializationInfo
+        &specializationInfo                                         // pSpecializationInfo
     };
 
     VkPipelineShaderStageCreateInfo fsStageCreateInfo = {
@@ -261,15 +181,15 @@ void ReflectiveModel::CreateGraphicsPipeline() {
     };
 
     std::vector<VkPipelineShaderStageCreateInfo> shaderStages = { vsStageCreateInfo, fsStageCreateInfo };
-    auto inputAttribute = Vertex::GetAttributeDescription();
-    auto bindingDescr = Vertex::GetBindingDescription();
+    auto &inputAttribute = m_Mesh.layout.attributes;
+    auto &bindingDescr = m_Mesh.layout.bindings;
 
     VkPipelineVertexInputStateCreateInfo vertexInputStateCreateInfo = {
         VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,  // sType
         nullptr,                                                    // pNext
         0,                                                          // flags
-        1,                                                          // vertexBindingDescriptionCount
-        &bindingDescr,                                              // pVertexBindingDescriptions
+        static_cast<uint32_t>(bindingDescr.size()),                 // vertexBindingDescriptionCount
+        bindingDescr.data(),                                        // pVertexBindingDescriptions
         static_cast<uint32_t>(inputAttribute.size()),               // vertexAttributeDescriptionCount
         inputAttribute.data()                                       // pVertexAttributeDescriptions
     };
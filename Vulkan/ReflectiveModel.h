@@ -3,10 +3,11 @@
 #include "Vertex.h"
 #include "VulkanFactory.h"
 #include "Interfaces.h"
+#include "VertexFormat.h"
 
 class ReflectiveModel : public DrawableInterface {
 public:
-    ReflectiveModel(std::vector<std::string> modelFilenames);
+    ReflectiveModel(std::vector<std::string> modelFilenames, VertexEncoding encoding = VertexEncoding::Packed);
     void Cleanup() override;
     void UpdateWindowSize() override;
 
@@ -57,26 +58,24 @@ private:
 
     VkBuffer m_VertexBuffer;
     VkBuffer m_IndexBuffer;
-    VkDeviceMemory m_VertexBufferMemory;
-    VkDeviceMemory m_IndexBufferMemory;
+    MemoryAllocation m_VertexBufferMemory;
+    MemoryAllocation m_IndexBufferMemory;
 
     VkDescriptorSetLayout m_DescriptorSetLayout;
     VkDescriptorPool m_DescriptorPool;
     std::vector<VkDescriptorSet> m_DescriptorSets;
     VkImage m_TextureImage;
-    VkDeviceMemory m_TextureImageMemory;
+    MemoryAllocation m_TextureImageMemory;
     VkImageView m_TextureImageView;
     VkSampler m_TextureSampler;
 
-    std::vector<Vertex> m_Vertices;
-    std::vector<uint32_t> m_Indices;
+    EncodedMesh m_Mesh;
 
     VkPipelineLayout m_GraphicsPipelineLayout;
     VkPipeline m_GraphicsPipeline;
 
     void CreateTextureImage(std::vector<std::string> textures);
     void CreateTextureImageView();
-    void LoadModel(std::string);
     void CreateVertexBuffer();
     void CreateIndexBuffer();
     void CreateDescriptorSetLayout();
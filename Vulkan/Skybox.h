@@ -3,6 +3,7 @@
 #include "Vertex.h"
 #include "VulkanFactory.h"
 #include "Interfaces.h"
+#include "VertexFormat.h"
 
 class Application;
 
@@ -24,27 +25,24 @@ private:
 
     VkBuffer m_VertexBuffer;
     VkBuffer m_IndexBuffer;
-    VkDeviceMemory m_VertexBufferMemory;
-    VkDeviceMemory m_IndexBufferMemory;
+    MemoryAllocation m_VertexBufferMemory;
+    MemoryAllocation m_IndexBufferMemory;
 
     VkDescriptorSetLayout m_DescriptorSetLayout;
     VkDescriptorPool m_DescriptorPool;
     std::vector<VkDescriptorSet> m_DescriptorSets;
     VkImage m_TextureImage;
-    VkDeviceMemory m_TextureImageMemory;
+    MemoryAllocation m_TextureImageMemory;
     VkImageView m_TextureImageView;
     VkSampler m_TextureSampler;
 
-    std::vector<Vertex> m_Vertices;
-
-    std::vector<uint32_t> m_Indices;
+    EncodedMesh m_Mesh;
 
     VkPipelineLayout m_GraphicsPipelineLayout;
     VkPipeline m_GraphicsPipeline;
 
     void CreateTextureImage(std::vector<std::string>);
     void CreateTextureImageView();
-    void LoadModel();
     void CreateVertexBuffer();
     void CreateIndexBuffer();
     void CreateDescriptorSetLayout();
@@ -0,0 +1,79 @@
+#include "StagingRing.h"
+
+template <class integral>
+static constexpr integral alignUp(integral x, size_t a) noexcept {
+    return integral((x + (integral(a) - 1)) & ~integral(a - 1));
+}
+
+void StagingRing::Init(VkDevice device, VkBuffer buffer, void *mapped, VkDeviceSize capacity, VkSemaphore timeline) {
+    m_Device = device;
+    m_Buffer = buffer;
+    m_Data = static_cast<uint8_t*>(mapped);
+    m_Capacity = capacity;
+    m_Timeline = timeline;
+    m_Head = 0;
+    m_Used = 0;
+    m_PendingBytes = 0;
+}
+
+void StagingRing::Cleanup() {
+    while (!m_InFlight.empty()) {
+        Retire(true);
+    }
+}
+
+void StagingRing::Retire(bool waitForOldest) {
+    if (waitForOldest && !m_InFlight.empty()) {
+        VkSemaphoreWaitInfo waitInfo = {
+            VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,                  // sType
+            nullptr,                                                // pNext
+            0,                                                      // flags
+            1,                                                      // semaphoreCount
+            &m_Timeline,                                            // pSemaphores
+            &m_InFlight.front().timelineValue                       // pValues
+        };
+        vkWaitSemaphores(m_Device, &waitInfo, UINT64_MAX);
+    }
+
+    uint64_t completed = 0;
+    vkGetSemaphoreCounterValue(m_Device, m_Timeline, &completed);
+    while (!m_InFlight.empty() && m_InFlight.front().timelineValue <= completed) {
+        m_Used -= m_InFlight.front().bytes;
+        m_InFlight.pop_front();
+    }
+}
+
+StagingRegion StagingRing::Allocate(VkDeviceSize size, VkDeviceSize alignment) {
+    if (size > m_Capacity) {
+        throw std::runtime_error("staging request larger than the ring");
+    }
+
+    VkDeviceSize start = alignUp(m_Head, alignment);
+    if (start + size > m_Capacity) {
+        // the tail end of the buffer is too short, skip it and continue from the beginning
+        start = 0;
+    }
+    VkDeviceSize total = (start >= m_Head ? start - m_Head : m_Capacity - m_Head) + size;
+
+    Retire(false);
+    while (m_Used + total > m_Capacity) {
+        if (m_InFlight.empty()) {
+            throw std::runtime_error("staging ring is full of unsubmitted uploads");
+        }
+        Retire(true);
+    }
+
+    m_Head = start + size;
+    m_Used += total;
+    m_PendingBytes += total;
+
+    return { m_Buffer, start, m_Data + start };
+}
+
+void StagingRing::Flush(uint64_t timelineValue) {
+    if (m_PendingBytes == 0) {
+        return;
+    }
+    m_InFlight.push_back({ timelineValue, m_PendingBytes });
+    m_PendingBytes = 0;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "CommonHeaders.h"
+#include "MemoryAllocator.h"
+#include <deque>
+
+struct StagingRegion {
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    void *data;
+};
+
+// Persistently mapped upload buffer used as a FIFO. Regions handed out since the last Flush()
+// belong to the submission signalling the given timeline value and are recycled once the
+// timeline semaphore reaches it. A single request may not exceed the capacity, larger
+// uploads are split by the caller.
+class StagingRing {
+private:
+    struct Submission {
+        uint64_t timelineValue;
+        VkDeviceSize bytes;
+    };
+
+    VkDevice m_Device = VK_NULL_HANDLE;
+    VkSemaphore m_Timeline = VK_NULL_HANDLE;
+    VkBuffer m_Buffer = VK_NULL_HANDLE;
+    uint8_t *m_Data = nullptr;
+    VkDeviceSize m_Capacity = 0;
+
+    VkDeviceSize m_Head = 0;
+    VkDeviceSize m_Used = 0;
+    VkDeviceSize m_PendingBytes = 0;
+
+    std::deque<Submission> m_InFlight;
+
+    void Retire(bool waitForOldest);
+
+public:
+    void Init(VkDevice device, VkBuffer buffer, void *mapped, VkDeviceSize capacity, VkSemaphore timeline);
+    void Cleanup();
+
+    StagingRegion Allocate(VkDeviceSize size, VkDeviceSize alignment);
+    void Flush(uint64_t timelineValue);
+
+    VkDeviceSize GetCapacity() { return m_Capacity; }
+    VkDeviceSize GetPendingSize() { return m_PendingBytes; }
+};
@@ -0,0 +1,90 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+ThreadPool *ThreadPool::m_Instance = nullptr;
+std::mutex ThreadPool::m_Mutex;
+
+ThreadPool *ThreadPool::GetInstance() {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (!m_Instance) {
+        // the thread calling Wait or ParallelFor works too, so one core is left for it
+        m_Instance = new ThreadPool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    }
+    return m_Instance;
+}
+
+ThreadPool::ThreadPool(uint32_t workerCount) {
+    for (uint32_t i = 0; i < workerCount; ++i) {
+        m_Workers.emplace_back([this]() {
+            while (true) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(m_QueueMutex);
+                    m_Condition.wait(lock, [this]() { return m_Stop || !m_Tasks.empty(); });
+                    if (m_Stop && m_Tasks.empty()) {
+                        return;
+                    }
+                    task = std::move(m_Tasks.front());
+                    m_Tasks.pop_front();
+                }
+                task();
+            }
+        });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_QueueMutex);
+        m_Stop = true;
+    }
+    m_Condition.notify_all();
+    for (auto &worker : m_Workers) {
+        worker.join();
+    }
+}
+
+bool ThreadPool::RunPendingTask() {
+    std::function<void()> task;
+    {
+        std::lock_guard<std::mutex> lock(m_QueueMutex);
+        if (m_Tasks.empty()) {
+            return false;
+        }
+        task = std::move(m_Tasks.back());
+        m_Tasks.pop_back();
+    }
+    task();
+    return true;
+}
+
+void ThreadPool::ParallelFor(uint32_t count, const std::function<void(uint32_t)> &body) {
+    if (count == 0) {
+        return;
+    }
+
+    std::vector<std::future<void>> futures;
+    futures.reserve(count - 1);
+    for (uint32_t i = 1; i < count; ++i) {
+        futures.push_back(Submit([&body, i]() { body(i); }));
+    }
+
+    std::exception_ptr error;
+    try {
+        body(0);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    for (auto &future : futures) {
+        try {
+            Wait(future);
+        } catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Shared worker threads for CPU side loading work. A thread waiting for a task it submitted runs queued
+// tasks meanwhile, so tasks may submit and wait for other tasks (e.g. per file loads that parse in chunks).
+class ThreadPool {
+private:
+    static ThreadPool *m_Instance;
+    static std::mutex m_Mutex;
+
+    std::vector<std::thread> m_Workers;
+    std::deque<std::function<void()>> m_Tasks;
+    std::mutex m_QueueMutex;
+    std::condition_variable m_Condition;
+    bool m_Stop = false;
+
+    explicit ThreadPool(uint32_t workerCount);
+    bool RunPendingTask();
+
+public:
+    ~ThreadPool();
+    ThreadPool(ThreadPool &other) = delete;
+    void operator=(ThreadPool &other) = delete;
+
+    static ThreadPool *GetInstance();
+
+    // threads that execute tasks, including the waiting caller
+    uint32_t GetThreadCount() { return static_cast<uint32_t>(m_Workers.size()) + 1; }
+
+    template <class F>
+    auto Submit(F &&task) -> std::future<decltype(task())> {
+        auto packaged = std::make_shared<std::packaged_task<decltype(task())()>>(std::forward<F>(task));
+        std::future<decltype(task())> result = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(m_QueueMutex);
+            m_Tasks.emplace_back([packaged]() { (*packaged)(); });
+        }
+        m_Condition.notify_one();
+        return result;
+    }
+
+    template <class T>
+    T Wait(std::future<T> &future) {
+        while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            if (!RunPendingTask()) {
+                future.wait_for(std::chrono::microseconds(100));
+            }
+        }
+        return future.get();
+    }
+
+    // runs body(0..count-1), item 0 on the calling thread; the first exception is rethrown after all items finished
+    void ParallelFor(uint32_t count, const std::function<void(uint32_t)> &body);
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "CommonHeaders.h"
+#include <cstring>
 
 struct UniformBufferObject {
     glm::mat4 model;
@@ -12,6 +13,7 @@ struct RtUniformBufferObject {
     glm::mat4 viewProj;
     glm::mat4 viewInverse;
     glm::mat4 projInverse;
+    glm::mat4 prevViewProj;                                 // reprojects primary hits for the denoiser
 };
 
 struct LightsPositions {
@@ -25,49 +27,53 @@ struct Vertex {
     glm::vec3 normal;
     glm::vec2 texCoord;
 
-    static VkVertexInputBindingDescription GetBindingDescription() {
-        return {
-            0,                                                      // binding
-            sizeof(Vertex),                                         // stride
-            VK_VERTEX_INPUT_RATE_VERTEX                             // inputRate
-        };
+    bool operator==(const Vertex& other) const {
+        return pos == other.pos && normal == other.normal && texCoord == other.texCoord;
     }
+};
+
+static_assert(sizeof(Vertex) == 8 * sizeof(uint32_t), "Vertex is hashed as eight packed floats");
 
-    static std::array<VkVertexInputAttributeDescription, 3> GetAttributeDescription() {
-        std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions = {};
-        attributeDescriptions[0] = {
-            0,                                                      // location
-            0,                                                      // binding
-            VK_FORMAT_R32G32B32_SFLOAT,                             // format
-            0                                                       // offset
-        };
-        attributeDescriptions[1] = {
-            1,                                                      // location
-            0,                                                      // binding
-            VK_FORMAT_R32G32B32_SFLOAT,                             // format
-            offsetof(Vertex, normal)                                // offset
-        };
-        attributeDescriptions[2] = {
-            2,                                                      // location
-            0,                                                      // binding
-            VK_FORMAT_R32G32_SFLOAT,                                // format
-            offsetof(Vertex, texCoord)                              // offset
-        };
-        return attributeDescriptions;
+// raw bits of a vertex with -0 folded into +0, vertices that compare equal have equal keys
+struct VertexKey {
+    uint32_t bits[8];
+
+    explicit VertexKey(const Vertex &vertex) {
+        std::memcpy(bits, &vertex, sizeof(bits));
+        for (uint32_t &word : bits) {
+            if ((word << 1) == 0) {
+                word = 0;
+            }
+        }
     }
 
-    bool operator==(const Vertex& other) const {
-        return pos == other.pos && normal == other.normal && texCoord == other.texCoord;
+    bool operator==(const VertexKey &other) const {
+        return std::memcmp(bits, other.bits, sizeof(bits)) == 0;
+    }
+
+    // every word goes through a full 64 bit finalizer, so nearby coordinates do not cluster in the low bits
+    uint64_t Hash() const {
+        uint64_t hash = 0x9e3779b97f4a7c15ull;
+        for (uint32_t i = 0; i < 8; i += 2) {
+            hash = (hash ^ Mix(static_cast<uint64_t>(bits[i]) | static_cast<uint64_t>(bits[i + 1]) << 32)) * 0xff51afd7ed558ccdull;
+        }
+        return Mix(hash);
+    }
+
+    static uint64_t Mix(uint64_t value) {
+        value ^= value >> 33;
+        value *= 0xff51afd7ed558ccdull;
+        value ^= value >> 33;
+        value *= 0xc4ceb9fe1a85ec53ull;
+        value ^= value >> 33;
+        return value;
     }
 };
 
 namespace std {
     template<> struct hash<Vertex> {
         size_t operator()(Vertex const& vertex) const {
-            return ((hash<glm::vec3>()(vertex.pos) ^
-                (hash<glm::vec3>()(vertex.normal) << 1)) >> 1) ^
-                (hash<glm::vec2>()(vertex.texCoord) << 1);
+            return static_cast<size_t>(VertexKey(vertex).Hash());
         }
     };
 }
-
@@ -0,0 +1,91 @@
+#include "VertexFormat.h"
+#include <glm/gtc/packing.hpp>
+#include <cmath>
+
+namespace {
+
+// octahedral mapping onto [-1, 1]^2, a zero vector maps to +z
+glm::vec2 OctEncode(glm::vec3 normal) {
+    float sum = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    if (sum == 0.0f) {
+        return glm::vec2(0.0f);
+    }
+    normal /= sum;
+    glm::vec2 encoded(normal.x, normal.y);
+    if (normal.z < 0.0f) {
+        encoded.x = (1.0f - std::abs(normal.y)) * (normal.x >= 0.0f ? 1.0f : -1.0f);
+        encoded.y = (1.0f - std::abs(normal.x)) * (normal.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return encoded;
+}
+
+}
+
+Quantization Quantization::FromBounds(const std::vector<Vertex> &vertices) {
+    if (vertices.empty()) {
+        return { glm::vec3(0.0f), glm::vec3(1.0f) };
+    }
+
+    glm::vec3 boundsMin = vertices[0].pos;
+    glm::vec3 boundsMax = vertices[0].pos;
+    for (const auto &vertex : vertices) {
+        boundsMin = glm::min(boundsMin, vertex.pos);
+        boundsMax = glm::max(boundsMax, vertex.pos);
+    }
+
+    // a flat mesh still needs an invertible dequantization, its normal matrix is built from it
+    glm::vec3 halfExtent = (boundsMax - boundsMin) * 0.5f;
+    float minExtent = std::max(std::max(halfExtent.x, halfExtent.y), halfExtent.z) * 1e-6f + 1e-30f;
+    return { (boundsMin + boundsMax) * 0.5f, glm::max(halfExtent, glm::vec3(minExtent)) };
+}
+
+glm::mat4 Quantization::GetDequantizeMatrix() const {
+    return glm::scale(glm::translate(glm::mat4(1.0f), center), halfExtent);
+}
+
+PackedVertex::Position VertexFormat<PackedVertex>::EncodePosition(const Vertex &vertex, const Quantization &quantization) {
+    PackedVertex::Position packed{};
+    glm::vec3 position = (vertex.pos - quantization.center) / quantization.halfExtent;
+    for (uint32_t i = 0; i < 3; ++i) {
+        packed.pos[i] = static_cast<int16_t>(glm::packSnorm1x16(position[i]));
+    }
+    return packed;
+}
+
+PackedVertex::Attributes VertexFormat<PackedVertex>::EncodeAttributes(const Vertex &vertex, const Quantization &quantization) {
+    PackedVertex::Attributes packed{};
+    // normals are covectors, going into the quantized space they scale with the extent instead of its inverse
+    glm::vec2 normal = OctEncode(vertex.normal * quantization.halfExtent);
+    packed.normal[0] = static_cast<int16_t>(glm::packSnorm1x16(normal.x));
+    packed.normal[1] = static_cast<int16_t>(glm::packSnorm1x16(normal.y));
+
+    packed.texCoord[0] = glm::packHalf1x16(vertex.texCoord.x);
+    packed.texCoord[1] = glm::packHalf1x16(vertex.texCoord.y);
+    return packed;
+}
+
+uint32_t EncodedMesh::SelectLod(const glm::mat4 &modelView, float pixelsPerUnit, float maxPixelError) const {
+    glm::vec3 center = glm::vec3(modelView * glm::vec4(glm::vec3(boundingSphere), 1.0f));
+    float scale = std::max(std::max(glm::length(glm::vec3(modelView[0])), glm::length(glm::vec3(modelView[1]))), glm::length(glm::vec3(modelView[2])));
+    float distance = glm::length(center) - boundingSphere.w * scale;
+    if (distance <= 0.0f || scale == 0.0f) {
+        return 0;
+    }
+
+    // model units a pixel covers at the nearest point of the bounds
+    float pixelSize = distance / (pixelsPerUnit * scale);
+    uint32_t lod = 0;
+    while (lod + 1 < lods.size() && lods[lod + 1].error <= pixelSize * maxPixelError) {
+        ++lod;
+    }
+    return lod;
+}
+
+EncodedMesh EncodeMesh(const Mesh &mesh, VertexEncoding encoding) {
+    switch (encoding) {
+    case VertexEncoding::Packed:
+        return EncodeMesh<PackedVertex>(mesh);
+    default:
+        return EncodeMesh<Vertex>(mesh);
+    }
+}
@@ -0,0 +1,183 @@
+#pragma once
+
+#include "CommonHeaders.h"
+#include "Vertex.h"
+#include "MeshLoader.h"
+
+// Every format is stored as two streams: a tightly packed position stream (binding 0), which is all
+// BLAS builds and depth-only passes read, and the shading attributes (binding 1).
+
+// Full precision streams of a Vertex, 12 + 20 bytes.
+struct FullAttributes {
+    glm::vec3 normal;
+    glm::vec2 texCoord;
+};
+
+// 8 + 8 bytes. Positions are snorm16 inside the mesh bounds and normals are octahedral snorm16
+// expressed in that same quantized space, so rasterization folds the dequantization into the model
+// matrix and the vertex shader only undoes the octahedral mapping; BLAS builds apply it as the
+// geometry transform.
+struct PackedVertex {
+    struct Position {
+        int16_t pos[4];                                     // w unused
+    };
+    struct Attributes {
+        int16_t normal[2];
+        uint16_t texCoord[2];                               // half floats
+    };
+};
+
+enum class VertexEncoding {
+    Full,                                                   // Vertex
+    Packed                                                  // PackedVertex
+};
+
+// maps mesh positions into the [-1, 1] cube PackedVertex stores
+struct Quantization {
+    glm::vec3 center;
+    glm::vec3 halfExtent;
+
+    static Quantization FromBounds(const std::vector<Vertex> &vertices);
+    // takes stored positions to model space, goes right of the model matrix
+    glm::mat4 GetDequantizeMatrix() const;
+};
+
+template <class V> struct VertexFormat;
+
+template <> struct VertexFormat<Vertex> {
+    using Position = glm::vec3;
+    using Attributes = FullAttributes;
+
+    static constexpr VertexEncoding Encoding = VertexEncoding::Full;
+    static constexpr std::array<VkFormat, 3> Formats = { VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32_SFLOAT };
+    static constexpr std::array<uint32_t, 2> AttributeOffsets = { offsetof(FullAttributes, normal), offsetof(FullAttributes, texCoord) };
+
+    static Position EncodePosition(const Vertex &vertex, const Quantization &) { return vertex.pos; }
+    static Attributes EncodeAttributes(const Vertex &vertex, const Quantization &) { return { vertex.normal, vertex.texCoord }; }
+};
+
+template <> struct VertexFormat<PackedVertex> {
+    using Position = PackedVertex::Position;
+    using Attributes = PackedVertex::Attributes;
+
+    static constexpr VertexEncoding Encoding = VertexEncoding::Packed;
+    static constexpr std::array<VkFormat, 3> Formats = { VK_FORMAT_R16G16B16A16_SNORM, VK_FORMAT_R16G16_SNORM, VK_FORMAT_R16G16_SFLOAT };
+    static constexpr std::array<uint32_t, 2> AttributeOffsets = { offsetof(Attributes, normal), offsetof(Attributes, texCoord) };
+
+    static Position EncodePosition(const Vertex &vertex, const Quantization &quantization);
+    static Attributes EncodeAttributes(const Vertex &vertex, const Quantization &quantization);
+};
+
+// what pipelines, BLAS builds and the hit shader need to know about a vertex format
+struct VertexLayout {
+    VertexEncoding encoding;
+    std::array<VkVertexInputBindingDescription, 2> bindings;  // positions, attributes
+    std::array<VkVertexInputAttributeDescription, 3> attributes;
+
+    VkFormat GetPositionFormat() const { return attributes[0].format; }
+    uint32_t GetPositionStride() const { return bindings[0].stride; }
+    // value of the PackedVertex specialization constant (constant_id 0) of the shaders reading this layout
+    VkBool32 IsPacked() const { return encoding == VertexEncoding::Packed; }
+
+    template <class V>
+    static VertexLayout Get() {
+        VertexLayout layout{};
+        layout.encoding = VertexFormat<V>::Encoding;
+        layout.bindings[0] = {
+            0,                                                      // binding
+            sizeof(typename VertexFormat<V>::Position),             // stride
+            VK_VERTEX_INPUT_RATE_VERTEX                             // inputRate
+        };
+        layout.bindings[1] = {
+            1,                                                      // binding
+            sizeof(typename VertexFormat<V>::Attributes),           // stride
+            VK_VERTEX_INPUT_RATE_VERTEX                             // inputRate
+        };
+        layout.attributes[0] = {
+            0,                                                      // location
+            0,                                                      // binding
+            VertexFormat<V>::Formats[0],                            // format
+            0                                                       // offset
+        };
+        for (uint32_t i = 1; i < 3; ++i) {
+            layout.attributes[i] = {
+                i,                                                  // location
+                1,                                                  // binding
+                VertexFormat<V>::Formats[i],                        // format
+                VertexFormat<V>::AttributeOffsets[i - 1]            // offset
+            };
+        }
+        return layout;
+    }
+};
+
+// vertex and index data in the layout the GPU reads
+struct EncodedMesh {
+    VertexLayout layout{};
+    std::vector<uint8_t> vertexData;                        // position stream, then the attribute stream at attributeOffset
+    VkDeviceSize attributeOffset = 0;
+    std::vector<uint8_t> indexData;                         // padded to a multiple of 4 bytes
+    uint32_t vertexCount = 0;
+    uint32_t indexCount = 0;                                // every LOD
+    VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+    Quantization quantization{ glm::vec3(0.0f), glm::vec3(1.0f) };   // identity unless the positions are packed
+    std::vector<MeshLod> lods;
+    std::vector<Meshlet> meshlets;
+    glm::vec4 boundingSphere{ 0.0f };                       // model space center and radius
+
+    EncodedMesh() = default;
+    EncodedMesh(EncodedMesh &&other) = default;
+    EncodedMesh &operator=(EncodedMesh &&other) = default;
+    EncodedMesh(const EncodedMesh &other) = delete;
+    EncodedMesh &operator=(const EncodedMesh &other) = delete;
+
+    // coarsest LOD whose error stays within maxPixelError pixels anywhere on the bounding sphere; pixelsPerUnit
+    // is the projection scale at unit distance, viewport height / (2 tan(fovy / 2))
+    uint32_t SelectLod(const glm::mat4 &modelView, float pixelsPerUnit, float maxPixelError = 1.0f) const;
+};
+
+// converts vertices to the two streams of V and picks 16 bit indices when every vertex is addressable with them
+template <class V>
+EncodedMesh EncodeMesh(const Mesh &mesh) {
+    EncodedMesh encoded;
+    encoded.layout = VertexLayout::Get<V>();
+    encoded.vertexCount = static_cast<uint32_t>(mesh.vertices.size());
+    encoded.indexCount = static_cast<uint32_t>(mesh.indices.size());
+
+    encoded.lods = mesh.lods;
+    encoded.meshlets = mesh.meshlets;
+    if (encoded.lods.empty()) {
+        encoded.lods.push_back({ 0, encoded.indexCount, 0.0f, 0, 0 });
+    }
+
+    Quantization bounds = Quantization::FromBounds(mesh.vertices);
+    encoded.boundingSphere = glm::vec4(bounds.center, glm::length(bounds.halfExtent));
+    if (VertexFormat<V>::Encoding == VertexEncoding::Packed) {
+        encoded.quantization = bounds;
+    }
+    using Position = typename VertexFormat<V>::Position;
+    using Attributes = typename VertexFormat<V>::Attributes;
+    encoded.attributeOffset = (mesh.vertices.size() * sizeof(Position) + 15) & ~VkDeviceSize(15);
+    encoded.vertexData.resize(encoded.attributeOffset + mesh.vertices.size() * sizeof(Attributes), 0);
+    Position *positions = reinterpret_cast<Position*>(encoded.vertexData.data());
+    Attributes *attributes = reinterpret_cast<Attributes*>(encoded.vertexData.data() + encoded.attributeOffset);
+    for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+        positions[i] = VertexFormat<V>::EncodePosition(mesh.vertices[i], encoded.quantization);
+        attributes[i] = VertexFormat<V>::EncodeAttributes(mesh.vertices[i], encoded.quantization);
+    }
+
+    if (mesh.vertices.size() <= 0x10000) {
+        encoded.indexType = VK_INDEX_TYPE_UINT16;
+        encoded.indexData.resize((mesh.indices.size() * sizeof(uint16_t) + 3) & ~size_t(3), 0);
+        uint16_t *indices = reinterpret_cast<uint16_t*>(encoded.indexData.data());
+        for (size_t i = 0; i < mesh.indices.size(); ++i) {
+            indices[i] = static_cast<uint16_t>(mesh.indices[i]);
+        }
+    } else {
+        encoded.indexData.resize(mesh.indices.size() * sizeof(uint32_t));
+        memcpy(encoded.indexData.data(), mesh.indices.data(), encoded.indexData.size());
+    }
+    return encoded;
+}
+
+EncodedMesh EncodeMesh(const Mesh &mesh, VertexEncoding encoding);
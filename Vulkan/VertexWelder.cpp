@@ -0,0 +1,148 @@
+#include "VertexWelder.h"
+#include "ThreadPool.h"
+#include <algorithm>
+
+namespace {
+
+struct SortEntry {
+    uint64_t hash;
+    uint32_t corner;
+};
+
+// stable LSD radix sort on the 64 bit hash, 16 bits per pass; passes whose digit is the same for every entry are skipped
+void RadixSort(std::vector<SortEntry> &entries) {
+    const uint32_t DigitBits = 16;
+    const size_t BucketCount = size_t(1) << DigitBits;
+
+    std::vector<SortEntry> scratch(entries.size());
+    std::vector<size_t> offsets(BucketCount);
+    for (uint32_t shift = 0; shift < 64; shift += DigitBits) {
+        std::fill(offsets.begin(), offsets.end(), 0);
+        for (const SortEntry &entry : entries) {
+            ++offsets[(entry.hash >> shift) & (BucketCount - 1)];
+        }
+        if (offsets[(entries.front().hash >> shift) & (BucketCount - 1)] == entries.size()) {
+            continue;
+        }
+
+        size_t sum = 0;
+        for (size_t &offset : offsets) {
+            size_t count = offset;
+            offset = sum;
+            sum += count;
+        }
+        for (const SortEntry &entry : entries) {
+            scratch[offsets[(entry.hash >> shift) & (BucketCount - 1)]++] = entry;
+        }
+        entries.swap(scratch);
+    }
+}
+
+}
+
+VertexWelder::VertexWelder(std::vector<Vertex> &vertices, size_t maxNewVertices)
+    : m_Vertices(vertices), m_BaseVertex(static_cast<uint32_t>(vertices.size())) {
+    // at most half full, so probe sequences stay short even when every corner is unique
+    size_t capacity = 16;
+    while (capacity < maxNewVertices * 2) {
+        capacity *= 2;
+    }
+    m_Slots.assign(capacity, 0);
+    m_Mask = capacity - 1;
+    m_Vertices.reserve(m_Vertices.size() + maxNewVertices);
+}
+
+void VertexWelder::Grow() {
+    std::vector<uint64_t> slots(m_Slots.size() * 2, 0);
+    size_t mask = slots.size() - 1;
+    for (uint64_t entry : m_Slots) {
+        if (entry == 0) {
+            continue;
+        }
+        uint64_t hash = VertexKey(m_Vertices[m_BaseVertex + static_cast<uint32_t>(entry) - 1]).Hash();
+        size_t slot = hash & mask;
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = entry;
+    }
+    m_Slots.swap(slots);
+    m_Mask = mask;
+}
+
+uint32_t VertexWelder::Weld(const Vertex &vertex) {
+    VertexKey key(vertex);
+    uint64_t hash = key.Hash();
+    uint64_t tag = hash & 0xffffffff00000000ull;
+
+    for (size_t slot = hash & m_Mask;; slot = (slot + 1) & m_Mask) {
+        uint64_t entry = m_Slots[slot];
+        if (entry == 0) {
+            uint32_t index = static_cast<uint32_t>(m_Vertices.size());
+            m_Vertices.push_back(vertex);
+            m_Slots[slot] = tag | (index - m_BaseVertex + 1);
+            if (++m_Count * 2 > m_Slots.size()) {
+                Grow();
+            }
+            return index;
+        }
+        if ((entry & 0xffffffff00000000ull) == tag) {
+            uint32_t index = m_BaseVertex + static_cast<uint32_t>(entry) - 1;
+            if (VertexKey(m_Vertices[index]) == key) {
+                return index;
+            }
+        }
+    }
+}
+
+void VertexWelder::WeldSorted(const std::vector<Vertex> &corners, std::vector<Vertex> &vertices, std::vector<uint32_t> &indices) {
+    if (corners.empty()) {
+        return;
+    }
+    uint32_t cornerCount = static_cast<uint32_t>(corners.size());
+
+    std::vector<SortEntry> entries(cornerCount);
+    uint32_t chunkCount = ThreadPool::GetInstance()->GetThreadCount();
+    uint32_t chunkSize = (cornerCount + chunkCount - 1) / chunkCount;
+    ThreadPool::GetInstance()->ParallelFor(chunkCount, [&](uint32_t chunk) {
+        uint32_t end = std::min(cornerCount, (chunk + 1) * chunkSize);
+        for (uint32_t corner = chunk * chunkSize; corner < end; ++corner) {
+            entries[corner] = { VertexKey(corners[corner]).Hash(), corner };
+        }
+    });
+    RadixSort(entries);
+
+    // the sort is stable, so the first corner of a run is the first occurrence of its vertex;
+    // a run with colliding hashes is split by comparing against the distinct vertices seen in it
+    std::vector<uint32_t> firstCorner(cornerCount);
+    std::vector<uint32_t> runFirsts;
+    for (uint32_t begin = 0, end = 0; begin < cornerCount; begin = end) {
+        end = begin + 1;
+        while (end < cornerCount && entries[end].hash == entries[begin].hash) {
+            ++end;
+        }
+        runFirsts.clear();
+        for (uint32_t i = begin; i < end; ++i) {
+            uint32_t corner = entries[i].corner;
+            VertexKey key(corners[corner]);
+            auto match = std::find_if(runFirsts.begin(), runFirsts.end(), [&](uint32_t first) { return VertexKey(corners[first]) == key; });
+            if (match == runFirsts.end()) {
+                runFirsts.push_back(corner);
+                firstCorner[corner] = corner;
+            } else {
+                firstCorner[corner] = *match;
+            }
+        }
+    }
+
+    // walking the corners in order numbers the vertices exactly like Weld would
+    std::vector<uint32_t> vertexIndex(cornerCount);
+    indices.reserve(indices.size() + cornerCount);
+    for (uint32_t corner = 0; corner < cornerCount; ++corner) {
+        if (firstCorner[corner] == corner) {
+            vertexIndex[corner] = static_cast<uint32_t>(vertices.size());
+            vertices.push_back(corners[corner]);
+        }
+        indices.push_back(vertexIndex[firstCorner[corner]]);
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "CommonHeaders.h"
+#include "Vertex.h"
+
+// Merges bit identical vertices (+0 and -0 count as equal) while a mesh is built.
+// Open addressing table with linear probing; every slot keeps the upper hash bits next to the
+// vertex index so most probes are rejected without touching the vertex array.
+class VertexWelder {
+private:
+    std::vector<Vertex> &m_Vertices;
+    uint32_t m_BaseVertex;
+    std::vector<uint64_t> m_Slots;                          // (hash >> 32) << 32 | (local index + 1), 0 when empty
+    size_t m_Mask;
+    size_t m_Count = 0;
+
+    void Grow();
+
+public:
+    // meshes with at least this many corners are better served by WeldSorted, the table no longer fits in cache
+    static constexpr size_t SortThreshold = 4u * 1024 * 1024;
+
+    // welded vertices are appended to vertices, maxNewVertices (the corner count) sizes the table up front
+    VertexWelder(std::vector<Vertex> &vertices, size_t maxNewVertices);
+
+    // index of the vertex in the vertices array, appended if it was not seen before
+    uint32_t Weld(const Vertex &vertex);
+
+    // same result as calling Weld for every corner in order, but built from a radix sort of the corner hashes
+    static void WeldSorted(const std::vector<Vertex> &corners, std::vector<Vertex> &vertices, std::vector<uint32_t> &indices);
+};
@@ -1,8 +1,16 @@
 #include "VulkanFactory.h"
+#include "BlasCache.h"
+#include "ThreadPool.h"
+#include <algorithm>
 
 VulkanFactory* VulkanFactory::m_Instance = nullptr;
 std::mutex VulkanFactory::m_Mutex;
 
+template <class integral>
+constexpr integral alignUp(integral x, size_t a) noexcept {
+    return integral((x + (integral(a) - 1)) & ~integral(a - 1));
+}
+
 VulkanFactory::~VulkanFactory() {
     CleanupSwapChain();
 
@@ -20,14 +28,8 @@ VulkanFactory::~VulkanFactory() {
 
 void VulkanFactory::InitVulkan(GLFWwindow* window) {
     m_Window = window;
-    CreateVkInstance();
-    if (glfwCreateWindowSurface(m_VkInstance, m_Window, nullptr, &m_Surface) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create window surface");
-    }
-    vkEnumeratePhysicalDeviceQueueFamilyPerformanceQueryCountersKHR = reinterpret_cast<PFN_vkEnumeratePhysicalDeviceQueueFamilyPerformanceQueryCountersKHR>(vkGetInstanceProcAddr(m_VkInstance, "vkEnumeratePhysicalDeviceQueueFamilyPerformanceQueryCountersKHR"));
-    PickPhysicalDevice();
-    CreateLogicalDevice();
-    QueryFunctionPointers();
+    m_Headless = false;
+    InitDevice();
     CreateSwapChain();
     CreateSwapchainImageViews();
     CreateCommandPool();
@@ -37,6 +39,79 @@ void VulkanFactory::InitVulkan(GLFWwindow* window) {
     CreateSemaphores();
 }
 
+void VulkanFactory::InitVulkanHeadless(uint32_t width, uint32_t height, uint32_t frameCount) {
+    m_Window = nullptr;
+    m_Headless = true;
+    m_HeadlessFrameCount = frameCount;
+    m_SwapChainExtent = { width, height };
+    InitDevice();
+    CreateHeadlessImages();
+    CreateSwapchainImageViews();
+    CreateCommandPool();
+    CreateDepthResources();
+    CreateRenderPass();
+    CreateFramebuffers();
+    CreateSemaphores();
+}
+
+void VulkanFactory::InitDevice() {
+    m_DeviceExtensions.clear();
+    for (const auto& ext : deviceExtensions) {
+        // without a window there is nothing to present to
+        if (m_Headless && !strcmp(ext, VK_KHR_SWAPCHAIN_EXTENSION_NAME)) {
+            continue;
+        }
+        m_DeviceExtensions.push_back(ext);
+    }
+
+    CreateVkInstance();
+    if (!m_Headless && glfwCreateWindowSurface(m_VkInstance, m_Window, nullptr, &m_Surface) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create window surface");
+    }
+    vkEnumeratePhysicalDeviceQueueFamilyPerformanceQueryCountersKHR = reinterpret_cast<PFN_vkEnumeratePhysicalDeviceQueueFamilyPerformanceQueryCountersKHR>(vkGetInstanceProcAddr(m_VkInstance, "vkEnumeratePhysicalDeviceQueueFamilyPerformanceQueryCountersKHR"));
+    PickPhysicalDevice();
+    CreateLogicalDevice();
+    m_Allocator.Init(m_PhysicalDevice, m_Device);
+    QueryFunctionPointers();
+    CreateUploadContext();
+    CreateStagingRing();
+}
+
+void VulkanFactory::CreateUploadContext() {
+    VkCommandPoolCreateInfo poolCreateInfo = {
+        VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,                 // sType
+        nullptr,                                                    // pNext
+        VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+        VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,            // flags
+        m_QueueFamilyIndice.value()                                 // queueFamilyIndex
+    };
+    if (vkCreateCommandPool(m_Device, &poolCreateInfo, nullptr, &m_UploadCommandPool) != VK_SUCCESS) {
+        throw std::runtime_error("cannot create upload command pool");
+    }
+
+    VkSemaphoreTypeCreateInfo typeCreateInfo = {
+        VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,               // sType
+        nullptr,                                                    // pNext
+        VK_SEMAPHORE_TYPE_TIMELINE,                                 // semaphoreType
+        0                                                           // initialValue
+    };
+    VkSemaphoreCreateInfo semaphoreCreateInfo = {
+        VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,                    // sType
+        &typeCreateInfo,                                            // pNext
+        0                                                           // flags
+    };
+    if (vkCreateSemaphore(m_Device, &semaphoreCreateInfo, nullptr, &m_UploadTimeline) != VK_SUCCESS) {
+        throw std::runtime_error("cannot create upload timeline semaphore");
+    }
+    m_UploadTicket = 0;
+}
+
+void VulkanFactory::CreateStagingRing() {
+    CreateBuffer(StagingRingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        m_StagingBuffer, m_StagingMemory);
+    m_StagingRing.Init(m_Device, m_StagingBuffer, MapMemory(m_StagingMemory), StagingRingSize, m_UploadTimeline);
+}
+
 void VulkanFactory::CreateVkInstance() {
     VkApplicationInfo appInfo = {
         VK_STRUCTURE_TYPE_APPLICATION_INFO,                         // sType
@@ -49,9 +124,11 @@ void VulkanFactory::CreateVkInstance() {
     };
 
     uint32_t glfwExtensionCount = 0;
-    const char** glfwExtensions;
+    const char** glfwExtensions = nullptr;
 
-    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    if (!m_Headless) {
+        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    }
 
     uint32_t extensionsCount = 0;
     vkEnumerateInstanceExtensionProperties(nullptr, &extensionsCount, nullptr);
@@ -217,6 +294,18 @@ void VulkanFactory::CreateSwapChain() {
     m_SwapChainImageFormat = surfaceFormat.format;
 }
 
+void VulkanFactory::CreateHeadlessImages() {
+    // stands in for the swapchain: a ring of images the frame loop renders into and that can be read back
+    m_SwapChainImageFormat = VK_FORMAT_B8G8R8A8_SRGB;
+    m_SwapChainImages.resize(m_HeadlessFrameCount);
+    m_HeadlessImageMemory.resize(m_HeadlessFrameCount);
+    for (uint32_t i = 0; i < m_HeadlessFrameCount; ++i) {
+        CreateImage(m_SwapChainExtent.width, m_SwapChainExtent.height, 1, m_SwapChainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            m_SwapChainImages[i], m_HeadlessImageMemory[i], 1);
+    }
+}
+
 void VulkanFactory::PickPhysicalDevice() {
     uint32_t deviceCount = 0;
     vkEnumeratePhysicalDevices(m_VkInstance, &deviceCount, nullptr);
@@ -241,7 +330,9 @@ void VulkanFactory::PickPhysicalDevice() {
         uint32_t i = 0;
         for (const auto& queue : queueFamilies) {
             VkBool32 presentSupport = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, m_Surface, &presentSupport);
+            if (!m_Headless) {
+                vkGetPhysicalDeviceSurfaceSupportKHR(device, i, m_Surface, &presentSupport);
+            }
             if (queue.queueFlags & VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT && queue.timestampValidBits > 0) {
                 indices = i;
                 break;
@@ -271,7 +362,7 @@ void VulkanFactory::PickPhysicalDevice() {
         };
         vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures2);
 
-        std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+        std::set<std::string> requiredExtensions(m_DeviceExtensions.begin(), m_DeviceExtensions.end());
 
         for (const auto& ext : extProperties) {
             requiredExtensions.erase(ext.extensionName);
@@ -280,6 +371,8 @@ void VulkanFactory::PickPhysicalDevice() {
         bool swapchainGood = false;
         if (!requiredExtensions.empty()) {
             return false;
+        } else if (m_Headless) {
+            swapchainGood = true;
         } else {
             SwapChainSupportDetails swapChainSupport = QuerySwapChainSupport(physicalDevice);
             swapchainGood = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
@@ -342,12 +435,19 @@ void VulkanFactory::CreateLogicalDevice() {
     VkPhysicalDeviceVulkan12Features vk12features{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
     vk12features.bufferDeviceAddress = VK_TRUE;
     vk12features.hostQueryReset = VK_TRUE;
+    vk12features.timelineSemaphore = VK_TRUE;
 
     VkPhysicalDeviceRayTracingPipelineFeaturesKHR rtPipelineFeatures{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR };
     rtPipelineFeatures.rayTracingPipeline = VK_TRUE;
 
+    VkPhysicalDeviceAccelerationStructureFeaturesKHR supportedAsFeatures{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR };
+    VkPhysicalDeviceFeatures2 supportedFeatures{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2, &supportedAsFeatures };
+    vkGetPhysicalDeviceFeatures2(m_PhysicalDevice, &supportedFeatures);
+    m_HostAsBuilds = supportedAsFeatures.accelerationStructureHostCommands == VK_TRUE;
+
     VkPhysicalDeviceAccelerationStructureFeaturesKHR asFeature{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR };
     asFeature.accelerationStructure = VK_TRUE;
+    asFeature.accelerationStructureHostCommands = m_HostAsBuilds ? VK_TRUE : VK_FALSE;
 
     vk12features.pNext = &rtPipelineFeatures;
     rtPipelineFeatures.pNext = &asFeature;
@@ -360,8 +460,8 @@ void VulkanFactory::CreateLogicalDevice() {
         &deviceQueueCreateInfo,                                     // pQueueCreateInfos
         (uint32_t)validationLayers.size(),                          // enabledLayerCount
         validationLayers.data(),                                    // ppEnabledLayerNames
-        (uint32_t)deviceExtensions.size(),                          // enabledExtensionCount
-        deviceExtensions.data(),                                    // ppEnabledExtensionNames
+        (uint32_t)m_DeviceExtensions.size(),                        // enabledExtensionCount
+        m_DeviceExtensions.data(),                                  // ppEnabledExtensionNames
         &deviceFeatures                                             // pEnabledFeatures
     };
 
@@ -374,6 +474,19 @@ void VulkanFactory::QueryFunctionPointers() {
     vkGetAccelerationStructureBuildSizesKHR = reinterpret_cast<PFN_vkGetAccelerationStructureBuildSizesKHR>(vkGetDeviceProcAddr(m_Device, "vkGetAccelerationStructureBuildSizesKHR"));
     vkCmdBuildAccelerationStructuresKHR = reinterpret_cast<PFN_vkCmdBuildAccelerationStructuresKHR>(vkGetDeviceProcAddr(m_Device, "vkCmdBuildAccelerationStructuresKHR"));
     vkCreateAccelerationStructureKHR = reinterpret_cast<PFN_vkCreateAccelerationStructureKHR>(vkGetDeviceProcAddr(m_Device, "vkCreateAccelerationStructureKHR"));
+    vkDestroyAccelerationStructureKHR = reinterpret_cast<PFN_vkDestroyAccelerationStructureKHR>(vkGetDeviceProcAddr(m_Device, "vkDestroyAccelerationStructureKHR"));
+    vkCmdWriteAccelerationStructuresPropertiesKHR = reinterpret_cast<PFN_vkCmdWriteAccelerationStructuresPropertiesKHR>(vkGetDeviceProcAddr(m_Device, "vkCmdWriteAccelerationStructuresPropertiesKHR"));
+    vkCmdCopyAccelerationStructureKHR = reinterpret_cast<PFN_vkCmdCopyAccelerationStructureKHR>(vkGetDeviceProcAddr(m_Device, "vkCmdCopyAccelerationStructureKHR"));
+    vkCmdCopyAccelerationStructureToMemoryKHR = reinterpret_cast<PFN_vkCmdCopyAccelerationStructureToMemoryKHR>(vkGetDeviceProcAddr(m_Device, "vkCmdCopyAccelerationStructureToMemoryKHR"));
+    vkCmdCopyMemoryToAccelerationStructureKHR = reinterpret_cast<PFN_vkCmdCopyMemoryToAccelerationStructureKHR>(vkGetDeviceProcAddr(m_Device, "vkCmdCopyMemoryToAccelerationStructureKHR"));
+    vkGetDeviceAccelerationStructureCompatibilityKHR = reinterpret_cast<PFN_vkGetDeviceAccelerationStructureCompatibilityKHR>(vkGetDeviceProcAddr(m_Device, "vkGetDeviceAccelerationStructureCompatibilityKHR"));
+    vkBuildAccelerationStructuresKHR = reinterpret_cast<PFN_vkBuildAccelerationStructuresKHR>(vkGetDeviceProcAddr(m_Device, "vkBuildAccelerationStructuresKHR"));
+    vkWriteAccelerationStructuresPropertiesKHR = reinterpret_cast<PFN_vkWriteAccelerationStructuresPropertiesKHR>(vkGetDeviceProcAddr(m_Device, "vkWriteAccelerationStructuresPropertiesKHR"));
+    vkCreateDeferredOperationKHR = reinterpret_cast<PFN_vkCreateDeferredOperationKHR>(vkGetDeviceProcAddr(m_Device, "vkCreateDeferredOperationKHR"));
+    vkDestroyDeferredOperationKHR = reinterpret_cast<PFN_vkDestroyDeferredOperationKHR>(vkGetDeviceProcAddr(m_Device, "vkDestroyDeferredOperationKHR"));
+    vkGetDeferredOperationMaxConcurrencyKHR = reinterpret_cast<PFN_vkGetDeferredOperationMaxConcurrencyKHR>(vkGetDeviceProcAddr(m_Device, "vkGetDeferredOperationMaxConcurrencyKHR"));
+    vkGetDeferredOperationResultKHR = reinterpret_cast<PFN_vkGetDeferredOperationResultKHR>(vkGetDeviceProcAddr(m_Device, "vkGetDeferredOperationResultKHR"));
+    vkDeferredOperationJoinKHR = reinterpret_cast<PFN_vkDeferredOperationJoinKHR>(vkGetDeviceProcAddr(m_Device, "vkDeferredOperationJoinKHR"));
     vkGetRayTracingShaderGroupHandlesKHR = reinterpret_cast<PFN_vkGetRayTracingShaderGroupHandlesKHR>(vkGetDeviceProcAddr(m_Device, "vkGetRayTracingShaderGroupHandlesKHR"));
     vkCmdTraceRaysKHR = reinterpret_cast<PFN_vkCmdTraceRaysKHR>(vkGetDeviceProcAddr(m_Device, "vkCmdTraceRaysKHR"));
     vkGetAccelerationStructureDeviceAddressKHR = reinterpret_cast<PFN_vkGetAccelerationStructureDeviceAddressKHR>(vkGetDeviceProcAddr(m_Device, "vkGetAccelerationStructureDeviceAddressKHR"));
@@ -381,6 +494,9 @@ void VulkanFactory::QueryFunctionPointers() {
 }
 
 void VulkanFactory::RecreateSwapChain() {
+    if (m_Headless) {
+        return;
+    }
     vkDeviceWaitIdle(m_Device);
 
     CleanupSwapChain();
@@ -397,7 +513,7 @@ void VulkanFactory::CleanupSwapChain() {
     vkDeviceWaitIdle(m_Device);
     vkDestroyImageView(m_Device, m_DepthImageView, nullptr);
     vkDestroyImage(m_Device, m_DepthImage, nullptr);
-    vkFreeMemory(m_Device, m_DepthImageMemory, nullptr);
+    m_Allocator.Free(m_DepthImageMemory);
 
     for (auto framebuffer : m_SwapChainFramebuffers) {
         vkDestroyFramebuffer(m_Device, framebuffer, nullptr);
@@ -409,7 +525,16 @@ void VulkanFactory::CleanupSwapChain() {
     for (auto imgView : m_SwapChainImageViews) {
         vkDestroyImageView(m_Device, imgView, nullptr);
     }
-    vkDestroySwapchainKHR(m_Device, m_SwapChain, nullptr);
+    if (m_Headless) {
+        for (uint32_t i = 0; i < m_SwapChainImages.size(); ++i) {
+            vkDestroyImage(m_Device, m_SwapChainImages[i], nullptr);
+            m_Allocator.Free(m_HeadlessImageMemory[i]);
+        }
+        m_SwapChainImages.clear();
+        m_HeadlessImageMemory.clear();
+    } else {
+        vkDestroySwapchainKHR(m_Device, m_SwapChain, nullptr);
+    }
 }
 
 VkImageView VulkanFactory::CreateImageView(VkImage img, VkFormat format, VkImageAspectFlags aspectMask, VkImageViewType viewType, uint32_t facesCount, uint32_t mipLevels) {
@@ -451,7 +576,8 @@ void VulkanFactory::CreateRenderPass() {
         VK_ATTACHMENT_LOAD_OP_DONT_CARE,                            // stencilLoadOp
         VK_ATTACHMENT_STORE_OP_DONT_CARE,                           // stencilStoreOp
         VK_IMAGE_LAYOUT_UNDEFINED,                                  // initialLayout
-        VK_IMAGE_LAYOUT_PRESENT_SRC_KHR                             // finalLayout
+        m_Headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL :
+                     VK_IMAGE_LAYOUT_PRESENT_SRC_KHR                // finalLayout
     };
 
     VkAttachmentReference colorAttachmentReference = {
@@ -538,7 +664,7 @@ void VulkanFactory::CreateDepthResources(){
 void VulkanFactory::CreateImage(uint32_t width, uint32_t height, uint32_t depth, VkFormat format,
     VkImageTiling tiling, VkImageUsageFlags usage,
     VkMemoryPropertyFlags properties, VkImage& img,
-    VkDeviceMemory& imgMem, uint32_t arrayLayers, uint32_t flags, uint32_t mipLevels) {
+    MemoryAllocation& imgMem, uint32_t arrayLayers, uint32_t flags, uint32_t mipLevels) {
     VkImageCreateInfo createInfo = {
         VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,                        // sType
         nullptr,                                                    // pNext
@@ -559,38 +685,22 @@ void VulkanFactory::CreateImage(uint32_t width, uint32_t height, uint32_t depth,
 
     vkCreateImage(m_Device, &createInfo, nullptr, &img);
 
-    VkMemoryRequirements memRequirements;
-    vkGetImageMemoryRequirements(m_Device, img, &memRequirements);
-
-    auto findMemoryType = [&](uint32_t typeFilter, VkMemoryPropertyFlags properties) {
-        VkPhysicalDeviceMemoryProperties memProperties;
-        vkGetPhysicalDeviceMemoryProperties(m_PhysicalDevice, &memProperties);
-
-        for (uint32_t i = 0; i < memProperties.memoryTypeCount; ++i) {
-            if (typeFilter & (1 << i) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-                return i;
-            }
-        }
-        throw std::runtime_error("cannot find suitable memory type");
-    };
-
-    VkMemoryAllocateInfo memAllocateInfo = {
-        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,                     // sType
-        nullptr,                                                    // pNext
-        memRequirements.size,                                       // allocationSize
-        findMemoryType(memRequirements.memoryTypeBits,
-                        properties)                                 // memoryTypeIndex
-    };
+    VkMemoryDedicatedRequirements dedicatedRequirements{ VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS };
+    VkMemoryRequirements2 memRequirements{ VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2, &dedicatedRequirements };
+    VkImageMemoryRequirementsInfo2 requirementsInfo{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2, nullptr, img };
+    vkGetImageMemoryRequirements2(m_Device, &requirementsInfo, &memRequirements);
 
-    if (vkAllocateMemory(m_Device, &memAllocateInfo, nullptr, &imgMem) != VK_SUCCESS) {
-        throw std::runtime_error("cannot allocate memory for texture");
-    }
+    // render targets and storage images get their own allocation, drivers may place those in faster memory
+    bool dedicated = dedicatedRequirements.prefersDedicatedAllocation || dedicatedRequirements.requiresDedicatedAllocation ||
+        (usage & (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT));
+    imgMem = m_Allocator.Allocate(memRequirements.memoryRequirements, properties, tiling == VK_IMAGE_TILING_LINEAR,
+        dedicated, VK_NULL_HANDLE, img);
 
-    vkBindImageMemory(m_Device, img, imgMem, 0);
+    vkBindImageMemory(m_Device, img, imgMem.memory, imgMem.offset);
 }
 
 void VulkanFactory::GenerateMipMaps(VkImage &image, uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t arrayLayers) {
-    VkCommandBuffer cmdBuff = BeginSingleTimeCommands();
+    VkCommandBuffer cmdBuff = GetUploadCommandBuffer();
 
     VkImageMemoryBarrier barrier{
         VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,                     // sType
@@ -682,8 +792,6 @@ void VulkanFactory::GenerateMipMaps(VkImage &image, uint32_t width, uint32_t hei
                          0, nullptr,
                          0, nullptr,
                          1, &barrier);
-
-    EndSingleTimeCommands(cmdBuff);
 }
 
 void VulkanFactory::CreateFramebuffers() {
@@ -794,7 +902,7 @@ void VulkanFactory::CreateSemaphores() {
     }
 }
 
-void VulkanFactory::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& memory) {
+void VulkanFactory::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, MemoryAllocation& memory) {
     VkBufferCreateInfo createInfo = {
         VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,                       // sType
         nullptr,                                                    // pNext
@@ -810,64 +918,59 @@ void VulkanFactory::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, Vk
         throw std::runtime_error("cannot create vertex buffer");
     }
 
-    VkMemoryRequirements memRequirements;
-    vkGetBufferMemoryRequirements(m_Device, buffer, &memRequirements);
-
-    auto findMemoryType = [&](uint32_t typeFilter, VkMemoryPropertyFlags properties) {
-        VkPhysicalDeviceMemoryProperties memProperties;
-        vkGetPhysicalDeviceMemoryProperties(m_PhysicalDevice, &memProperties);
-
-        for (uint32_t i = 0; i < memProperties.memoryTypeCount; ++i) {
-            if (typeFilter & (1 << i) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-                return i;
-            }
-        }
-        throw std::runtime_error("cannot find suitable memory type");
-    };
+    VkMemoryDedicatedRequirements dedicatedRequirements{ VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS };
+    VkMemoryRequirements2 memRequirements{ VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2, &dedicatedRequirements };
+    VkBufferMemoryRequirementsInfo2 requirementsInfo{ VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2, nullptr, buffer };
+    vkGetBufferMemoryRequirements2(m_Device, &requirementsInfo, &memRequirements);
 
-    VkMemoryAllocateFlagsInfo flagsInfo{
-        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,               // sType
-        nullptr,                                                    // pNext
-        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,                      // flags
-        0                                                           // deviceMask
-    };
+    // scratch, AS storage and SBT addresses need up to 256 byte alignment, more than the buffer itself reports
+    if (usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) {
+        memRequirements.memoryRequirements.alignment = std::max<VkDeviceSize>(memRequirements.memoryRequirements.alignment, 256);
+    }
 
-    VkMemoryAllocateInfo memAllocateInfo = {
-        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,                     // sType
-        &flagsInfo,                                                 // pNext
-        memRequirements.size,                                       // allocationSize
-        findMemoryType(memRequirements.memoryTypeBits,
-                        properties)                                 // memoryTypeIndex
-    };
+    memory = m_Allocator.Allocate(memRequirements.memoryRequirements, properties, true,
+        dedicatedRequirements.prefersDedicatedAllocation || dedicatedRequirements.requiresDedicatedAllocation, buffer, VK_NULL_HANDLE);
+    vkBindBufferMemory(m_Device, buffer, memory.memory, memory.offset);
+}
 
-    if (vkAllocateMemory(m_Device, &memAllocateInfo, nullptr, &memory) != VK_SUCCESS) {
-        throw std::runtime_error("cannot allocate device memory");
+void* VulkanFactory::MapMemory(const MemoryAllocation& memory) {
+    // host visible blocks stay mapped for their whole lifetime
+    if (!memory.mapped) {
+        throw std::runtime_error("memory is not host visible");
     }
-    vkBindBufferMemory(m_Device, buffer, memory, 0);
+    return memory.mapped;
 }
 
 void VulkanFactory::CopyBuffer(VkBuffer& srcBuffer, VkBuffer& dstBuffer, VkDeviceSize size) {
-    VkCommandBuffer cmdBuffer = BeginSingleTimeCommands();
-
     VkBufferCopy copyRegion = {
         0,                                                          // srcOffset
         0,                                                          // dstOffset
         size                                                        // size
     };
-    vkCmdCopyBuffer(cmdBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-    EndSingleTimeCommands(cmdBuffer);
+    vkCmdCopyBuffer(GetUploadCommandBuffer(), srcBuffer, dstBuffer, 1, &copyRegion);
 }
 
-VkCommandBuffer VulkanFactory::BeginSingleTimeCommands() {
-    VkCommandBufferAllocateInfo allocInfo = {
-        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,             // sType
-        nullptr,                                                    // pNext
-        m_CommandPool,                                              // commandPool
-        VK_COMMAND_BUFFER_LEVEL_PRIMARY,                            // level
-        1                                                           // commandBufferCount
-    };
-    VkCommandBuffer cmdBuffer;
-    vkAllocateCommandBuffers(m_Device, &allocInfo, &cmdBuffer);
+VkCommandBuffer VulkanFactory::GetUploadCommandBuffer() {
+    if (m_UploadCmdBuffer != VK_NULL_HANDLE) {
+        return m_UploadCmdBuffer;
+    }
+
+    RetireUploads();
+    if (!m_FreeUploadCmdBuffers.empty()) {
+        m_UploadCmdBuffer = m_FreeUploadCmdBuffers.back();
+        m_FreeUploadCmdBuffers.pop_back();
+    } else {
+        VkCommandBufferAllocateInfo allocInfo = {
+            VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,             // sType
+            nullptr,                                                    // pNext
+            m_UploadCommandPool,                                        // commandPool
+            VK_COMMAND_BUFFER_LEVEL_PRIMARY,                            // level
+            1                                                           // commandBufferCount
+        };
+        if (vkAllocateCommandBuffers(m_Device, &allocInfo, &m_UploadCmdBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("cannot allocate upload command buffer");
+        }
+    }
 
     VkCommandBufferBeginInfo cmdBuffbeginInfo = {
         VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,                // sType
@@ -875,28 +978,96 @@ VkCommandBuffer VulkanFactory::BeginSingleTimeCommands() {
         VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,                // flags
         nullptr                                                     // pInheritanceInfo
     };
-    vkBeginCommandBuffer(cmdBuffer, &cmdBuffbeginInfo);
+    vkBeginCommandBuffer(m_UploadCmdBuffer, &cmdBuffbeginInfo);
 
-    return cmdBuffer;
+    return m_UploadCmdBuffer;
 }
 
-void VulkanFactory::EndSingleTimeCommands(VkCommandBuffer buffer) {
-    vkEndCommandBuffer(buffer);
+uint64_t VulkanFactory::SubmitUploads() {
+    // nothing recorded since the last submit, its ticket already covers everything
+    if (m_UploadCmdBuffer == VK_NULL_HANDLE) {
+        return m_UploadTicket;
+    }
+    vkEndCommandBuffer(m_UploadCmdBuffer);
 
+    uint64_t ticket = ++m_UploadTicket;
+    VkTimelineSemaphoreSubmitInfo timelineInfo = {
+        VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,           // sType
+        nullptr,                                                    // pNext
+        0,                                                          // waitSemaphoreValueCount
+        nullptr,                                                    // pWaitSemaphoreValues
+        1,                                                          // signalSemaphoreValueCount
+        &ticket                                                     // pSignalSemaphoreValues
+    };
     VkSubmitInfo submitInfo = {
         VK_STRUCTURE_TYPE_SUBMIT_INFO,                              // sType
-        nullptr,                                                    // pNext
+        &timelineInfo,                                              // pNext
         0,                                                          // waitSemaphoreCount
         nullptr,                                                    // pWaitSemaphores
         0,                                                          // pWaitDstStageMask
         1,                                                          // commandBufferCount
-        &buffer,                                                    // pCommandBuffers
-        0,                                                          // signalSemaphoreCount
-        nullptr                                                     // pSignalSemaphores
+        &m_UploadCmdBuffer,                                         // pCommandBuffers
+        1,                                                          // signalSemaphoreCount
+        &m_UploadTimeline                                           // pSignalSemaphores
     };
-    vkQueueSubmit(m_Queue, 1, &submitInfo, VK_NULL_HANDLE);
-    VkResult result = vkQueueWaitIdle(m_Queue);
-    vkFreeCommandBuffers(m_Device, m_CommandPool, 1, &buffer);
+    if (vkQueueSubmit(m_Queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+        throw std::runtime_error("cannot submit uploads");
+    }
+
+    // staging regions recorded into this buffer are recycled once the timeline reaches the ticket
+    m_StagingRing.Flush(ticket);
+    m_UploadsInFlight.push_back({ ticket, m_UploadCmdBuffer });
+    m_UploadCmdBuffer = VK_NULL_HANDLE;
+    return ticket;
+}
+
+void VulkanFactory::WaitForUpload(uint64_t ticket) {
+    VkSemaphoreWaitInfo waitInfo = {
+        VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,                      // sType
+        nullptr,                                                    // pNext
+        0,                                                          // flags
+        1,                                                          // semaphoreCount
+        &m_UploadTimeline,                                          // pSemaphores
+        &ticket                                                     // pValues
+    };
+    vkWaitSemaphores(m_Device, &waitInfo, UINT64_MAX);
+    RetireUploads();
+}
+
+void VulkanFactory::ReleaseAfterUpload(VkBuffer buffer, MemoryAllocation& memory) {
+    // a buffer used by the batch still being recorded lives until that batch's ticket
+    uint64_t ticket = m_UploadCmdBuffer != VK_NULL_HANDLE ? m_UploadTicket + 1 : m_UploadTicket;
+    m_DeferredReleases.push_back({ ticket, buffer, memory, VK_NULL_HANDLE });
+    memory = MemoryAllocation();
+}
+
+void VulkanFactory::ReleaseAfterUpload(AccelerationStructure& as) {
+    uint64_t ticket = m_UploadCmdBuffer != VK_NULL_HANDLE ? m_UploadTicket + 1 : m_UploadTicket;
+    m_DeferredReleases.push_back({ ticket, as.buffer, as.memory, as.as });
+    as = AccelerationStructure();
+}
+
+void VulkanFactory::RetireUploads() {
+    uint64_t completed = 0;
+    vkGetSemaphoreCounterValue(m_Device, m_UploadTimeline, &completed);
+
+    while (!m_UploadsInFlight.empty() && m_UploadsInFlight.front().ticket <= completed) {
+        m_FreeUploadCmdBuffers.push_back(m_UploadsInFlight.front().cmdBuffer);
+        m_UploadsInFlight.pop_front();
+    }
+
+    auto released = std::remove_if(m_DeferredReleases.begin(), m_DeferredReleases.end(), [&](DeferredRelease &release) {
+        if (release.ticket > completed) {
+            return false;
+        }
+        if (release.as != VK_NULL_HANDLE) {
+            vkDestroyAccelerationStructureKHR(m_Device, release.as, nullptr);
+        }
+        vkDestroyBuffer(m_Device, release.buffer, nullptr);
+        m_Allocator.Free(release.memory);
+        return true;
+    });
+    m_DeferredReleases.erase(released, m_DeferredReleases.end());
 }
 
 void VulkanFactory::CreateTextureSampler(VkSampler& textureSampler) {
@@ -932,13 +1103,7 @@ void VulkanFactory::CreateTextureSampler(VkSampler& textureSampler) {
 OffscreenRender &&VulkanFactory::CreateOffscreenRenderer() {
     OffscreenRender render{};
 
-    CreateImage(m_SwapChainExtent.width, m_SwapChainExtent.height, 1, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
-        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        render.targetImage, render.targetImageMemory, 1, 0);
-
-    TransitionImageLayout(render.targetImage, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 1);
-
-    render.targetImageView = CreateImageView(render.targetImage, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_2D, 1);
+    CreateOffscreenImages(render);
     CreateTextureSampler(render.targetSampler);
 
     std::vector<VkDescriptorSetLayoutBinding> samplerLayoutBinding = { {
@@ -970,6 +1135,70 @@ OffscreenRender &&VulkanFactory::CreateOffscreenRenderer() {
         throw std::runtime_error("cannot allocate descriptor sets");
     }
 
+    UpdateOffscreenDescriptorSet(render);
+
+    return std::move(render);
+}
+
+void VulkanFactory::ResizeOffscreenRenderer(OffscreenRender &render) {
+    std::array<std::pair<VkImage, VkImageView>, 6> images = { {
+        { render.targetImage, render.targetImageView },
+        { render.accumulationImage, render.accumulationImageView },
+        { render.momentsImage, render.momentsImageView },
+        { render.sampleCountImage, render.sampleCountImageView },
+        { render.gbufferImage, render.gbufferImageView },
+        { render.motionImage, render.motionImageView }
+    } };
+    for (auto &image : images) {
+        vkDestroyImageView(m_Device, image.second, nullptr);
+        vkDestroyImage(m_Device, image.first, nullptr);
+    }
+    for (MemoryAllocation *memory : { &render.targetImageMemory, &render.accumulationImageMemory, &render.momentsImageMemory,
+                                      &render.sampleCountImageMemory, &render.gbufferImageMemory, &render.motionImageMemory }) {
+        m_Allocator.Free(*memory);
+    }
+
+    // the sampler and the descriptor set layout, which the post pipeline was created with, stay
+    CreateOffscreenImages(render);
+    UpdateOffscreenDescriptorSet(render);
+}
+
+void VulkanFactory::CreateOffscreenImages(OffscreenRender &render) {
+    CreateImage(m_SwapChainExtent.width, m_SwapChainExtent.height, 1, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        render.targetImage, render.targetImageMemory, 1, 0);
+
+    TransitionImageLayout(render.targetImage, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 1);
+
+    render.targetImageView = CreateImageView(render.targetImage, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_2D, 1);
+
+    CreateImage(m_SwapChainExtent.width, m_SwapChainExtent.height, 1, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_STORAGE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, render.accumulationImage, render.accumulationImageMemory, 1, 0);
+    TransitionImageLayout(render.accumulationImage, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 1);
+    render.accumulationImageView = CreateImageView(render.accumulationImage, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_2D, 1);
+
+    CreateImage(m_SwapChainExtent.width, m_SwapChainExtent.height, 1, VK_FORMAT_R32G32_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_STORAGE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, render.momentsImage, render.momentsImageMemory, 1, 0);
+    TransitionImageLayout(render.momentsImage, VK_FORMAT_R32G32_SFLOAT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 1);
+    render.momentsImageView = CreateImageView(render.momentsImage, VK_FORMAT_R32G32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_2D, 1);
+
+    CreateImage(m_SwapChainExtent.width, m_SwapChainExtent.height, 1, VK_FORMAT_R32_UINT, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_STORAGE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, render.sampleCountImage, render.sampleCountImageMemory, 1, 0);
+    TransitionImageLayout(render.sampleCountImage, VK_FORMAT_R32_UINT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 1);
+    render.sampleCountImageView = CreateImageView(render.sampleCountImage, VK_FORMAT_R32_UINT, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_2D, 1);
+
+    CreateImage(m_SwapChainExtent.width, m_SwapChainExtent.height, 1, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_STORAGE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, render.gbufferImage, render.gbufferImageMemory, 1, 0);
+    TransitionImageLayout(render.gbufferImage, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 1);
+    render.gbufferImageView = CreateImageView(render.gbufferImage, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_2D, 1);
+
+    CreateImage(m_SwapChainExtent.width, m_SwapChainExtent.height, 1, VK_FORMAT_R32G32_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_STORAGE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, render.motionImage, render.motionImageMemory, 1, 0);
+    TransitionImageLayout(render.motionImage, VK_FORMAT_R32G32_SFLOAT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 1);
+    render.motionImageView = CreateImageView(render.motionImage, VK_FORMAT_R32G32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_2D, 1);
+}
+
+void VulkanFactory::UpdateOffscreenDescriptorSet(OffscreenRender &render) {
     VkDescriptorImageInfo imageInfo = {
         render.targetSampler,                                       // sampler
         render.targetImageView,                                     // imageView
@@ -992,13 +1221,148 @@ OffscreenRender &&VulkanFactory::CreateOffscreenRenderer() {
     };
 
     vkUpdateDescriptorSets(m_Device, static_cast<uint32_t>(writeDescriptorSet.size()), writeDescriptorSet.data(), 0, nullptr);
+}
 
-    return std::move(render);
+void VulkanFactory::ReadbackImage(uint32_t index, const std::string& filename) {
+    VkDeviceSize imageSize = (VkDeviceSize)m_SwapChainExtent.width * m_SwapChainExtent.height * 4;
+    VkBuffer readbackBuffer;
+    MemoryAllocation readbackBufferMemory;
+
+    CreateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        readbackBuffer, readbackBufferMemory);
+
+    VkCommandBuffer cmdBuffer = GetUploadCommandBuffer();
+
+    // the render pass leaves headless images in TRANSFER_SRC_OPTIMAL
+    VkImageMemoryBarrier barrier = {
+        VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,                     // sType
+        nullptr,                                                    // pNext
+        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,                       // srcAccessMask
+        VK_ACCESS_TRANSFER_READ_BIT,                                // dstAccessMask
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,                       // oldLayout
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,                       // newLayout
+        VK_QUEUE_FAMILY_IGNORED,                                    // srcQueueFamilyIndex
+        VK_QUEUE_FAMILY_IGNORED,                                    // dstQueueFamilyIndex
+        m_SwapChainImages[index],                                   // image
+        {
+            VK_IMAGE_ASPECT_COLOR_BIT,                          // aspectMask
+            0,                                                  // baseMipLevel
+            1,                                                  // levelCount
+            0,                                                  // baseArrayLayer
+            1                                                   // layerCount
+        }                                                           // subresourceRange
+    };
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    VkBufferImageCopy region = {
+        0,                                                          // bufferOffset
+        0,                                                          // bufferRowLength
+        0,                                                          // bufferImageHeight
+        {
+            VK_IMAGE_ASPECT_COLOR_BIT,                          // aspectMask
+            0,                                                  // mipLevel
+            0,                                                  // baseArrayLayer
+            1,                                                  // layerCount
+        },                                                          // imageSubresource
+        {0, 0, 0},                                                  // imageOffset
+        {m_SwapChainExtent.width, m_SwapChainExtent.height, 1}      // imageExtent
+    };
+    vkCmdCopyImageToBuffer(cmdBuffer, m_SwapChainImages[index], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffer, 1, &region);
+
+    FlushUploads();
+
+    std::ofstream fout(filename, std::ios::binary);
+    if (!fout.is_open()) {
+        throw std::runtime_error("failed to open " + filename);
+    }
+    fout << "P6\n" << m_SwapChainExtent.width << " " << m_SwapChainExtent.height << "\n255\n";
+
+    uint8_t* data = static_cast<uint8_t*>(MapMemory(readbackBufferMemory));
+    std::vector<uint8_t> row(m_SwapChainExtent.width * 3);
+    for (uint32_t y = 0; y < m_SwapChainExtent.height; ++y) {
+        const uint8_t* bgra = data + (VkDeviceSize)y * m_SwapChainExtent.width * 4;
+        for (uint32_t x = 0; x < m_SwapChainExtent.width; ++x) {
+            row[x * 3 + 0] = bgra[x * 4 + 2];
+            row[x * 3 + 1] = bgra[x * 4 + 1];
+            row[x * 3 + 2] = bgra[x * 4 + 0];
+        }
+        fout.write(reinterpret_cast<const char*>(row.data()), row.size());
+    }
+
+    vkDestroyBuffer(m_Device, readbackBuffer, nullptr);
+    m_Allocator.Free(readbackBufferMemory);
 }
 
-void VulkanFactory::CopyBufferToImage(VkBuffer& srcBuffer, VkImage dstImage, uint32_t width, uint32_t height, uint32_t depth, uint32_t faceNo) {
-    VkCommandBuffer cmdBuffer = BeginSingleTimeCommands();
+void VulkanFactory::UploadToBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size) {
+    // chunks of a quarter ring, submitted before half the ring is pending, so a chunk never waits on its own command buffer
+    const VkDeviceSize chunkSize = m_StagingRing.GetCapacity() / 4;
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+
+    for (VkDeviceSize copied = 0; copied < size; ) {
+        VkDeviceSize copySize = std::min(chunkSize, size - copied);
+        StagingRegion region = m_StagingRing.Allocate(copySize, 16);
+        memcpy(region.data, src + copied, copySize);
+
+        VkBufferCopy copyRegion = {
+            region.offset,                                          // srcOffset
+            dstOffset + copied,                                     // dstOffset
+            copySize                                                // size
+        };
+        vkCmdCopyBuffer(GetUploadCommandBuffer(), region.buffer, dstBuffer, 1, &copyRegion);
+        copied += copySize;
+
+        if (m_StagingRing.GetPendingSize() > m_StagingRing.GetCapacity() / 2) {
+            SubmitUploads();
+        }
+    }
+}
+
+void VulkanFactory::UploadToImage(VkImage dstImage, const void* data, uint32_t width, uint32_t height, uint32_t depth, uint32_t texelSize, uint32_t faceNo) {
+    // image has to be in TRANSFER_DST_OPTIMAL already; big images are split into whole slices or, if one slice is too big, rows
+    const VkDeviceSize chunkSize = m_StagingRing.GetCapacity() / 4;
+    const VkDeviceSize rowPitch = (VkDeviceSize)width * texelSize;
+    const VkDeviceSize slicePitch = rowPitch * height;
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+
+    uint32_t slicesPerChunk = static_cast<uint32_t>(std::max<VkDeviceSize>(1, chunkSize / slicePitch));
+    uint32_t rowsPerChunk = slicePitch <= chunkSize ? height : static_cast<uint32_t>(std::max<VkDeviceSize>(1, chunkSize / rowPitch));
+    if (rowPitch > chunkSize) {
+        throw std::runtime_error("image row does not fit in the staging ring");
+    }
+
+    for (uint32_t z = 0; z < depth; ) {
+        uint32_t slices = rowsPerChunk == height ? std::min(slicesPerChunk, depth - z) : 1;
+        for (uint32_t y = 0; y < height; ) {
+            uint32_t rows = std::min(rowsPerChunk, height - y);
+            VkDeviceSize copySize = rowPitch * rows * slices;
+            StagingRegion stagingRegion = m_StagingRing.Allocate(copySize, 16);
+            memcpy(stagingRegion.data, src + slicePitch * z + rowPitch * y, copySize);
+
+            VkBufferImageCopy region = {
+                stagingRegion.offset,                                   // bufferOffset
+                0,                                                      // bufferRowLength
+                0,                                                      // bufferImageHeight
+                {
+                    VK_IMAGE_ASPECT_COLOR_BIT,                          // aspectMask
+                    0,                                                  // mipLevel
+                    faceNo,                                             // baseArrayLayer
+                    1,                                                  // layerCount
+                },                                                      // imageSubresource
+                {0, static_cast<int32_t>(y), static_cast<int32_t>(z)},  // imageOffset
+                {width, rows, slices}                                   // imageExtent
+            };
+            vkCmdCopyBufferToImage(GetUploadCommandBuffer(), stagingRegion.buffer, dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+            y += rows;
+
+            if (m_StagingRing.GetPendingSize() > m_StagingRing.GetCapacity() / 2) {
+                SubmitUploads();
+            }
+        }
+        z += slices;
+    }
+}
 
+void VulkanFactory::CopyBufferToImage(VkBuffer& srcBuffer, VkImage dstImage, uint32_t width, uint32_t height, uint32_t depth, uint32_t faceNo) {
     VkBufferImageCopy region = {
         0,                                                          // bufferOffset
         0,                                                          // bufferRowLength
@@ -1013,14 +1377,10 @@ void VulkanFactory::CopyBufferToImage(VkBuffer& srcBuffer, VkImage dstImage, uin
         {width, height, depth}                                      // imageExtent
     };
 
-    vkCmdCopyBufferToImage(cmdBuffer, srcBuffer, dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-    EndSingleTimeCommands(cmdBuffer);
+    vkCmdCopyBufferToImage(GetUploadCommandBuffer(), srcBuffer, dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 }
 
 void VulkanFactory::TransitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t layerCount, uint32_t mipLevels) {
-    VkCommandBuffer cmdBuffer = BeginSingleTimeCommands();
-
     VkImageMemoryBarrier imgMemoryBarrier = {
         VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,                     // sType
         nullptr,                                                    // pNext
@@ -1051,23 +1411,21 @@ void VulkanFactory::TransitionImageLayout(VkImage image, VkFormat format, VkImag
         dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
     } else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_GENERAL) {
         imgMemoryBarrier.srcAccessMask = 0;
-        imgMemoryBarrier.dstAccessMask = VkAccessFlags();
+        imgMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
 
         srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-        dstStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+        dstStage = VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
     } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
         imgMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
         imgMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
         srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
     } else {
         throw std::runtime_error("unsuported image layout transition");
     }
 
-    vkCmdPipelineBarrier(cmdBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &imgMemoryBarrier);
-
-    EndSingleTimeCommands(cmdBuffer);
+    vkCmdPipelineBarrier(GetUploadCommandBuffer(), srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &imgMemoryBarrier);
 }
 
 void VulkanFactory::CreateShaderModule(VkShaderModule& shaderModule, const std::string& shaderFilename) {
@@ -1124,7 +1482,7 @@ void VulkanFactory::CreateGraphicsPipelineLayout(std::vector<VkDescriptorSetLayo
         VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,              // sType
         nullptr,                                                    // pNext
         0,                                                          // flags
-        1,                                                          // setLayoutCount
+        static_cast<uint32_t>(descriptorSetLayouts.size()),         // setLayoutCount
         descriptorSetLayouts.data(),                                // pSetLayouts
         static_cast<uint32_t>(pushConstantRanges.size()),           // pushConstantRangeCount
         pushConstantRanges.data()                                   // pPushConstantRanges
@@ -1136,6 +1494,35 @@ void VulkanFactory::CreateGraphicsPipelineLayout(std::vector<VkDescriptorSetLayo
 
 }
 
+void VulkanFactory::CreateComputePipeline(const std::string& shaderFilename, VkPipelineLayout pipelineLayout, VkPipeline& computePipeline) {
+    VkShaderModule shaderModule;
+    CreateShaderModule(shaderModule, shaderFilename);
+
+    VkComputePipelineCreateInfo pipelineCreateInfo{
+        VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,             // sType
+        nullptr,                                                    // pNext
+        0,                                                          // flags
+        {
+            VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,    // sType
+            nullptr,                                                // pNext
+            0,                                                      // flags
+            VK_SHADER_STAGE_COMPUTE_BIT,                            // stage
+            shaderModule,                                           // module
+            "main",                                                 // pName
+            nullptr                                                 // pSpecializationInfo
+        },                                                          // stage
+        pipelineLayout,                                             // layout
+        VK_NULL_HANDLE,                                             // basePipelineHandle
+        0                                                           // basePipelineIndex
+    };
+
+    VkResult result = vkCreateComputePipelines(m_Device, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &computePipeline);
+    vkDestroyShaderModule(m_Device, shaderModule, nullptr);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("cannot create compute pipeline");
+    }
+}
+
 void VulkanFactory::CreateGraphicsPipeline(std::vector<VkPipelineShaderStageCreateInfo>& shaderStages, VkPipelineVertexInputStateCreateInfo& vertexInput,
                                             VkPipelineLayout& pipelineLayout, VkPipeline& graphicsPipeline, uint32_t culling, uint32_t depthEnabled) {
     VkViewport viewport = {
@@ -1384,7 +1771,20 @@ void VulkanFactory::Cleanup() {
 
     vkDestroyCommandPool(m_Device, m_CommandPool, nullptr);
 
-    vkDestroySurfaceKHR(m_VkInstance, m_Surface, nullptr);
+    if (!m_Headless) {
+        vkDestroySurfaceKHR(m_VkInstance, m_Surface, nullptr);
+    }
+    FlushUploads();
+    if (m_ScratchBuffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(m_Device, m_ScratchBuffer, nullptr);
+        m_Allocator.Free(m_ScratchMemory);
+    }
+    m_StagingRing.Cleanup();
+    vkDestroyCommandPool(m_Device, m_UploadCommandPool, nullptr);
+    vkDestroySemaphore(m_Device, m_UploadTimeline, nullptr);
+    vkDestroyBuffer(m_Device, m_StagingBuffer, nullptr);
+    m_Allocator.Free(m_StagingMemory);
+    m_Allocator.Cleanup();
     vkDestroyDevice(m_Device, nullptr);
     vkDestroyInstance(m_VkInstance, nullptr);
 }
@@ -1407,79 +1807,564 @@ VkDeviceAddress VulkanFactory::GetAccelerationStructureAddress(VkAccelerationStr
     return vkGetAccelerationStructureDeviceAddressKHR(m_Device, &info);
 }
 
-AccelerationStructure &&VulkanFactory::CreateBLAS(VkBuffer vertexBuffer, VkBuffer indexBuffer, uint32_t vertexNo, uint32_t primitiveNo) {
-    VkDeviceAddress vertexBufferAddress = GetBufferAddress(vertexBuffer);
-    VkDeviceAddress indexBufferAddress = GetBufferAddress(indexBuffer);
+void VulkanFactory::DestroyAccelerationStructure(AccelerationStructure& as) {
+    vkDestroyAccelerationStructureKHR(m_Device, as.as, nullptr);
+    vkDestroyBuffer(m_Device, as.buffer, nullptr);
+    m_Allocator.Free(as.memory);
+    as = AccelerationStructure();
+}
 
-    VkAccelerationStructureGeometryTrianglesDataKHR asGeometryTrianglesData{
-        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,   // sType
-        nullptr,                                                                // pNext
-        VK_FORMAT_R32G32B32_SFLOAT,                                             // vertexFormat
-        { vertexBufferAddress },                                                // vertexData
-        sizeof(Vertex),                                                         // vertexStride
-        vertexNo,                                                               // maxVertex
-        VK_INDEX_TYPE_UINT32,                                                   // indexType
-        { indexBufferAddress },                                                 // indexData
-        {}                                                                      // transformData
-    };
+std::vector<AccelerationStructure> VulkanFactory::CreateBLASes(const std::vector<BlasInput>& inputs, bool compact) {
+    std::vector<AccelerationStructure> blases(inputs.size());
+    std::vector<BlasInput> missing;
+    std::vector<size_t> missingSlots;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        if (inputs[i].cachePath.empty() || !LoadCachedBLAS(inputs[i], blases[i])) {
+            missing.push_back(inputs[i]);
+            missingSlots.push_back(i);
+        }
+    }
+    if (missing.size() < inputs.size()) {
+        std::cout << inputs.size() - missing.size() << " BLAS loaded from cache" << std::endl;
+    }
+    if (missing.empty()) {
+        return blases;
+    }
 
-    VkAccelerationStructureGeometryKHR asGeometry{
-        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,      // sType
-        nullptr,                                                    // pNext
-        VK_GEOMETRY_TYPE_TRIANGLES_KHR,                             // geometryType
-        { asGeometryTrianglesData },                                // geometry
-        VK_GEOMETRY_OPAQUE_BIT_KHR                                  // flags
-    };
+    bool hostData = true;
+    for (const BlasInput &input : missing) {
+        hostData &= input.hostVertexData != nullptr && input.hostIndexData != nullptr;
+    }
+    std::vector<AccelerationStructure> built = m_HostAsBuilds && hostData ? HostBuildBLASes(missing, compact) : BuildBLASes(missing, compact);
+    StoreCachedBLASes(built, missing);
+    for (size_t i = 0; i < built.size(); ++i) {
+        blases[missingSlots[i]] = built[i];
+    }
+    return blases;
+}
 
-    const VkAccelerationStructureBuildRangeInfoKHR *asBuildRangeInfo = new VkAccelerationStructureBuildRangeInfoKHR{
-        primitiveNo,                                                // primitiveCount
-        0,                                                          // primitiveOffset
-        0,                                                          // firstVertex
-        0                                                           // transformOffset
-    };
+std::vector<AccelerationStructure> VulkanFactory::BuildBLASes(const std::vector<BlasInput>& inputs, bool compact) {
+    size_t count = inputs.size();
+    std::vector<AccelerationStructure> blases(count);
+    if (count == 0) {
+        return blases;
+    }
 
-    VkAccelerationStructureBuildGeometryInfoKHR asBuildGeometryInfo{
-        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,   // sType
-        nullptr,                                                            // pNext
-        VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,                    // type
-        VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,          // flags
-        VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,                     // mode
-        {},                                                                 // srcAccelerationStructure
-        {},                                                                 // dstAccelerationStructure
-        1,                                                                  // geometryCount
-        &asGeometry,                                                        // pGeometries
-        nullptr,                                                            // ppGeometries
-        {}                                                                  // scratchData
-    };
+    // all transforms share one buffer, VkTransformMatrixKHR is row major 3x4 and keeps every element 16 byte aligned
+    std::vector<VkTransformMatrixKHR> matrices(count);
+    bool transformed = false;
+    for (size_t i = 0; i < count; ++i) {
+        glm::mat4 rows = glm::transpose(inputs[i].transform);
+        memcpy(&matrices[i], &rows, sizeof(VkTransformMatrixKHR));
+        transformed |= inputs[i].transform != glm::mat4(1.0f);
+    }
+    VkBuffer transformBuffer = VK_NULL_HANDLE;
+    MemoryAllocation transformMemory{};
+    VkDeviceAddress transformAddress = 0;
+    if (transformed) {
+        VkDeviceSize transformSize = count * sizeof(VkTransformMatrixKHR);
+        CreateBuffer(transformSize, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, transformBuffer, transformMemory);
+        UploadToBuffer(transformBuffer, 0, matrices.data(), transformSize);
+        transformAddress = GetBufferAddress(transformBuffer);
+    }
 
-    VkAccelerationStructureBuildSizesInfoKHR asBuildSizesInfo{
-        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,  // sType
-        nullptr,                                                        // pNext
-        0,                                                              // accelerationStructureSize
-        0,                                                              // updateScratchSize
-        0                                                               // buildScratchSize
+    VkBuildAccelerationStructureFlagsKHR buildFlags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+    if (compact) {
+        buildFlags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+    }
+
+    // build infos point into these, they are sized up front and never reallocate
+    std::vector<VkAccelerationStructureGeometryKHR> geometries(count);
+    std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildInfos(count);
+    std::vector<VkAccelerationStructureBuildRangeInfoKHR> ranges(count);
+    std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> rangePointers(count);
+    std::vector<VkDeviceSize> buildSizes(count);
+    std::vector<VkDeviceSize> scratchSizes(count);
+    VkDeviceSize scratchAlignment = GetScratchAlignment();
+    for (size_t i = 0; i < count; ++i) {
+        const BlasInput &input = inputs[i];
+        VkAccelerationStructureGeometryTrianglesDataKHR asGeometryTrianglesData{
+            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,   // sType
+            nullptr,                                                                // pNext
+            input.vertexFormat,                                                     // vertexFormat
+            { GetBufferAddress(input.vertexBuffer) },                               // vertexData
+            input.vertexStride,                                                     // vertexStride
+            input.vertexNo,                                                         // maxVertex
+            input.indexType,                                                        // indexType
+            { GetBufferAddress(input.indexBuffer) },                                // indexData
+            { input.transform != glm::mat4(1.0f) ?
+                transformAddress + i * sizeof(VkTransformMatrixKHR) : 0 }           // transformData
+        };
+
+        geometries[i] = {
+            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,      // sType
+            nullptr,                                                    // pNext
+            VK_GEOMETRY_TYPE_TRIANGLES_KHR,                             // geometryType
+            { asGeometryTrianglesData },                                // geometry
+            VK_GEOMETRY_OPAQUE_BIT_KHR                                  // flags
+        };
+
+        ranges[i] = {
+            input.primitiveNo,                                          // primitiveCount
+            0,                                                          // primitiveOffset
+            0,                                                          // firstVertex
+            0                                                           // transformOffset
+        };
+        rangePointers[i] = &ranges[i];
+
+        buildInfos[i] = {
+            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,   // sType
+            nullptr,                                                            // pNext
+            VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,                    // type
+            buildFlags,                                                         // flags
+            VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,                     // mode
+            {},                                                                 // srcAccelerationStructure
+            {},                                                                 // dstAccelerationStructure
+            1,                                                                  // geometryCount
+            &geometries[i],                                                     // pGeometries
+            nullptr,                                                            // ppGeometries
+            {}                                                                  // scratchData
+        };
+
+        VkAccelerationStructureBuildSizesInfoKHR asBuildSizesInfo{
+            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,  // sType
+            nullptr,                                                        // pNext
+            0,                                                              // accelerationStructureSize
+            0,                                                              // updateScratchSize
+            0                                                               // buildScratchSize
+        };
+        vkGetAccelerationStructureBuildSizesKHR(m_Device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfos[i], &input.primitiveNo, &asBuildSizesInfo);
+        buildSizes[i] = asBuildSizesInfo.accelerationStructureSize;
+        scratchSizes[i] = alignUp(asBuildSizesInfo.buildScratchSize, scratchAlignment);
+
+        CreateBuffer(buildSizes[i], VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR |
+            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, 0, blases[i].buffer, blases[i].memory);
+
+        VkAccelerationStructureCreateInfoKHR asCreateInfo{
+            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,   // sType
+            nullptr,                                                    // pNext
+            0,                                                          // createFlags
+            blases[i].buffer,                                           // buffer
+            0,                                                          // offset
+            buildSizes[i],                                              // size
+            VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,            // type
+            0                                                           // deviceAddress
+        };
+        if (vkCreateAccelerationStructureKHR(m_Device, &asCreateInfo, nullptr, &blases[i].as) != VK_SUCCESS) {
+            throw std::runtime_error("cannot create acceleration structure");
+        }
+        buildInfos[i].dstAccelerationStructure = blases[i].as;
+    }
+
+    // the pool holds the whole batch side by side unless that exceeds the budget, then builds go in chunks that fit
+    VkDeviceSize totalScratch = 0;
+    VkDeviceSize largestScratch = 0;
+    for (VkDeviceSize size : scratchSizes) {
+        totalScratch += size;
+        largestScratch = std::max(largestScratch, size);
+    }
+    ReserveScratch(std::max(largestScratch, std::min(totalScratch, ScratchPoolBudget)));
+
+    VkCommandBuffer cmdBuff = GetUploadCommandBuffer();
+    size_t first = 0;
+    while (first < count) {
+        size_t last = first;
+        VkDeviceSize offset = 0;
+        while (last < count && offset + scratchSizes[last] <= m_ScratchSize) {
+            buildInfos[last].scratchData.deviceAddress = m_ScratchAddress + offset;
+            offset += scratchSizes[last];
+            ++last;
+        }
+
+        // geometry may have been uploaded earlier in the same batch and hit shaders read it through buffer addresses too;
+        // the scratch pool may still be in use by an earlier chunk or batch
+        VkMemoryBarrier barrier{
+            VK_STRUCTURE_TYPE_MEMORY_BARRIER,                           // sType;
+            nullptr,                                                    // pNext;
+            VK_ACCESS_TRANSFER_WRITE_BIT |
+            VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,             // srcAccessMask;
+            VK_ACCESS_SHADER_READ_BIT |
+            VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR |
+            VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR              // dstAccessMask;
+        };
+        vkCmdPipelineBarrier(cmdBuff, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        vkCmdBuildAccelerationStructuresKHR(cmdBuff, static_cast<uint32_t>(last - first), &buildInfos[first], &rangePointers[first]);
+        first = last;
+    }
+
+    if (transformBuffer != VK_NULL_HANDLE) {
+        ReleaseAfterUpload(transformBuffer, transformMemory);
+    }
+
+    if (compact) {
+        CompactBLASes(blases, buildSizes);
+    }
+
+    return blases;
+}
+
+std::vector<AccelerationStructure> VulkanFactory::HostBuildBLASes(const std::vector<BlasInput>& inputs, bool compact) {
+    size_t count = inputs.size();
+    std::vector<AccelerationStructure> hostBlases(count);
+
+    std::vector<VkTransformMatrixKHR> matrices(count);
+    for (size_t i = 0; i < count; ++i) {
+        glm::mat4 rows = glm::transpose(inputs[i].transform);
+        memcpy(&matrices[i], &rows, sizeof(VkTransformMatrixKHR));
+    }
+
+    VkBuildAccelerationStructureFlagsKHR buildFlags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+    if (compact) {
+        buildFlags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+    }
+
+    std::vector<VkAccelerationStructureGeometryKHR> geometries(count);
+    std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildInfos(count);
+    std::vector<VkAccelerationStructureBuildRangeInfoKHR> ranges(count);
+    std::vector<VkDeviceSize> buildSizes(count);
+    std::vector<VkDeviceSize> scratchSizes(count);
+    VkDeviceSize scratchAlignment = GetScratchAlignment();
+    for (size_t i = 0; i < count; ++i) {
+        const BlasInput &input = inputs[i];
+        VkAccelerationStructureGeometryTrianglesDataKHR asGeometryTrianglesData{
+            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,   // sType
+            nullptr,                                                                // pNext
+            input.vertexFormat,                                                     // vertexFormat
+            {},                                                                     // vertexData
+            input.vertexStride,                                                     // vertexStride
+            input.vertexNo,                                                         // maxVertex
+            input.indexType,                                                        // indexType
+            {},                                                                     // indexData
+            {}                                                                      // transformData
+        };
+        asGeometryTrianglesData.vertexData.hostAddress = input.hostVertexData;
+        asGeometryTrianglesData.indexData.hostAddress = input.hostIndexData;
+        asGeometryTrianglesData.transformData.hostAddress = input.transform != glm::mat4(1.0f) ? &matrices[i] : nullptr;
+
+        geometries[i] = {
+            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,      // sType
+            nullptr,                                                    // pNext
+            VK_GEOMETRY_TYPE_TRIANGLES_KHR,                             // geometryType
+            { asGeometryTrianglesData },                                // geometry
+            VK_GEOMETRY_OPAQUE_BIT_KHR                                  // flags
+        };
+
+        ranges[i] = {
+            input.primitiveNo,                                          // primitiveCount
+            0,                                                          // primitiveOffset
+            0,                                                          // firstVertex
+            0                                                           // transformOffset
+        };
+
+        buildInfos[i] = {
+            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,   // sType
+            nullptr,                                                            // pNext
+            VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,                    // type
+            buildFlags,                                                         // flags
+            VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,                     // mode
+            {},                                                                 // srcAccelerationStructure
+            {},                                                                 // dstAccelerationStructure
+            1,                                                                  // geometryCount
+            &geometries[i],                                                     // pGeometries
+            nullptr,                                                            // ppGeometries
+            {}                                                                  // scratchData
+        };
+
+        VkAccelerationStructureBuildSizesInfoKHR asBuildSizesInfo{
+            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,  // sType
+            nullptr,                                                        // pNext
+            0,                                                              // accelerationStructureSize
+            0,                                                              // updateScratchSize
+            0                                                               // buildScratchSize
+        };
+        vkGetAccelerationStructureBuildSizesKHR(m_Device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_HOST_KHR, &buildInfos[i], &input.primitiveNo, &asBuildSizesInfo);
+        buildSizes[i] = asBuildSizesInfo.accelerationStructureSize;
+        scratchSizes[i] = alignUp(asBuildSizesInfo.buildScratchSize, scratchAlignment);
+
+        // host builds write the structure through a mapping, so it has to live in host visible memory
+        CreateBuffer(buildSizes[i], VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, hostBlases[i].buffer, hostBlases[i].memory);
+
+        VkAccelerationStructureCreateInfoKHR asCreateInfo{
+            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,   // sType
+            nullptr,                                                    // pNext
+            0,                                                          // createFlags
+            hostBlases[i].buffer,                                       // buffer
+            0,                                                          // offset
+            buildSizes[i],                                              // size
+            VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,            // type
+            0                                                           // deviceAddress
+        };
+        if (vkCreateAccelerationStructureKHR(m_Device, &asCreateInfo, nullptr, &hostBlases[i].as) != VK_SUCCESS) {
+            throw std::runtime_error("cannot create acceleration structure");
+        }
+        buildInfos[i].dstAccelerationStructure = hostBlases[i].as;
+    }
+
+    // every build is its own deferred operation joined by as many pool threads as it can use, the scratch of the
+    // builds in flight at once stays within the budget of the device pool
+    ThreadPool *threadPool = ThreadPool::GetInstance();
+    size_t first = 0;
+    while (first < count) {
+        size_t last = first;
+        VkDeviceSize waveScratch = 0;
+        while (last < count && (last == first || waveScratch + scratchSizes[last] <= ScratchPoolBudget)) {
+            waveScratch += scratchSizes[last];
+            ++last;
+        }
+        std::vector<uint8_t> scratch(static_cast<size_t>(waveScratch + scratchAlignment));
+        uintptr_t scratchAddress = alignUp(reinterpret_cast<uintptr_t>(scratch.data()), static_cast<size_t>(scratchAlignment));
+
+        std::vector<VkDeferredOperationKHR> operations(last - first, VK_NULL_HANDLE);
+        std::vector<VkDeferredOperationKHR> joins;
+        for (size_t i = first; i < last; ++i) {
+            buildInfos[i].scratchData.hostAddress = reinterpret_cast<void*>(scratchAddress);
+            scratchAddress += static_cast<uintptr_t>(scratchSizes[i]);
+
+            VkDeferredOperationKHR &operation = operations[i - first];
+            if (vkCreateDeferredOperationKHR(m_Device, nullptr, &operation) != VK_SUCCESS) {
+                throw std::runtime_error("cannot create deferred operation");
+            }
+            const VkAccelerationStructureBuildRangeInfoKHR *range = &ranges[i];
+            VkResult result = vkBuildAccelerationStructuresKHR(m_Device, operation, 1, &buildInfos[i], &range);
+            if (result == VK_OPERATION_DEFERRED_KHR) {
+                uint32_t concurrency = std::min(vkGetDeferredOperationMaxConcurrencyKHR(m_Device, operation), threadPool->GetThreadCount());
+                joins.insert(joins.end(), std::max(concurrency, 1u), operation);
+            } else if (result != VK_OPERATION_NOT_DEFERRED_KHR && result != VK_SUCCESS) {
+                throw std::runtime_error("cannot build acceleration structure on the host");
+            }
+        }
+
+        threadPool->ParallelFor(static_cast<uint32_t>(joins.size()), [&](uint32_t j) {
+            // idle means the operation has no work for this thread at the moment, yet is not finished
+            while (vkDeferredOperationJoinKHR(m_Device, joins[j]) == VK_THREAD_IDLE_KHR) {
+                std::this_thread::yield();
+            }
+        });
+
+        for (VkDeferredOperationKHR operation : operations) {
+            VkResult result = vkGetDeferredOperationResultKHR(m_Device, operation);
+            vkDestroyDeferredOperationKHR(m_Device, operation, nullptr);
+            if (result != VK_SUCCESS) {
+                throw std::runtime_error("host acceleration structure build failed");
+            }
+        }
+        first = last;
+    }
+
+    // on the host the compacted sizes are known right away, no round trip through a query pool
+    std::vector<VkDeviceSize> finalSizes = buildSizes;
+    if (compact) {
+        std::vector<VkAccelerationStructureKHR> handles(count);
+        for (size_t i = 0; i < count; ++i) {
+            handles[i] = hostBlases[i].as;
+        }
+        std::vector<VkDeviceSize> compactedSizes(count, 0);
+        if (vkWriteAccelerationStructuresPropertiesKHR(m_Device, static_cast<uint32_t>(count), handles.data(), VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+            count * sizeof(VkDeviceSize), compactedSizes.data(), sizeof(VkDeviceSize)) == VK_SUCCESS) {
+            for (size_t i = 0; i < count; ++i) {
+                if (compactedSizes[i] != 0 && compactedSizes[i] < buildSizes[i]) {
+                    finalSizes[i] = compactedSizes[i];
+                }
+            }
+        }
+    }
+
+    // traversal should not read over the bus, the upload batch copies every structure into device local storage
+    std::vector<AccelerationStructure> blases(count);
+    VkDeviceSize totalBuildSize = 0;
+    VkDeviceSize totalFinalSize = 0;
+    VkCommandBuffer cmdBuff = GetUploadCommandBuffer();
+    for (size_t i = 0; i < count; ++i) {
+        CreateBuffer(finalSizes[i], VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR |
+            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, 0, blases[i].buffer, blases[i].memory);
+
+        VkAccelerationStructureCreateInfoKHR asCreateInfo{
+            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,   // sType
+            nullptr,                                                    // pNext
+            0,                                                          // createFlags
+            blases[i].buffer,                                           // buffer
+            0,                                                          // offset
+            finalSizes[i],                                              // size
+            VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,            // type
+            0                                                           // deviceAddress
+        };
+        if (vkCreateAccelerationStructureKHR(m_Device, &asCreateInfo, nullptr, &blases[i].as) != VK_SUCCESS) {
+            throw std::runtime_error("cannot create acceleration structure");
+        }
+
+        VkCopyAccelerationStructureInfoKHR copyInfo{
+            VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR,     // sType
+            nullptr,                                                    // pNext
+            hostBlases[i].as,                                           // src
+            blases[i].as,                                               // dst
+            compact ? VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR :
+                VK_COPY_ACCELERATION_STRUCTURE_MODE_CLONE_KHR           // mode
+        };
+        vkCmdCopyAccelerationStructureKHR(cmdBuff, &copyInfo);
+        ReleaseAfterUpload(hostBlases[i]);
+
+        totalBuildSize += buildSizes[i];
+        totalFinalSize += finalSizes[i];
+    }
+
+    std::cout << count << " BLAS built on the host, " << totalBuildSize / 1024 << " KiB copied to " << totalFinalSize / 1024 << " KiB of device memory" << std::endl;
+    return blases;
+}
+
+VkDeviceSize VulkanFactory::GetScratchAlignment() {
+    if (m_ScratchAlignment == 0) {
+        VkPhysicalDeviceAccelerationStructurePropertiesKHR asProperties{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR };
+        VkPhysicalDeviceProperties2 deviceProperties2 = {
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,        // sType
+            &asProperties,                                         // pNext
+            {}                                                     // properties
+        };
+        vkGetPhysicalDeviceProperties2(m_PhysicalDevice, &deviceProperties2);
+        m_ScratchAlignment = std::max<VkDeviceSize>(asProperties.minAccelerationStructureScratchOffsetAlignment, 1);
+    }
+    return m_ScratchAlignment;
+}
+
+void VulkanFactory::ReserveScratch(VkDeviceSize size) {
+    if (m_ScratchSize >= size) {
+        return;
+    }
+    // builds recorded earlier in the batch may still use the old pool
+    if (m_ScratchBuffer != VK_NULL_HANDLE) {
+        ReleaseAfterUpload(m_ScratchBuffer, m_ScratchMemory);
+    }
+    // device address buffers are 256 byte aligned, at least as much as the scratch offset alignment asks for
+    CreateBuffer(size, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, 0, m_ScratchBuffer, m_ScratchMemory);
+    m_ScratchAddress = GetBufferAddress(m_ScratchBuffer);
+    m_ScratchSize = size;
+}
+
+void VulkanFactory::CompactBLASes(std::vector<AccelerationStructure>& blases, const std::vector<VkDeviceSize>& buildSizes) {
+    uint32_t count = static_cast<uint32_t>(blases.size());
+    VkQueryPoolCreateInfo queryPoolInfo{
+        VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,                   // sType
+        nullptr,                                                    // pNext
+        0,                                                          // flags
+        VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,    // queryType
+        count,                                                      // queryCount
+        0                                                           // pipelineStatistics
     };
+    VkQueryPool queryPool;
+    if (vkCreateQueryPool(m_Device, &queryPoolInfo, nullptr, &queryPool) != VK_SUCCESS) {
+        throw std::runtime_error("cannot create compaction query pool");
+    }
 
-    VkResult res{};
+    // the sizes are only known once the builds have run
+    std::vector<VkAccelerationStructureKHR> handles(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        handles[i] = blases[i].as;
+    }
+    VkCommandBuffer cmdBuff = GetUploadCommandBuffer();
+    VkMemoryBarrier barrier{
+        VK_STRUCTURE_TYPE_MEMORY_BARRIER,                           // sType;
+        nullptr,                                                    // pNext;
+        VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,             // srcAccessMask;
+        VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR               // dstAccessMask;
+    };
+    vkCmdPipelineBarrier(cmdBuff, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+    vkCmdResetQueryPool(cmdBuff, queryPool, 0, count);
+    vkCmdWriteAccelerationStructuresPropertiesKHR(cmdBuff, count, handles.data(), VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, queryPool, 0);
+    FlushUploads();
+
+    std::vector<VkDeviceSize> compactedSizes(count, 0);
+    VkResult result = vkGetQueryPoolResults(m_Device, queryPool, 0, count, count * sizeof(VkDeviceSize), compactedSizes.data(), sizeof(VkDeviceSize),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+    vkDestroyQueryPool(m_Device, queryPool, nullptr);
+    if (result != VK_SUCCESS) {
+        return;
+    }
 
-    vkGetAccelerationStructureBuildSizesKHR(m_Device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &asBuildGeometryInfo, &primitiveNo, &asBuildSizesInfo);
+    VkDeviceSize totalBuildSize = 0;
+    VkDeviceSize totalCompactedSize = 0;
+    cmdBuff = GetUploadCommandBuffer();
+    for (uint32_t i = 0; i < count; ++i) {
+        totalBuildSize += buildSizes[i];
+        if (compactedSizes[i] == 0 || compactedSizes[i] >= buildSizes[i]) {
+            totalCompactedSize += buildSizes[i];
+            continue;
+        }
+        totalCompactedSize += compactedSizes[i];
 
-    VkBuffer scratchBuffer{};
-    VkDeviceMemory scratchMemory{};
-    CreateBuffer(asBuildSizesInfo.buildScratchSize, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-        0, scratchBuffer, scratchMemory);
+        AccelerationStructure compacted{};
+        CreateBuffer(compactedSizes[i], VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR |
+            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, 0, compacted.buffer, compacted.memory);
 
-    VkBufferDeviceAddressInfo bufferInfo{
-        VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,               // sType
+        VkAccelerationStructureCreateInfoKHR asCreateInfo{
+            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,   // sType
+            nullptr,                                                    // pNext
+            0,                                                          // createFlags
+            compacted.buffer,                                           // buffer
+            0,                                                          // offset
+            compactedSizes[i],                                          // size
+            VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,            // type
+            0                                                           // deviceAddress
+        };
+        if (vkCreateAccelerationStructureKHR(m_Device, &asCreateInfo, nullptr, &compacted.as) != VK_SUCCESS) {
+            throw std::runtime_error("cannot create compacted acceleration structure");
+        }
+
+        VkCopyAccelerationStructureInfoKHR copyInfo{
+            VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR,     // sType
+            nullptr,                                                    // pNext
+            blases[i].as,                                               // src
+            compacted.as,                                               // dst
+            VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR             // mode
+        };
+        vkCmdCopyAccelerationStructureKHR(cmdBuff, &copyInfo);
+
+        // the copy reads the original until its batch completes
+        ReleaseAfterUpload(blases[i]);
+        blases[i] = compacted;
+    }
+
+    std::cout << count << " BLAS compacted from " << totalBuildSize / 1024 << " KiB to " << totalCompactedSize / 1024 << " KiB" << std::endl;
+}
+
+bool VulkanFactory::LoadCachedBLAS(const BlasInput& input, AccelerationStructure& blas) {
+    std::vector<uint8_t> serialized;
+    if (!BlasCache::Load(input.cachePath, input.cacheKey, serialized)) {
+        return false;
+    }
+
+    // the blob starts with the driver UUID, the compatibility UUID, its own size and the size it deserializes to
+    const size_t deserializedSizeOffset = 2 * VK_UUID_SIZE + sizeof(uint64_t);
+    if (serialized.size() < deserializedSizeOffset + sizeof(uint64_t)) {
+        return false;
+    }
+    VkAccelerationStructureVersionInfoKHR versionInfo{
+        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_VERSION_INFO_KHR,  // sType
         nullptr,                                                    // pNext
-        scratchBuffer                                               // buffer
+        serialized.data()                                           // pVersionData
     };
-    VkDeviceAddress scratchAddress = vkGetBufferDeviceAddress(m_Device, &bufferInfo);
+    VkAccelerationStructureCompatibilityKHR compatibility = VK_ACCELERATION_STRUCTURE_COMPATIBILITY_INCOMPATIBLE_KHR;
+    vkGetDeviceAccelerationStructureCompatibilityKHR(m_Device, &versionInfo, &compatibility);
+    if (compatibility != VK_ACCELERATION_STRUCTURE_COMPATIBILITY_COMPATIBLE_KHR) {
+        return false;
+    }
+    uint64_t deserializedSize;
+    memcpy(&deserializedSize, serialized.data() + deserializedSizeOffset, sizeof(deserializedSize));
+    if (deserializedSize == 0) {
+        return false;
+    }
 
-    AccelerationStructure blas{};
+    VkBuffer blobBuffer;
+    MemoryAllocation blobMemory;
+    CreateBuffer(serialized.size(), VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, blobBuffer, blobMemory);
+    memcpy(MapMemory(blobMemory), serialized.data(), serialized.size());
 
-    CreateBuffer(asBuildSizesInfo.accelerationStructureSize, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR |
-                                                        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, 0, blas.buffer, blas.memory);
+    CreateBuffer(deserializedSize, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR |
+        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, 0, blas.buffer, blas.memory);
 
     VkAccelerationStructureCreateInfoKHR asCreateInfo{
         VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,   // sType
@@ -1487,56 +2372,131 @@ AccelerationStructure &&VulkanFactory::CreateBLAS(VkBuffer vertexBuffer, VkBuffe
         0,                                                          // createFlags
         blas.buffer,                                                // buffer
         0,                                                          // offset
-        asBuildSizesInfo.accelerationStructureSize,                 // size
+        deserializedSize,                                           // size
         VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,            // type
         0                                                           // deviceAddress
     };
+    if (vkCreateAccelerationStructureKHR(m_Device, &asCreateInfo, nullptr, &blas.as) != VK_SUCCESS) {
+        throw std::runtime_error("cannot create deserialized acceleration structure");
+    }
 
-    res = vkCreateAccelerationStructureKHR(m_Device, &asCreateInfo, nullptr, &blas.as);
-
-    asBuildGeometryInfo.dstAccelerationStructure = blas.as;
-    asBuildGeometryInfo.scratchData.deviceAddress = scratchAddress;
-
-    VkCommandBuffer cmdBuff = BeginSingleTimeCommands();
-
-    // only one creation for now, creating more needs pipeline barrier
-    vkCmdBuildAccelerationStructuresKHR(cmdBuff, 1, &asBuildGeometryInfo, &asBuildRangeInfo);
-
-    EndSingleTimeCommands(cmdBuff);
-
-    vkFreeMemory(m_Device, scratchMemory, nullptr);
-
-    return std::move(blas);
+    // device address buffers are 256 byte aligned, as the serialized data has to be
+    VkCopyMemoryToAccelerationStructureInfoKHR copyInfo{
+        VK_STRUCTURE_TYPE_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_INFO_KHR,   // sType
+        nullptr,                                                            // pNext
+        { GetBufferAddress(blobBuffer) },                                   // src
+        blas.as,                                                            // dst
+        VK_COPY_ACCELERATION_STRUCTURE_MODE_DESERIALIZE_KHR                 // mode
+    };
+    vkCmdCopyMemoryToAccelerationStructureKHR(GetUploadCommandBuffer(), &copyInfo);
+    ReleaseAfterUpload(blobBuffer, blobMemory);
+    return true;
 }
 
-void VulkanFactory::CreateTLAS(AccelerationStructure& tlas,VkAccelerationStructureInstanceKHR& asInstance, VkBuildAccelerationStructureFlagsKHR flags, uint32_t primitiveCount, bool update) {
-    VkCommandBuffer cmdBuff = BeginSingleTimeCommands();
+void VulkanFactory::StoreCachedBLASes(const std::vector<AccelerationStructure>& blases, const std::vector<BlasInput>& inputs) {
+    std::vector<VkAccelerationStructureKHR> handles;
+    std::vector<size_t> slots;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        if (!inputs[i].cachePath.empty()) {
+            handles.push_back(blases[i].as);
+            slots.push_back(i);
+        }
+    }
+    uint32_t count = static_cast<uint32_t>(handles.size());
+    if (count == 0) {
+        return;
+    }
 
-    VkBuffer instanceBuffer{};
-    VkDeviceMemory instanceMemory{};
-    CreateBuffer(sizeof(VkAccelerationStructureInstanceKHR), VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        0, instanceBuffer, instanceMemory);
+    VkQueryPoolCreateInfo queryPoolInfo{
+        VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,                   // sType
+        nullptr,                                                    // pNext
+        0,                                                          // flags
+        VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR,    // queryType
+        count,                                                      // queryCount
+        0                                                           // pipelineStatistics
+    };
+    VkQueryPool queryPool;
+    if (vkCreateQueryPool(m_Device, &queryPoolInfo, nullptr, &queryPool) != VK_SUCCESS) {
+        throw std::runtime_error("cannot create serialization query pool");
+    }
 
-    vkCmdUpdateBuffer(cmdBuff, instanceBuffer, 0, sizeof(VkAccelerationStructureInstanceKHR), &asInstance);
+    // builds or compacting copies of the same batch write the structures
+    VkCommandBuffer cmdBuff = GetUploadCommandBuffer();
+    VkMemoryBarrier barrier{
+        VK_STRUCTURE_TYPE_MEMORY_BARRIER,                           // sType;
+        nullptr,                                                    // pNext;
+        VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,             // srcAccessMask;
+        VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR               // dstAccessMask;
+    };
+    vkCmdPipelineBarrier(cmdBuff, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+    vkCmdResetQueryPool(cmdBuff, queryPool, 0, count);
+    vkCmdWriteAccelerationStructuresPropertiesKHR(cmdBuff, count, handles.data(), VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR, queryPool, 0);
+    FlushUploads();
+
+    std::vector<VkDeviceSize> serializedSizes(count, 0);
+    VkResult result = vkGetQueryPoolResults(m_Device, queryPool, 0, count, count * sizeof(VkDeviceSize), serializedSizes.data(), sizeof(VkDeviceSize),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+    vkDestroyQueryPool(m_Device, queryPool, nullptr);
+    if (result != VK_SUCCESS) {
+        return;
+    }
 
-    VkDeviceAddress instanceBufferAddress = GetBufferAddress(instanceBuffer);
+    std::vector<VkBuffer> readbackBuffers(count, VK_NULL_HANDLE);
+    std::vector<MemoryAllocation> readbackMemory(count);
+    cmdBuff = GetUploadCommandBuffer();
+    for (uint32_t i = 0; i < count; ++i) {
+        if (serializedSizes[i] == 0) {
+            continue;
+        }
+        CreateBuffer(serializedSizes[i], VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, readbackBuffers[i], readbackMemory[i]);
 
-    VkMemoryBarrier barrier{
+        VkCopyAccelerationStructureToMemoryInfoKHR copyInfo{
+            VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_INFO_KHR,   // sType
+            nullptr,                                                            // pNext
+            handles[i],                                                         // src
+            { GetBufferAddress(readbackBuffers[i]) },                           // dst
+            VK_COPY_ACCELERATION_STRUCTURE_MODE_SERIALIZE_KHR                   // mode
+        };
+        vkCmdCopyAccelerationStructureToMemoryKHR(cmdBuff, &copyInfo);
+    }
+    VkMemoryBarrier hostBarrier{
         VK_STRUCTURE_TYPE_MEMORY_BARRIER,                           // sType;
         nullptr,                                                    // pNext;
         VK_ACCESS_TRANSFER_WRITE_BIT,                               // srcAccessMask;
-        VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR              // dstAccessMask;
+        VK_ACCESS_HOST_READ_BIT                                     // dstAccessMask;
     };
+    vkCmdPipelineBarrier(cmdBuff, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_HOST_BIT,
+        0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+    FlushUploads();
 
-    vkCmdPipelineBarrier(cmdBuff, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
-        0, 1, &barrier, 0, nullptr, 0, nullptr);
+    VkDeviceSize totalSize = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (readbackBuffers[i] == VK_NULL_HANDLE) {
+            continue;
+        }
+        const BlasInput &input = inputs[slots[i]];
+        BlasCache::Store(input.cachePath, input.cacheKey, MapMemory(readbackMemory[i]), static_cast<size_t>(serializedSizes[i]));
+        totalSize += serializedSizes[i];
+        vkDestroyBuffer(m_Device, readbackBuffers[i], nullptr);
+        m_Allocator.Free(readbackMemory[i]);
+    }
 
-    VkAccelerationStructureGeometryInstancesDataKHR asGeometryInstances{
-        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,   // sType
-        nullptr,                                                                // pNext
-        VK_FALSE,                                                               // arrayOfPointers
-        instanceBufferAddress                                                   // data
-    };
+    std::cout << count << " BLAS serialized to cache, " << totalSize / 1024 << " KiB" << std::endl;
+}
+
+void VulkanFactory::CreateTLAS(TopLevelAS& tlas, uint32_t maxInstances, VkBuildAccelerationStructureFlagsKHR flags) {
+    tlas = TopLevelAS();
+    tlas.flags = flags;
+    tlas.maxInstances = std::max(maxInstances, 1u);
+    tlas.frameCount = static_cast<uint32_t>(m_SwapChainImages.size());
+
+    VkDeviceSize instanceSize = (VkDeviceSize)tlas.frameCount * tlas.maxInstances * sizeof(VkAccelerationStructureInstanceKHR);
+    CreateBuffer(instanceSize, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, tlas.instanceBuffer, tlas.instanceMemory);
+    tlas.instances = static_cast<VkAccelerationStructureInstanceKHR*>(MapMemory(tlas.instanceMemory));
+    tlas.instanceAddress = GetBufferAddress(tlas.instanceBuffer);
 
     VkAccelerationStructureGeometryKHR asGeometry{
         VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,      // sType
@@ -1545,21 +2505,25 @@ void VulkanFactory::CreateTLAS(AccelerationStructure& tlas,VkAccelerationStructu
         {},                                                         // geometry
         0                                                           // flags
     };
-    asGeometry.geometry.instances = asGeometryInstances; // for some reason it didn't let me do it in previous call
+    asGeometry.geometry.instances = {
+        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,   // sType
+        nullptr,                                                                // pNext
+        VK_FALSE,                                                               // arrayOfPointers
+        {}                                                                      // data
+    };
 
     VkAccelerationStructureBuildGeometryInfoKHR asBuildGeometryInfo{
         VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,   // sType
         nullptr,                                                            // pNext
         VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,                       // type
         flags,                                                              // flags
-        update ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR :
-                 VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,            // mode
+        VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,                     // mode
         VK_NULL_HANDLE,                                                     // srcAccelerationStructure
         VK_NULL_HANDLE,                                                     // dstAccelerationStructure
         1,                                                                  // geometryCount
         &asGeometry,                                                        // pGeometries
         nullptr,                                                            // ppGeometries
-        0                                                                   // scratchData
+        {}                                                                  // scratchData
     };
 
     VkAccelerationStructureBuildSizesInfoKHR asBuildSizesInfo{
@@ -1569,66 +2533,127 @@ void VulkanFactory::CreateTLAS(AccelerationStructure& tlas,VkAccelerationStructu
         0,                                                              // updateScratchSize
         0                                                               // buildScratchSize
     };
-    uint32_t count{ 1 };
-    vkGetAccelerationStructureBuildSizesKHR(m_Device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &asBuildGeometryInfo, &count, &asBuildSizesInfo);
+    vkGetAccelerationStructureBuildSizesKHR(m_Device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &asBuildGeometryInfo, &tlas.maxInstances, &asBuildSizesInfo);
 
     CreateBuffer(asBuildSizesInfo.accelerationStructureSize, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR |
-        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, 0, tlas.buffer, tlas.memory);
-
-    if (!update) {
-        VkAccelerationStructureCreateInfoKHR asCreateInfo{
-            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,   // sType
-            nullptr,                                                    // pNext
-            0,                                                          // createFlags
-            tlas.buffer,                                                // buffer
-            0,                                                          // offset
-            asBuildSizesInfo.accelerationStructureSize,                 // size
-            VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,               // type
-            0                                                           // deviceAddress
-        };
+        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, 0, tlas.structure.buffer, tlas.structure.memory);
 
-        vkCreateAccelerationStructureKHR(m_Device, &asCreateInfo, nullptr, &tlas.as);
+    VkAccelerationStructureCreateInfoKHR asCreateInfo{
+        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,   // sType
+        nullptr,                                                    // pNext
+        0,                                                          // createFlags
+        tlas.structure.buffer,                                      // buffer
+        0,                                                          // offset
+        asBuildSizesInfo.accelerationStructureSize,                 // size
+        VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,               // type
+        0                                                           // deviceAddress
+    };
+    if (vkCreateAccelerationStructureKHR(m_Device, &asCreateInfo, nullptr, &tlas.structure.as) != VK_SUCCESS) {
+        throw std::runtime_error("cannot create acceleration structure");
     }
 
-    VkBuffer scratchBuffer{};
-    VkDeviceMemory scratchMemory{};
-    CreateBuffer(asBuildSizesInfo.buildScratchSize, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-        0, scratchBuffer, scratchMemory);
+    // one scratch serves builds and refits, they never overlap
+    VkDeviceSize scratchSize = std::max(asBuildSizesInfo.buildScratchSize, asBuildSizesInfo.updateScratchSize);
+    CreateBuffer(scratchSize, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        0, tlas.scratchBuffer, tlas.scratchMemory);
+    tlas.scratchAddress = GetBufferAddress(tlas.scratchBuffer);
+}
 
-    VkDeviceAddress scratchAddress = GetBufferAddress(scratchBuffer);
-    
-    asBuildGeometryInfo.scratchData.deviceAddress = scratchAddress;
+void VulkanFactory::BuildTLAS(VkCommandBuffer cmdBuff, TopLevelAS& tlas, const VkAccelerationStructureInstanceKHR* instances, uint32_t instanceCount, uint32_t frame) {
+    if (instanceCount > tlas.maxInstances || frame >= tlas.frameCount) {
+        throw std::runtime_error("TLAS instance slice out of range");
+    }
+    // host coherent, the write is visible to the build once the command buffer is submitted
+    VkDeviceSize sliceOffset = (VkDeviceSize)frame * tlas.maxInstances;
+    memcpy(tlas.instances + sliceOffset, instances, instanceCount * sizeof(VkAccelerationStructureInstanceKHR));
+
+    bool update = tlas.built && (tlas.flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR)
+        && tlas.builtInstances == instanceCount && tlas.refitsSinceBuild < TlasRefitsPerRebuild;
     if (update) {
-        asBuildGeometryInfo.srcAccelerationStructure = tlas.as;
+        ++tlas.refitsSinceBuild;
+    } else {
+        tlas.built = true;
+        tlas.builtInstances = instanceCount;
+        tlas.refitsSinceBuild = 0;
     }
-    asBuildGeometryInfo.dstAccelerationStructure = tlas.as;
 
-    const VkAccelerationStructureBuildRangeInfoKHR *asBuildRangeInfo = new VkAccelerationStructureBuildRangeInfoKHR{
-        1,                                                          // primitiveCount
+    VkAccelerationStructureGeometryKHR asGeometry{
+        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,      // sType
+        nullptr,                                                    // pNext
+        VK_GEOMETRY_TYPE_INSTANCES_KHR,                             // geometryType
+        {},                                                         // geometry
+        0                                                           // flags
+    };
+    asGeometry.geometry.instances = {
+        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,   // sType
+        nullptr,                                                                // pNext
+        VK_FALSE,                                                               // arrayOfPointers
+        { tlas.instanceAddress + sliceOffset * sizeof(VkAccelerationStructureInstanceKHR) }  // data
+    };
+
+    VkAccelerationStructureBuildGeometryInfoKHR asBuildGeometryInfo{
+        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,   // sType
+        nullptr,                                                            // pNext
+        VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,                       // type
+        tlas.flags,                                                         // flags
+        update ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR :
+                 VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,            // mode
+        update ? tlas.structure.as : VK_NULL_HANDLE,                        // srcAccelerationStructure
+        tlas.structure.as,                                                  // dstAccelerationStructure
+        1,                                                                  // geometryCount
+        &asGeometry,                                                        // pGeometries
+        nullptr,                                                            // ppGeometries
+        { tlas.scratchAddress }                                             // scratchData
+    };
+
+    VkAccelerationStructureBuildRangeInfoKHR asBuildRangeInfo{
+        instanceCount,                                              // primitiveCount
         0,                                                          // primitiveOffset
         0,                                                          // firstVertex
         0                                                           // transformOffset
     };
+    const VkAccelerationStructureBuildRangeInfoKHR *pAsBuildRangeInfo = &asBuildRangeInfo;
 
-    vkCmdBuildAccelerationStructuresKHR(cmdBuff, 1, &asBuildGeometryInfo, &asBuildRangeInfo);
+    // rays of the previous frame may still traverse the TLAS and BLASes may come from the upload batch
+    VkMemoryBarrier barrier{
+        VK_STRUCTURE_TYPE_MEMORY_BARRIER,                           // sType;
+        nullptr,                                                    // pNext;
+        VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR |
+        VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,             // srcAccessMask;
+        VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR |
+        VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR              // dstAccessMask;
+    };
+    vkCmdPipelineBarrier(cmdBuff, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
 
-    EndSingleTimeCommands(cmdBuff);
+    vkCmdBuildAccelerationStructuresKHR(cmdBuff, 1, &asBuildGeometryInfo, &pAsBuildRangeInfo);
+
+    barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+    vkCmdPipelineBarrier(cmdBuff, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
 
-    vkFreeMemory(m_Device, scratchMemory, nullptr);
-    vkFreeMemory(m_Device, instanceMemory, nullptr);
+void VulkanFactory::DestroyTLAS(TopLevelAS& tlas) {
+    DestroyAccelerationStructure(tlas.structure);
+    vkDestroyBuffer(m_Device, tlas.instanceBuffer, nullptr);
+    m_Allocator.Free(tlas.instanceMemory);
+    vkDestroyBuffer(m_Device, tlas.scratchBuffer, nullptr);
+    m_Allocator.Free(tlas.scratchMemory);
+    tlas = TopLevelAS();
 }
 
 void VulkanFactory::CreateRtDescriptorSets(AccelerationStructure tlas, VkDescriptorSetLayout descriptorSetLayout, VkDescriptorPool descriptorPool,
-                                            std::vector<VkDescriptorSet>& descriptorSets, std::vector<VkImageView> &imageViews) {
-    std::vector<VkDescriptorSetLayout> layouts(m_SwapChainImages.size(), descriptorSetLayout);
+                                            std::vector<VkDescriptorSet>& descriptorSets, const std::vector<OffscreenRender> &targets) {
+    std::vector<VkDescriptorSetLayout> layouts(targets.size(), descriptorSetLayout);
     VkDescriptorSetAllocateInfo allocateInfo = {
         VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,             // sType
         nullptr,                                                    // pNext
         descriptorPool,                                             // descriptorPool
-        static_cast<uint32_t>(imageViews.size()),                   // descriptorSetCount
+        static_cast<uint32_t>(targets.size()),                      // descriptorSetCount
         layouts.data()                                              // pSetLayouts
     };
-    descriptorSets.resize(imageViews.size());
+    descriptorSets.resize(targets.size());
 
     if (vkAllocateDescriptorSets(m_Device, &allocateInfo, descriptorSets.data()) != VK_SUCCESS) {
         throw std::runtime_error("cannot allocate descriptor sets");
@@ -1642,13 +2667,7 @@ void VulkanFactory::CreateRtDescriptorSets(AccelerationStructure tlas, VkDescrip
             &tlas.as                                                            // pAccelerationStructures
         };
 
-        VkDescriptorImageInfo imageInfo = {
-            {},                                                     // sampler
-            imageViews[i],                                          // imageView
-            VK_IMAGE_LAYOUT_GENERAL                                 // imageLayout
-        };
-
-        std::array<VkWriteDescriptorSet, 2> writeDescriptorSet{};
+        std::array<VkWriteDescriptorSet, 1> writeDescriptorSet{};
 
         writeDescriptorSet[0] = {
             VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,                 // sType
@@ -1663,44 +2682,37 @@ void VulkanFactory::CreateRtDescriptorSets(AccelerationStructure tlas, VkDescrip
             nullptr                                                 // pTexelBufferView
         };
 
-        writeDescriptorSet[1] = {
-            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,                 // sType
-            nullptr,                                                // pNext
-            descriptorSets[i],                                      // dstSet
-            1,                                                      // dstBinding
-            0,                                                      // dstArrayElement
-            1,                                                      // descriptorCount
-            VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,                       // descriptorType
-            &imageInfo,                                             // pImageInfo
-            nullptr,                                                // pBufferInfo
-            nullptr                                                 // pTexelBufferView
-        };
-
         vkUpdateDescriptorSets(m_Device, static_cast<uint32_t>(writeDescriptorSet.size()), writeDescriptorSet.data(), 0, nullptr);
     }
+    UpdateRtDescriptorSets(descriptorSets, targets);
 }
 
-void VulkanFactory::UpdateRtDescriptorSets(std::vector<VkDescriptorSet>& descriptorSets) {
+void VulkanFactory::UpdateRtDescriptorSets(const std::vector<VkDescriptorSet>& descriptorSets, const std::vector<OffscreenRender> &targets) {
     for (uint32_t i = 0; i < descriptorSets.size(); ++i) {
-        VkDescriptorImageInfo imageInfo = {
-            {},                                                     // sampler
-            m_SwapChainImageViews[i],                               // imageView
-            VK_IMAGE_LAYOUT_GENERAL                                 // imageLayout
-        };
-
-        std::array<VkWriteDescriptorSet, 1> writeDescriptorSet{};
-        writeDescriptorSet[0] = {
-            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,                 // sType
-            nullptr,                                                // pNext
-            descriptorSets[i],                                      // dstSet
-            1,                                                      // dstBinding
-            0,                                                      // dstArrayElement
-            1,                                                      // descriptorCount
-            VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,                       // descriptorType
-            &imageInfo,                                             // pImageInfo
-            nullptr,                                                // pBufferInfo
-            nullptr                                                 // pTexelBufferView
-        };
+        std::array<VkDescriptorImageInfo, 6> imageInfos = { {
+            { {}, targets[i].targetImageView, VK_IMAGE_LAYOUT_GENERAL },
+            { {}, targets[i].accumulationImageView, VK_IMAGE_LAYOUT_GENERAL },
+            { {}, targets[i].momentsImageView, VK_IMAGE_LAYOUT_GENERAL },
+            { {}, targets[i].sampleCountImageView, VK_IMAGE_LAYOUT_GENERAL },
+            { {}, targets[i].gbufferImageView, VK_IMAGE_LAYOUT_GENERAL },
+            { {}, targets[i].motionImageView, VK_IMAGE_LAYOUT_GENERAL }
+        } };
+
+        std::array<VkWriteDescriptorSet, 6> writeDescriptorSet{};
+        for (uint32_t j = 0; j < imageInfos.size(); ++j) {
+            writeDescriptorSet[j] = {
+                VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,             // sType
+                nullptr,                                            // pNext
+                descriptorSets[i],                                  // dstSet
+                j + 1,                                              // dstBinding
+                0,                                                  // dstArrayElement
+                1,                                                  // descriptorCount
+                VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,                   // descriptorType
+                &imageInfos[j],                                     // pImageInfo
+                nullptr,                                            // pBufferInfo
+                nullptr                                             // pTexelBufferView
+            };
+        }
 
         vkUpdateDescriptorSets(m_Device, static_cast<uint32_t>(writeDescriptorSet.size()), writeDescriptorSet.data(), 0, nullptr);
     }
@@ -1825,15 +2837,10 @@ void VulkanFactory::CreateRtPipeline(const std::vector<VkDescriptorSetLayout>& r
     }
 }
 
-template <class integral>
-constexpr integral alignUp(integral x, size_t a) noexcept {
-    return integral((x + (integral(a) - 1)) & ~integral(a - 1));
-}
-
 void VulkanFactory::CreateShaderBindingTable(VkPipeline& rtPipeline, VkStridedDeviceAddressRegionKHR& rgenRegion, VkStridedDeviceAddressRegionKHR& missRegion,
-                                VkStridedDeviceAddressRegionKHR& hitRegion, VkStridedDeviceAddressRegionKHR& callRegion, VkBuffer& sbtBuffer, VkDeviceMemory& sbtMemory) {
+                                VkStridedDeviceAddressRegionKHR& hitRegion, VkStridedDeviceAddressRegionKHR& callRegion, VkBuffer& sbtBuffer, MemoryAllocation& sbtMemory) {
     uint32_t missCount{ 3 };
-    uint32_t hitCount{ 1 };
+    uint32_t hitCount{ HitGroupCount };
     uint32_t handleCount{ 1 + missCount + hitCount };
 
     VkPhysicalDeviceRayTracingPipelinePropertiesKHR rtProperties{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR };
@@ -1872,8 +2879,7 @@ void VulkanFactory::CreateShaderBindingTable(VkPipeline& rtPipeline, VkStridedDe
 
     auto getHandle = [&](uint32_t i) { return handles.data() + i * handleSize; };
 
-    uint8_t *pSBTBuffer{ nullptr };
-    vkMapMemory(m_Device, sbtMemory, 0, sbtSize, 0, reinterpret_cast<void**>(&pSBTBuffer));
+    uint8_t *pSBTBuffer = static_cast<uint8_t*>(MapMemory(sbtMemory));
     uint8_t *pData{ pSBTBuffer };
     uint32_t handleIdx{ 0 };
 
@@ -1890,10 +2896,8 @@ void VulkanFactory::CreateShaderBindingTable(VkPipeline& rtPipeline, VkStridedDe
         memcpy(pData, getHandle(handleIdx++), handleSize);
         pData += hitRegion.stride;
     }
-
-    vkUnmapMemory(m_Device, sbtMemory);
 }
 
-void VulkanFactory::TraceRays(VkCommandBuffer cmdBuff, const VkStridedDeviceAddressRegionKHR *rgenRegion, const VkStridedDeviceAddressRegionKHR *missRegion, const VkStridedDeviceAddressRegionKHR *hitRegion, const VkStridedDeviceAddressRegionKHR *callRegion) {
-    vkCmdTraceRaysKHR(cmdBuff, rgenRegion, missRegion, hitRegion, callRegion, m_SwapChainExtent.width, m_SwapChainExtent.height, 1);
+void VulkanFactory::TraceRays(VkCommandBuffer cmdBuff, const VkStridedDeviceAddressRegionKHR *rgenRegion, const VkStridedDeviceAddressRegionKHR *missRegion, const VkStridedDeviceAddressRegionKHR *hitRegion, const VkStridedDeviceAddressRegionKHR *callRegion, uint32_t width, uint32_t height) {
+    vkCmdTraceRaysKHR(cmdBuff, rgenRegion, missRegion, hitRegion, callRegion, width, height, 1);
 }
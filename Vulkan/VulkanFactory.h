@@ -2,6 +2,8 @@
 
 #include "CommonHeaders.h"
 #include "Vertex.h"
+#include "MemoryAllocator.h"
+#include "StagingRing.h"
 
 const std::vector<const char*> validationLayers = {
 #ifdef _DEBUG
@@ -24,22 +26,88 @@ struct SwapChainSupportDetails {
 
 struct AccelerationStructure {
     VkBuffer buffer;
-    VkDeviceMemory memory;
+    MemoryAllocation memory;
     VkAccelerationStructureKHR as;
 };
 
+// geometry of one bottom level structure; transform is applied to the positions while building, e.g. to undo their quantization.
+// With a cachePath the structure is deserialized from there when the file was written for cacheKey, and stored there after building otherwise
+struct BlasInput {
+    VkBuffer vertexBuffer;
+    VkFormat vertexFormat;
+    VkDeviceSize vertexStride;
+    uint32_t vertexNo;
+    VkBuffer indexBuffer;
+    VkIndexType indexType;
+    uint32_t primitiveNo;
+    glm::mat4 transform;
+    std::string cachePath;                                  // empty keeps the structure out of the cache
+    uint64_t cacheKey;                                      // hash of the geometry and everything above
+    const void *hostVertexData;                             // same contents as the buffers, null unless the CPU may build
+    const void *hostIndexData;
+};
+
+// lives as long as its scene: storage sized for maxInstances, its own scratch and a persistently mapped instance buffer
+// with one slice per swapchain image, so writing this frame's instances never touches the ones still in flight
+struct TopLevelAS {
+    AccelerationStructure structure;
+    VkBuffer instanceBuffer;
+    MemoryAllocation instanceMemory;
+    VkAccelerationStructureInstanceKHR *instances;          // mapped, frameCount slices of maxInstances
+    VkDeviceAddress instanceAddress;
+    VkBuffer scratchBuffer;
+    MemoryAllocation scratchMemory;
+    VkDeviceAddress scratchAddress;
+    VkBuildAccelerationStructureFlagsKHR flags;
+    uint32_t maxInstances;
+    uint32_t frameCount;
+    bool built;
+    uint32_t builtInstances;                                // instance count of the last full build
+    uint32_t refitsSinceBuild;
+};
+
+// where the hit shader takes its BRDF samples from, see shaders/Sampling.glsl
+enum class SampleSequence : uint32_t {
+    Random,                                                 // PCG per pixel and frame
+    Sobol,                                                  // Owen scrambled per pixel
+    R2,                                                     // offset by the blue noise of the pixel
+    Count
+};
+
 struct RtPushConstants {
     bool useLtc;
     float ax;
     float ay;
+    uint32_t frame;                                         // seeds the per pixel sequences, differs every frame
+    uint32_t samples;                                       // BRDF samples per hit this frame
+    uint32_t accumulated;                                   // frames already averaged into the accumulation image
+    SampleSequence sequence;
+    uint32_t checkerboard;                                  // nonzero traces half the pixels, see Checkerboard
+    uint32_t checkerboardParity;                            // the traced half, pixels with x + y + parity even
 };
 
 struct OffscreenRender {
     VkImage targetImage;
-    VkDeviceMemory targetImageMemory;
+    MemoryAllocation targetImageMemory;
     VkImageView targetImageView;
     VkSampler targetSampler;
 
+    VkImage accumulationImage;                              // running average since the last reset, alpha counts its samples
+    MemoryAllocation accumulationImageMemory;
+    VkImageView accumulationImageView;
+    VkImage momentsImage;                                   // per sample mean luminance and mean squared luminance
+    MemoryAllocation momentsImageMemory;
+    VkImageView momentsImageView;
+    VkImage sampleCountImage;                               // samples per pixel for the next frame, 0 once converged
+    MemoryAllocation sampleCountImageMemory;
+    VkImageView sampleCountImageView;
+    VkImage gbufferImage;                                   // world normal and primary hit distance, negative for the sky
+    MemoryAllocation gbufferImageMemory;
+    VkImageView gbufferImageView;
+    VkImage motionImage;                                    // where the primary hit was in the previous frame, in UV
+    MemoryAllocation motionImageMemory;
+    VkImageView motionImageView;
+
     VkDescriptorSetLayout descriptorSetLayout;
     VkDescriptorPool descriptorPool;
     VkDescriptorSet descriptorSet;
@@ -51,6 +119,19 @@ private:
     PFN_vkGetAccelerationStructureBuildSizesKHR vkGetAccelerationStructureBuildSizesKHR;
     PFN_vkCmdBuildAccelerationStructuresKHR vkCmdBuildAccelerationStructuresKHR;
     PFN_vkCreateAccelerationStructureKHR vkCreateAccelerationStructureKHR;
+    PFN_vkDestroyAccelerationStructureKHR vkDestroyAccelerationStructureKHR;
+    PFN_vkCmdWriteAccelerationStructuresPropertiesKHR vkCmdWriteAccelerationStructuresPropertiesKHR;
+    PFN_vkCmdCopyAccelerationStructureKHR vkCmdCopyAccelerationStructureKHR;
+    PFN_vkCmdCopyAccelerationStructureToMemoryKHR vkCmdCopyAccelerationStructureToMemoryKHR;
+    PFN_vkCmdCopyMemoryToAccelerationStructureKHR vkCmdCopyMemoryToAccelerationStructureKHR;
+    PFN_vkGetDeviceAccelerationStructureCompatibilityKHR vkGetDeviceAccelerationStructureCompatibilityKHR;
+    PFN_vkBuildAccelerationStructuresKHR vkBuildAccelerationStructuresKHR;
+    PFN_vkWriteAccelerationStructuresPropertiesKHR vkWriteAccelerationStructuresPropertiesKHR;
+    PFN_vkCreateDeferredOperationKHR vkCreateDeferredOperationKHR;
+    PFN_vkDestroyDeferredOperationKHR vkDestroyDeferredOperationKHR;
+    PFN_vkGetDeferredOperationMaxConcurrencyKHR vkGetDeferredOperationMaxConcurrencyKHR;
+    PFN_vkGetDeferredOperationResultKHR vkGetDeferredOperationResultKHR;
+    PFN_vkDeferredOperationJoinKHR vkDeferredOperationJoinKHR;
     PFN_vkGetRayTracingShaderGroupHandlesKHR vkGetRayTracingShaderGroupHandlesKHR;
     PFN_vkCmdTraceRaysKHR vkCmdTraceRaysKHR;
     PFN_vkGetAccelerationStructureDeviceAddressKHR vkGetAccelerationStructureDeviceAddressKHR;
@@ -61,6 +142,9 @@ private:
     static std::mutex m_Mutex;
 
     GLFWwindow *m_Window;
+    bool m_Headless = false;
+    uint32_t m_HeadlessFrameCount = 0;
+    std::vector<const char*> m_DeviceExtensions;
 
     VkInstance m_VkInstance;
     VkPhysicalDevice m_PhysicalDevice;
@@ -68,6 +152,44 @@ private:
     VkDevice m_Device;
     VkQueue m_Queue;
     VkSurfaceKHR m_Surface;
+    MemoryAllocator m_Allocator;
+
+    static constexpr VkDeviceSize StagingRingSize = 32ull * 1024 * 1024;
+    StagingRing m_StagingRing;
+    VkBuffer m_StagingBuffer;
+    MemoryAllocation m_StagingMemory;
+
+    // upload context: transfers, layout transitions and AS builds are batched into one command buffer
+    // and submitted on the graphics queue, completion is tracked with a timeline semaphore
+    struct UploadSubmission {
+        uint64_t ticket;
+        VkCommandBuffer cmdBuffer;
+    };
+    struct DeferredRelease {
+        uint64_t ticket;
+        VkBuffer buffer;
+        MemoryAllocation memory;
+        VkAccelerationStructureKHR as;                      // VK_NULL_HANDLE for a plain buffer
+    };
+    VkCommandPool m_UploadCommandPool;
+    VkCommandBuffer m_UploadCmdBuffer = VK_NULL_HANDLE;
+    VkSemaphore m_UploadTimeline;
+    uint64_t m_UploadTicket = 0;
+    std::deque<UploadSubmission> m_UploadsInFlight;
+    std::vector<VkCommandBuffer> m_FreeUploadCmdBuffers;
+    std::vector<DeferredRelease> m_DeferredReleases;
+
+    // scratch memory shared by all BLAS builds, grown to the largest batch seen (capped by the budget)
+    static constexpr VkDeviceSize ScratchPoolBudget = 64ull * 1024 * 1024;
+    // refits keep the hierarchy of the last full build, which fits worse the further instances move from where they were
+    static constexpr uint32_t TlasRefitsPerRebuild = 120;
+    VkBuffer m_ScratchBuffer = VK_NULL_HANDLE;
+    MemoryAllocation m_ScratchMemory;
+    VkDeviceAddress m_ScratchAddress = 0;
+    VkDeviceSize m_ScratchSize = 0;
+    VkDeviceSize m_ScratchAlignment = 0;
+    // BLASes with host copies of their geometry are built by the CPU when the device supports it
+    bool m_HostAsBuilds = false;
 
     VkSwapchainKHR m_SwapChain;
     std::vector<VkImage> m_SwapChainImages;
@@ -75,9 +197,10 @@ private:
     VkFormat m_SwapChainImageFormat;
     VkExtent2D m_SwapChainExtent;
     std::vector<VkFramebuffer> m_SwapChainFramebuffers;
+    std::vector<MemoryAllocation> m_HeadlessImageMemory;
 
     VkImage m_DepthImage;
-    VkDeviceMemory m_DepthImageMemory;
+    MemoryAllocation m_DepthImageMemory;
     VkImageView m_DepthImageView;
 
     VkCommandPool m_CommandPool;
@@ -94,13 +217,18 @@ private:
 private:
     VulkanFactory() {};
 
+    void InitDevice();
     void CreateVkInstance();
 
     void PickPhysicalDevice();
     void CreateLogicalDevice();
     void QueryFunctionPointers();
+    void CreateUploadContext();
+    void CreateStagingRing();
+    void RetireUploads();
 
     void CreateSwapChain();
+    void CreateHeadlessImages();
     void CreateSwapchainImageViews();
     void CreateFramebuffers();
 
@@ -114,7 +242,13 @@ private:
 
     void CreateSemaphores();
 
+    void CreateOffscreenImages(OffscreenRender &render);
+    void UpdateOffscreenDescriptorSet(OffscreenRender &render);
+
 public:
+    // hit groups CreateRtPipeline builds and CreateShaderBindingTable lays out, one closest hit shader so far
+    static constexpr uint32_t HitGroupCount = 1;
+
     ~VulkanFactory();
     VulkanFactory(VulkanFactory &other) = delete;
     void operator=(VulkanFactory &other) = delete;
@@ -128,20 +262,37 @@ public:
     }
 
     void InitVulkan(GLFWwindow *window);
+    void InitVulkanHeadless(uint32_t width, uint32_t height, uint32_t frameCount);
     void RecreateSwapChain();
     void CleanupSwapChain();
     void Cleanup();
 
-    VkCommandBuffer BeginSingleTimeCommands();
-    void EndSingleTimeCommands(VkCommandBuffer buffer);
+    VkCommandBuffer GetUploadCommandBuffer();
+    uint64_t SubmitUploads();
+    void WaitForUpload(uint64_t ticket);
+    void FlushUploads() { WaitForUpload(SubmitUploads()); }
+    void ReleaseAfterUpload(VkBuffer buffer, MemoryAllocation &memory);
+    void ReleaseAfterUpload(AccelerationStructure &as);
+    VkDeviceSize GetScratchAlignment();
+    void ReserveScratch(VkDeviceSize size);
+    std::vector<AccelerationStructure> BuildBLASes(const std::vector<BlasInput> &inputs, bool compact);
+    std::vector<AccelerationStructure> HostBuildBLASes(const std::vector<BlasInput> &inputs, bool compact);
+    void CompactBLASes(std::vector<AccelerationStructure> &blases, const std::vector<VkDeviceSize> &buildSizes);
+    bool LoadCachedBLAS(const BlasInput &input, AccelerationStructure &blas);
+    void StoreCachedBLASes(const std::vector<AccelerationStructure> &blases, const std::vector<BlasInput> &inputs);
     void CreateTextureDescriptorSets(std::vector<VkDescriptorSet> &descriptorSets, VkImageView &textureImageView, VkSampler &textureSampler, VkDescriptorSetLayout &layout, VkDescriptorPool &pool);
     void CreateMultipleTextureDescriptorSets(std::vector<VkDescriptorSet> &descriptorSets, std::vector<VkDescriptorImageInfo> &imageInfos, VkDescriptorSetLayout &layout, VkDescriptorPool &pool);
     void CreateDescriptorSets(std::vector<VkDescriptorSet> &descriptorSets, VkDescriptorSetLayout &layout, VkDescriptorPool &pool);
     void AllocateSecondaryCommandBuffer(std::vector<VkCommandBuffer> &cmdBuffer);
-    void CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer &buffer, VkDeviceMemory &memory);
+    void CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer &buffer, MemoryAllocation &memory);
+    void *MapMemory(const MemoryAllocation &memory);
+    void FreeMemory(MemoryAllocation &memory) { m_Allocator.Free(memory); }
+    void DumpMemoryStatistics() { m_Allocator.DumpStatistics(); }
     void CopyBuffer(VkBuffer &srcBuffer, VkBuffer &dstBuffer, VkDeviceSize size);
+    void UploadToBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void *data, VkDeviceSize size);
+    void UploadToImage(VkImage dstImage, const void *data, uint32_t width, uint32_t height, uint32_t depth, uint32_t texelSize, uint32_t faceNo);
     void CreateImage(uint32_t width, uint32_t height, uint32_t depth, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
-        VkMemoryPropertyFlags properties, VkImage &img, VkDeviceMemory &imgMem, uint32_t arrayLayers, uint32_t flags = 0, uint32_t mipLevels = 1);
+        VkMemoryPropertyFlags properties, VkImage &img, MemoryAllocation &imgMem, uint32_t arrayLayers, uint32_t flags = 0, uint32_t mipLevels = 1);
     void GenerateMipMaps(VkImage &image, uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t arrayLayers);
     void TransitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t layerCount, uint32_t mipLevels = 1);
     void CopyBufferToImage(VkBuffer &srcBuffer, VkImage dstImage, uint32_t width, uint32_t height, uint32_t depth, uint32_t faceNo);
@@ -153,8 +304,12 @@ public:
         VkPipelineLayout &pipelineLayout);
     void CreateGraphicsPipeline(std::vector<VkPipelineShaderStageCreateInfo> &shaderStages, VkPipelineVertexInputStateCreateInfo &vertexInput,
         VkPipelineLayout &pipelineLayout, VkPipeline &graphicsPipeline, uint32_t culling, uint32_t depthEnabled);
+    void CreateComputePipeline(const std::string &shaderFilename, VkPipelineLayout pipelineLayout, VkPipeline &computePipeline);
     void CreateTextureSampler(VkSampler &textureSampler);
     OffscreenRender &&CreateOffscreenRenderer();
+    // recreates the images of a target at the current extent
+    void ResizeOffscreenRenderer(OffscreenRender &render);
+    void ReadbackImage(uint32_t index, const std::string &filename);
 
     void FetchRenderTimeResults(uint32_t index) {
 #define TIMING_OFF
@@ -201,15 +356,29 @@ public:
     // RT
     VkDeviceAddress GetBufferAddress(VkBuffer buffer);
     VkDeviceAddress GetAccelerationStructureAddress(VkAccelerationStructureKHR as);
-    AccelerationStructure &&CreateBLAS(VkBuffer vertexBuffer, VkBuffer indexBuffer, uint32_t vertexNo, uint32_t indexNo);
-    void CreateTLAS(AccelerationStructure &tlas, VkAccelerationStructureInstanceKHR &asInstance, VkBuildAccelerationStructureFlagsKHR flags, uint32_t primitiveCount, bool update);
-    void CreateRtDescriptorSets(AccelerationStructure tlas, VkDescriptorSetLayout descriptorSetLayout, VkDescriptorPool descriptorPool, std::vector<VkDescriptorSet> &descriptorSets, std::vector<VkImageView> &imageViews);
-    void UpdateRtDescriptorSets(std::vector<VkDescriptorSet> &descriptorSets);
+    // records every build into the upload batch, as few build commands as the scratch pool allows; compacting waits
+    // for the builds to read back their compacted sizes and then copies each into storage of exactly that size.
+    // Inputs found in their cache are deserialized instead, the ones built are serialized to it, which waits for the batch.
+    // When the device takes host commands and every input has host data the builds run on the thread pool instead and the
+    // upload batch only receives the copies into device local storage
+    std::vector<AccelerationStructure> CreateBLASes(const std::vector<BlasInput> &inputs, bool compact = true);
+    AccelerationStructure CreateBLAS(const BlasInput &input, bool compact = true) { return CreateBLASes({ input }, compact)[0]; }
+    void DestroyAccelerationStructure(AccelerationStructure &as);
+    void CreateTLAS(TopLevelAS &tlas, uint32_t maxInstances, VkBuildAccelerationStructureFlagsKHR flags);
+    // copies the instances into the slice of frame and records into cmdBuff a refit, or a full build when the instance count
+    // changed, the flags do not allow updates or TlasRefitsPerRebuild refits have passed; barriers on both sides included
+    void BuildTLAS(VkCommandBuffer cmdBuff, TopLevelAS &tlas, const VkAccelerationStructureInstanceKHR *instances, uint32_t instanceCount, uint32_t frame);
+    void DestroyTLAS(TopLevelAS &tlas);
+    // one set per target: the structure, then the target, accumulation, moments, sample count, G-buffer and motion images
+    void CreateRtDescriptorSets(AccelerationStructure tlas, VkDescriptorSetLayout descriptorSetLayout, VkDescriptorPool descriptorPool, std::vector<VkDescriptorSet> &descriptorSets,
+        const std::vector<OffscreenRender> &targets);
+    // points the image bindings at the images of the targets again
+    void UpdateRtDescriptorSets(const std::vector<VkDescriptorSet> &descriptorSets, const std::vector<OffscreenRender> &targets);
     void CreateRtPipeline(const std::vector<VkDescriptorSetLayout> &rtDescSetLayouts, VkPipelineLayout &pipelineLayout, VkPipeline &rtPipeline, std::vector<VkRayTracingShaderGroupCreateInfoKHR> &shaderGroups);
     void CreateShaderBindingTable(VkPipeline &rtPipeline, VkStridedDeviceAddressRegionKHR &rgenRegion, VkStridedDeviceAddressRegionKHR &missRegion,
-        VkStridedDeviceAddressRegionKHR &hitRegion, VkStridedDeviceAddressRegionKHR &callRegion, VkBuffer &sbtBuffer, VkDeviceMemory &sbtMemory);
+        VkStridedDeviceAddressRegionKHR &hitRegion, VkStridedDeviceAddressRegionKHR &callRegion, VkBuffer &sbtBuffer, MemoryAllocation &sbtMemory);
     void TraceRays(VkCommandBuffer commandBuffer, const VkStridedDeviceAddressRegionKHR *pRaygenShaderBindingTable, const VkStridedDeviceAddressRegionKHR *pMissShaderBindingTable,
-        const VkStridedDeviceAddressRegionKHR *pHitShaderBindingTable, const VkStridedDeviceAddressRegionKHR *pCallableShaderBindingTable);
+        const VkStridedDeviceAddressRegionKHR *pHitShaderBindingTable, const VkStridedDeviceAddressRegionKHR *pCallableShaderBindingTable, uint32_t width, uint32_t height);
 
     VkRenderPass &GetRenderPass() { return m_RenderPass; }
     VkFramebuffer &GetFramebuffer(uint32_t index) { return m_SwapChainFramebuffers[index]; }
@@ -223,4 +392,5 @@ public:
     VkSwapchainKHR &GetSwapchain() { return m_SwapChain; }
     VkFence &GetCmdBuffFence(uint32_t index) { return m_CmdBuffFreeFences[index]; }
     VkQueryPool &GetQueryPool() { return m_QueryPool; }
+    bool IsHeadless() { return m_Headless; }
 };
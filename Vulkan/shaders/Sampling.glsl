@@ -0,0 +1,75 @@
+// Sample sequences of the ray tracing shaders, chosen by SampleSequence in VulkanFactory.h. The sample index of a
+// pixel keeps counting across accumulated frames, so the low discrepancy sequences continue where the last frame
+// stopped instead of starting over.
+
+const uint SequenceRandom = 0;
+const uint SequenceSobol = 1;
+const uint SequenceR2 = 2;
+
+// tileable, two independent channels, see BlueNoise.h
+layout(set = 4, binding = 0) uniform sampler2D blueNoise;
+
+uint Hash(uint x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// PCG step
+float Random(inout uint state) {
+    state = state * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return float(((word >> 22u) ^ word) >> 8) / 16777216.0;
+}
+
+// 24 bits of x make a float in [0, 1)
+float ToUnitFloat(uint x) {
+    return float(x >> 8) / 16777216.0;
+}
+
+// Laine-Karras permutation on the bit reversed value, a nested uniform (Owen) scramble keyed by seed
+uint NestedUniformScramble(uint x, uint seed) {
+    x = bitfieldReverse(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return bitfieldReverse(x);
+}
+
+// first two Sobol dimensions scrambled per seed; every power of two prefix stays stratified
+vec2 SobolOwen(uint index, uint seed) {
+    uint x = bitfieldReverse(index);
+    // direction numbers of the second dimension follow v ^= v >> 1
+    uint y = 0;
+    for (uint v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1) {
+        if ((index & 1) != 0) {
+            y ^= v;
+        }
+    }
+    return vec2(ToUnitFloat(NestedUniformScramble(x, Hash(seed ^ 0xa511e9b3u))), ToUnitFloat(NestedUniformScramble(y, Hash(seed ^ 0x63d83595u))));
+}
+
+// Roberts' R2 in 0.32 fixed point, which stays exact for any index, shifted by offset
+vec2 R2(uint index, vec2 offset) {
+    uvec2 x = index * uvec2(0xc13fa9a9u, 0x91e10da6u);
+    return fract(vec2(x >> 8) / 16777216.0 + offset);
+}
+
+vec2 BlueNoise(uvec2 pixel) {
+    return texelFetch(blueNoise, ivec2(pixel % uvec2(textureSize(blueNoise, 0))), 0).rg;
+}
+
+// sample index of a pixel: Sobol scrambled by the pixel, R2 offset by the blue noise of the pixel, or PCG from state
+vec2 Sample2D(uint sequence, uint index, uvec2 pixel, inout uint state) {
+    if (sequence == SequenceSobol) {
+        return SobolOwen(index, pixel.x + pixel.y * 65536u);
+    } else if (sequence == SequenceR2) {
+        return R2(index, BlueNoise(pixel));
+    }
+    return vec2(Random(state), Random(state));
+}
\ No newline at end of file
@@ -0,0 +1,20 @@
+// Decoding side of VertexFormat.h
+
+// inverse of the octahedral mapping, e in [-1, 1]^2
+vec3 OctDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+// PackedVertex streams read as pairs of 32 bit words; position and normal stay in the quantized space
+vec3 UnpackPosition(uvec2 words) {
+    return vec3(unpackSnorm2x16(words.x), unpackSnorm2x16(words.y).x);
+}
+
+void UnpackAttributes(uvec2 words, out vec3 normal, out vec2 texCoord) {
+    normal = OctDecode(unpackSnorm2x16(words.x));
+    texCoord = unpackHalf2x16(words.y);
+}
@@ -1,5 +1,11 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "VertexFormat.glsl"
+
+// set from VertexLayout::IsPacked, PackedVertex carries an octahedral normal in the quantized space
+layout(constant_id = 0) const bool PackedVertex = false;
 
 layout(push_constant) uniform constants {
     mat4 model;
@@ -8,7 +14,7 @@ layout(push_constant) uniform constants {
 } ubo;
 
 layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec3 inNormal;
+layout(location = 1) in vec4 inNormal;
 layout(location = 2) in vec2 inTexCoord;
 
 layout(location = 0) out vec3 fragColor;
@@ -20,6 +26,7 @@ void main() {
     gl_Position = ubo.projection * ubo.view * ubo.model * vec4(inPosition, 1.0);
     fragTexCoord = inTexCoord;
 
-    fragNormal = normalize(mat3(transpose(inverse(ubo.model))) * inNormal);
+    vec3 normal = PackedVertex ? OctDecode(inNormal.xy) : inNormal.xyz;
+    fragNormal = normalize(mat3(transpose(inverse(ubo.model))) * normal);
     fragCoord = vec3(ubo.model * vec4(inPosition, 1.0));
 }